@@ -97,6 +97,8 @@ using std::vector;
 // Currently it initializes google flags and google logging.
 void GlobalInit(int* pargc, char*** pargv);
 
+class HostAllocator;
+
 // A singleton class to hold common caffe stuff, such as the handler that
 // caffe is going to use for cublas, curand, etc.
 class Caffe {
@@ -161,8 +163,25 @@ class Caffe {
   // Parallel training info
   inline static int solver_count() { return Get().solver_count_; }
   inline static void set_solver_count(int val) { Get().solver_count_ = val; }
+  inline static int solver_rank() { return Get().solver_rank_; }
+  inline static void set_solver_rank(int val) { Get().solver_rank_ = val; }
+  // Whether the solvers are replicas in processes of their own
+  inline static bool multiprocess() { return Get().multiprocess_; }
+  inline static void set_multiprocess(bool val) { Get().multiprocess_ = val; }
   inline static bool root_solver() { return Get().root_solver_; }
   inline static void set_root_solver(bool val) { Get().root_solver_ = val; }
+  // The allocator of the host memory of this thread, read without locking.
+  // Threads start with the process-wide HostAllocator::Get(), or with the
+  // allocator of the thread starting them for an InternalThread.
+  inline static const shared_ptr<HostAllocator>& host_allocator() {
+    return Get().host_allocator_;
+  }
+  // Sets the allocator of this thread; HostAllocator::Set sets the one of
+  // threads started afterwards.
+  inline static void set_host_allocator(
+      const shared_ptr<HostAllocator>& allocator) {
+    Get().host_allocator_ = allocator;
+  }
 
  protected:
 #ifndef CPU_ONLY
@@ -173,7 +192,10 @@ class Caffe {
 
   Brew mode_;
   int solver_count_;
+  int solver_rank_;
+  bool multiprocess_;
   bool root_solver_;
+  shared_ptr<HostAllocator> host_allocator_;
 
  private:
   // The private constructor to avoid duplicate instantiation.
@@ -18,17 +18,39 @@ namespace caffe {
  * are running in parallel, e.g. for multi-GPU training. This makes sure
  * databases are read sequentially, and that each solver accesses a different
  * subset of the database. Data is distributed to solvers in a round-robin
- * way to keep parallel training deterministic.
+ * way to keep parallel training deterministic. Solvers that are replicas in
+ * processes of their own (see Caffe::multiprocess) each read their own slice
+ * of the database instead, the records that round-robin would give them.
+ *
+ * Datums are parsed straight from the memory of the database. If it keeps
+ * its values in place for as long as they are read, as LMDB does, the uint8
+ * pixels of unencoded datums are not copied at all but left there.
+ *
+ * With a shuffle_buffer_size, the reading thread shuffles the records it
+ * streams through a buffer of that many records, so that they do not come
+ * out in database order while the database is still read sequentially.
  */
 class DataReader {
  public:
   explicit DataReader(const LayerParameter& param);
   ~DataReader();
 
-  inline BlockingQueue<Datum*>& free() const {
+  /// @brief A datum read, with its uint8 pixels either in datum.data() or,
+  ///        if data is not NULL, in place in the database, and its position
+  ///        in the database.
+  struct Item {
+    Item() : data(NULL), data_size(0), index(0) {}
+
+    Datum datum;
+    const char* data;
+    size_t data_size;
+    int index;
+  };
+
+  inline BlockingQueue<Item*>& free() const {
     return queue_pair_->free_;
   }
-  inline BlockingQueue<Datum*>& full() const {
+  inline BlockingQueue<Item*>& full() const {
     return queue_pair_->full_;
   }
 
@@ -39,8 +61,8 @@ class DataReader {
     explicit QueuePair(int size);
     ~QueuePair();
 
-    BlockingQueue<Datum*> free_;
-    BlockingQueue<Datum*> full_;
+    BlockingQueue<Item*> free_;
+    BlockingQueue<Item*> full_;
 
   DISABLE_COPY_AND_ASSIGN(QueuePair);
   };
@@ -54,9 +76,24 @@ class DataReader {
    protected:
     void InternalThreadEntry();
     void read_one(db::Cursor* cursor, QueuePair* qp);
+    // Parses the record at the cursor into item, and moves the cursor on to
+    // the next record to read.
+    void read(db::Cursor* cursor, Item* item);
+    // Moves the cursor on by one record, back to the first at the end.
+    void next(db::Cursor* cursor);
 
     const LayerParameter param_;
     BlockingQueue<shared_ptr<QueuePair> > new_queue_pairs_;
+    // The records held back to shuffle them, and the generator drawing the
+    // one to emit next.
+    vector<Item*> shuffle_buffer_;
+    shared_ptr<Caffe::RNG> shuffle_rng_;
+    unsigned int shuffle_seed_;
+    int epoch_;
+    int record_index_;
+    // The number of records read records are apart: one, or the number of
+    // replicas in processes of their own.
+    int stride_;
 
     friend class DataReader;
 
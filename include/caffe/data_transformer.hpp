@@ -37,6 +37,21 @@ class DataTransformer {
    */
   void Transform(const Datum& datum, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Applies the transformation to an unencoded datum whose uint8
+   * pixels are held elsewhere, e.g. in place in a memory mapped database,
+   * rather than in datum.data().
+   *
+   * @param datum
+   *    Datum describing the data to be transformed.
+   * @param data, data_size
+   *    The uint8 pixels of the datum.
+   * @param transformed_blob
+   *    This is destination blob, as for a Datum holding its pixels.
+   */
+  void Transform(const Datum& datum, const char* data, size_t data_size,
+                 Blob<Dtype>* transformed_blob);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to a vector of Datum.
@@ -138,7 +153,8 @@ class DataTransformer {
    */
   virtual int Rand(int n);
 
-  void Transform(const Datum& datum, Dtype* transformed_data);
+  void Transform(const Datum& datum, const char* data, size_t data_size,
+                 Dtype* transformed_data);
   // Tranformation parameters
   TransformationParameter param_;
 
@@ -0,0 +1,67 @@
+#ifndef CAFFE_INFERENCE_POOL_HPP_
+#define CAFFE_INFERENCE_POOL_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A pool of inference sessions over one copy of trained weights.
+ *
+ * Every session is a Net with layers and activations of its own, whose
+ * layers share the parameter blobs of the first session. Any number of
+ * threads can Acquire a session, fill its inputs, run Forward and read its
+ * outputs concurrently, as long as each session is used by one thread at a
+ * time. In GPU mode, each of these threads has to set the mode and device of
+ * its own Caffe context first.
+ */
+template <typename Dtype>
+class InferencePool {
+ public:
+  /**
+   * @brief Creates num_sessions nets from a TEST phase param, and loads the
+   *        weights from trained_filename into them unless it is empty.
+   */
+  InferencePool(const NetParameter& param, const string& trained_filename,
+      int num_sessions);
+
+  inline int num_sessions() const { return sessions_.size(); }
+  /// @brief The net that holds the shared parameters.
+  inline const shared_ptr<Net<Dtype> >& net() const { return sessions_[0]; }
+
+  /// @brief Blocks until a session is free and takes it.
+  Net<Dtype>* Acquire();
+  /// @brief Returns a session taken with Acquire.
+  void Release(Net<Dtype>* net);
+
+  /// @brief Holds a session of the pool for the lifetime of the object.
+  class Session {
+   public:
+    explicit Session(InferencePool* pool)
+        : pool_(pool), net_(pool->Acquire()) {}
+    ~Session() { pool_->Release(net_); }
+    inline Net<Dtype>* net() const { return net_; }
+
+   private:
+    InferencePool* pool_;
+    Net<Dtype>* net_;
+
+    DISABLE_COPY_AND_ASSIGN(Session);
+  };
+
+ protected:
+  vector<shared_ptr<Net<Dtype> > > sessions_;
+  BlockingQueue<Net<Dtype>*> free_sessions_;
+
+  DISABLE_COPY_AND_ASSIGN(InferencePool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_INFERENCE_POOL_HPP_
@@ -43,7 +43,8 @@ class InternalThread {
 
  private:
   void entry(int device, Caffe::Brew mode, int rand_seed, int solver_count,
-      bool root_solver);
+      int solver_rank, bool multiprocess, bool root_solver,
+      shared_ptr<HostAllocator> host_allocator);
 
   shared_ptr<boost::thread> thread_;
 };
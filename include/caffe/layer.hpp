@@ -294,6 +294,15 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Return whether Forward computes top[0] correctly when it is the
+   *        same blob as bottom[0].
+   *
+   * Nets with NetParameter.auto_in_place run such layers in place whenever
+   * nothing else reads their bottom afterwards.
+   */
+  virtual inline bool AllowsInPlace() const { return false; }
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
@@ -40,6 +40,15 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
       weights);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // Variants of the gemm helpers that work in the given column buffer, of
+  // col_buffer_shape_, so that several images can be processed concurrently.
+  // The buffer is unused (and may be NULL) for 1x1 convolution.
+  void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
+      Dtype* output, Dtype* col_buff, bool skip_im2col = false);
+  void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
+      Dtype* output, Dtype* col_buff);
+  void weight_cpu_gemm(const Dtype* input, const Dtype* output,
+      Dtype* weights, Dtype* col_buff);
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -67,16 +67,19 @@ class BasePrefetchingDataLayer :
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
-  // Prefetches batches (asynchronously if to GPU memory)
-  static const int PREFETCH_COUNT = 3;
 
  protected:
   virtual void InternalThreadEntry();
   virtual void load_batch(Batch<Dtype>* batch) = 0;
 
-  Batch<Dtype> prefetch_[PREFETCH_COUNT];
+  // Prefetches data_param().prefetch() batches (asynchronously if to GPU
+  // memory).
+  vector<shared_ptr<Batch<Dtype> > > prefetch_;
   BlockingQueue<Batch<Dtype>*> prefetch_free_;
   BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  // The batch the tops point at when sharing prefetched batches, handed back
+  // to the prefetch thread by the next Forward.
+  Batch<Dtype>* prefetch_current_;
 
   Blob<Dtype> transformed_data_;
 };
@@ -60,9 +60,19 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
    *  - bias_term (\b optional, default true). Whether to have a bias.
    *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
    *    kernels + stream parallelism) engines.
+   *    Depthwise 2D convolution (group == channels) is computed directly,
+   *    without im2col or column buffer.
+   *  - num_threads (\b optional, default 1). The number of CPU threads that
+   *    split the batch between them; 0 means one per core.
+   *  - fused_relu (\b optional, default false). Whether to apply a ReLU to
+   *    the output, as set by layer fusion for inference.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : BaseConvolutionLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Convolution"; }
 
@@ -77,6 +87,43 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual inline bool reverse_dimensions() { return false; }
   virtual void compute_output_shape();
+
+  // Apply the fused ReLU, if any, to the output of one image.
+  void forward_cpu_relu(Dtype* output);
+#ifndef CPU_ONLY
+  void forward_gpu_relu(Blob<Dtype>* top);
+#endif
+
+  int num_threads_;
+  bool fused_relu_;
+  Dtype fused_relu_negative_slope_;
+
+ private:
+  // Process the images of one chunk of the batch, for batch-parallel CPU
+  // convolution; weight_diff, bias and bottom_diff may be NULL to skip
+  // their part of the computation.
+  void forward_cpu_chunk(int chunk, const Dtype* bottom_data,
+      const Dtype* weight, const Dtype* bias, Dtype* top_data);
+  void backward_cpu_chunk(int chunk, const Dtype* top_diff,
+      const Dtype* bottom_data, const Dtype* weight, Dtype* weight_diff,
+      Dtype* bottom_diff);
+
+  // Depthwise convolution of one image, accumulating shifted input rows into
+  // each output row so that the inner loops vectorize for stride 1.
+  void forward_cpu_depthwise(const Dtype* input, const Dtype* weights,
+      Dtype* output);
+  void backward_cpu_depthwise(const Dtype* output, const Dtype* weights,
+      Dtype* input);
+  void weight_cpu_depthwise(const Dtype* input, const Dtype* output,
+      Dtype* weights);
+
+  /// @brief Whether the direct depthwise path replaces im2col + gemm.
+  bool depthwise_;
+  /// @brief The column buffer of each chunk; empty when not batch-parallel.
+  vector<shared_ptr<Blob<Dtype> > > chunk_col_buffers_;
+  /// @brief The weight gradients of all chunks but the first, which
+  ///        accumulates into the weight diff directly.
+  vector<shared_ptr<Blob<Dtype> > > chunk_weight_diffs_;
 };
 
 }  // namespace caffe
@@ -11,6 +11,8 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/sample_cache.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -32,6 +34,20 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual void load_batch(Batch<Dtype>* batch);
 
   DataReader reader_;
+  // The items of a batch are split into one contiguous chunk per thread;
+  // each chunk has its own transformer, so that its random draws do not
+  // depend on scheduling, and its own view into the batch.
+  int num_threads_;
+  shared_ptr<ThreadPool> thread_pool_;
+  vector<shared_ptr<DataTransformer<Dtype> > > chunk_transformers_;
+  vector<shared_ptr<Blob<Dtype> > > chunk_transformed_data_;
+  vector<DataReader::Item*> batch_items_;
+  // The decoded pixels of encoded datums, by position in the database.
+  shared_ptr<SampleCache> sample_cache_;
+
+ private:
+  // Decodes and transforms the items of one chunk of the batch.
+  void transform_chunk(int chunk, Dtype* top_data, Dtype* top_label);
 };
 
 }  // namespace caffe
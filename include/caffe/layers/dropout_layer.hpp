@@ -39,6 +39,7 @@ class DropoutLayer : public NeuronLayer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Dropout"; }
+  virtual inline bool AllowsInPlace() const { return true; }
 
  protected:
   /**
@@ -11,6 +11,8 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/lru_cache.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -39,6 +41,23 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+
+  // As in DataLayer, the images of a batch are split into one contiguous
+  // chunk per thread, each with its own transformer and view into the batch.
+  int num_threads_;
+  shared_ptr<ThreadPool> thread_pool_;
+  vector<shared_ptr<DataTransformer<Dtype> > > chunk_transformers_;
+  vector<shared_ptr<Blob<Dtype> > > chunk_transformed_data_;
+  vector<std::pair<std::string, int> > batch_lines_;
+  // The decoded and resized images by file name, shared by the threads.
+  shared_ptr<LRUCache<std::string, cv::Mat> > cache_;
+  shared_ptr<boost::mutex> cache_mutex_;
+
+ private:
+  // Reads, decodes and resizes an image, or takes it from the cache.
+  cv::Mat ReadImage(const std::string& filename);
+  // Reads and transforms the images of one chunk of the batch.
+  void load_chunk(int chunk, Dtype* top_data, Dtype* top_label);
 };
 
 
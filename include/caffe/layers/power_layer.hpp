@@ -32,6 +32,7 @@ class PowerLayer : public NeuronLayer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Power"; }
+  virtual inline bool AllowsInPlace() const { return true; }
 
  protected:
   /**
@@ -31,6 +31,8 @@ class ScaleLayer: public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Scale"; }
+  // Not AllowsInPlace: in place, Forward keeps a copy of the bottom in temp_
+  // for Backward, costing more memory and traffic than a separate top.
   // Scale
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int MaxBottomBlobs() const { return 2; }
@@ -0,0 +1,70 @@
+#ifndef CAFFE_WINOGRAD_CONV_LAYER_HPP_
+#define CAFFE_WINOGRAD_CONV_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/syncedmem.hpp"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Winograd F(2x2, 3x3) implementation of ConvolutionLayer.
+ *        Fallback to ConvolutionLayer for other kernels, for the backward
+ *        pass and for GPU mode.
+ *
+ * Every 2x2 output tile is computed from a 4x4 input tile with 16 instead of
+ * 36 multiplications per channel pair. Input tiles are transformed into 16
+ * matrices that are multiplied with the transformed filters by 16 gemm
+ * calls, and the products are transformed back into output tiles. The
+ * transformed filters are cached and recomputed only when the weights
+ * change, e.g. after a solver update.
+ *
+ * Only ungrouped 2D convolution with 3x3 kernels, stride 1 and dilation 1 is
+ * supported; any padding is.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param), transformed_version_(0) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+ private:
+  // Recompute transformed_weights_ if the weights changed since last time.
+  void transform_weights();
+  void forward_cpu_chunk(int chunk, const Dtype* bottom_data,
+      const Dtype* bias, Dtype* top_data);
+  // Winograd convolution of one image, using the given input and output
+  // tile buffers of 16 x channels x tiles and 16 x num_output x tiles.
+  void forward_cpu_winograd(const Dtype* input, Dtype* output,
+      Dtype* input_tiles, Dtype* output_tiles);
+
+  /// @brief Whether the kernel shape is supported by Winograd F(2x2, 3x3).
+  bool winograd_;
+  int tiles_h_;
+  int tiles_w_;
+  /// @brief The filters as 16 matrices of num_output x channels.
+  Blob<Dtype> transformed_weights_;
+  /// @brief The memory of the weights that transformed_weights_ was
+  ///        computed from, and its version then.
+  shared_ptr<SyncedMemory> transformed_from_;
+  size_t transformed_version_;
+  vector<shared_ptr<Blob<Dtype> > > chunk_input_tiles_;
+  vector<shared_ptr<Blob<Dtype> > > chunk_output_tiles_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_WINOGRAD_CONV_LAYER_HPP_
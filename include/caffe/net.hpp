@@ -11,6 +11,9 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fuse_layers.hpp"
+#include "caffe/util/mapped_weights.hpp"
+#include "caffe/util/net_profiler.hpp"
 
 namespace caffe {
 
@@ -27,6 +30,13 @@ class Net {
   explicit Net(const string& param_file, Phase phase,
       const int level = 0, const vector<string>* stages = NULL,
       const Net* root_net = NULL);
+  /**
+   * @brief Initialize a network whose layers use the parameter blobs of the
+   *        layers of the same name in params_net, instead of allocating and
+   *        filling parameters of their own. The nets keep separate layers
+   *        and activations, so each can run Forward in a thread of its own.
+   */
+  Net(const NetParameter& param, const Net* root_net, const Net* params_net);
   virtual ~Net() {}
 
   /// @brief Initialize a network with a NetParameter.
@@ -100,6 +110,29 @@ class Net {
    */
   void ShareWeights();
 
+  /**
+   * @brief Moves the data and the diffs of the learnable params into two
+   *        contiguous slabs of host memory, in the order of
+   *        learnable_params().
+   *
+   * Note: this is called by Net::Init when the net was created with
+   * flat_params set, and thus should normally not be called manually. The
+   * learnable params must not be reshaped, nor their memory replaced,
+   * afterwards.
+   */
+  void FlattenParams();
+
+  /**
+   * @brief Points the top blobs of a TEST net at shared memory slabs, such
+   *        that blobs whose lifetimes do not overlap use the same memory.
+   *
+   * This is a no-op unless the net was created with optimize_memory set.
+   * Note: this is called by Net::Init, Net::Reshape and, after blobs were
+   * pinned by blob_by_name, Net::Forward; it should normally not be called
+   * manually.
+   */
+  void PlanActivationMemory();
+
   /**
    * @brief For an already initialized net, implicitly copies (i.e., using no
    *        additional memory) the pre-trained layers from another Net.
@@ -115,6 +148,13 @@ class Net {
   void CopyTrainedLayersFrom(const string trained_filename);
   void CopyTrainedLayersFromBinaryProto(const string trained_filename);
   void CopyTrainedLayersFromHDF5(const string trained_filename);
+  /**
+   * @brief Points the parameter blobs at the pages of a memory mapped
+   *        weights file (see MappedWeights), which the net keeps mapped, or
+   *        copies the values of the params stored in another precision or
+   *        when the params are flat.
+   */
+  void CopyTrainedLayersFromMappedWeights(const string trained_filename);
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
   /// @brief Writes the net to an HDF5 file.
@@ -178,6 +218,17 @@ class Net {
   inline const vector<Blob<Dtype>*>& learnable_params() const {
     return learnable_params_;
   }
+  /// @brief Whether the learnable params are in flat slabs (see FlattenParams)
+  inline bool has_flat_params() const { return flat_param_data_ != NULL; }
+  /// @brief The number of values of the learnable params in the flat slabs
+  inline size_t flat_param_count() const { return flat_param_count_; }
+  /// @brief The slabs holding the data and the diffs of the learnable params
+  inline const shared_ptr<SyncedMemory>& flat_param_data() const {
+    return flat_param_data_;
+  }
+  inline const shared_ptr<SyncedMemory>& flat_param_diff() const {
+    return flat_param_diff_;
+  }
   /// @brief returns the learnable parameter learning rate multipliers
   inline const vector<float>& params_lr() const { return params_lr_; }
   inline const vector<bool>& has_params_lr() const { return has_params_lr_; }
@@ -192,6 +243,14 @@ class Net {
     return param_names_index_;
   }
   inline const vector<int>& param_owners() const { return param_owners_; }
+  /// @brief The layer of each param, and its index among the layer's blobs
+  inline const vector<pair<int, int> >& param_layer_indices() const {
+    return param_layer_indices_;
+  }
+  /// @brief The index in learnable_params() of each param, or of its owner
+  inline const vector<int>& learnable_param_ids() const {
+    return learnable_param_ids_;
+  }
   inline const vector<string>& param_display_names() const {
     return param_display_names_;
   }
@@ -216,6 +275,31 @@ class Net {
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name) const;
 
   void set_debug_info(const bool value) { debug_info_ = value; }
+  /**
+   * @brief Turns the per-layer profiling of Forward and Backward on or off.
+   *        The profile accumulates across toggles until it is Reset.
+   */
+  void set_profiling(const bool value);
+  inline bool profiling() const { return profiling_; }
+  /// @brief The per-layer profile, or NULL if profiling was never turned on.
+  inline const shared_ptr<NetProfiler<Dtype> >& profiler() const {
+    return profiler_;
+  }
+
+  // Invoked at specific points during a pass
+  class Callback {
+   protected:
+    virtual void run(int layer) = 0;
+
+    template <typename T>
+    friend class Net;
+  };
+  /// @brief Callbacks run after the backward pass of every layer, whether it
+  ///        needs backward or not, with the index of the layer.
+  const vector<Callback*>& after_backward() const { return after_backward_; }
+  void add_after_backward(Callback* value) {
+    after_backward_.push_back(value);
+  }
 
   // Helpers for Init.
   /**
@@ -302,12 +386,38 @@ class Net {
   /// the weight decay multipliers for learnable_params_
   vector<float> params_weight_decay_;
   vector<bool> has_params_decay_;
+  /// The slabs holding the learnable params, if flat
+  shared_ptr<SyncedMemory> flat_param_data_;
+  shared_ptr<SyncedMemory> flat_param_diff_;
+  size_t flat_param_count_;
   /// The bytes of memory used by this net
   size_t memory_used_;
+  /// Whether top blobs share memory according to their lifetimes
+  bool optimize_memory_;
+  /// Whether layer chains were folded into convolutions for inference
+  bool fuse_layers_;
+  /// The chains whose weights were folded, to fold trained weights the same
+  vector<FusedLayers> fused_layers_;
+  /// Whether the memory plan has to be recomputed before the next Forward
+  mutable bool memory_plan_dirty_;
+  /// Whether a blob keeps memory of its own, indexed by blob_id
+  mutable vector<bool> blob_pinned_;
+  /// The slabs holding the shared activations, and the memory mapped on them
+  vector<shared_ptr<SyncedMemory> > activation_slabs_;
+  set<const SyncedMemory*> planned_memory_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Whether layer calls are recorded by profiler_.
+  bool profiling_;
+  shared_ptr<NetProfiler<Dtype> > profiler_;
+  /// Callbacks run after the backward pass of every layer
+  vector<Callback*> after_backward_;
+  /// The weights files the parameter blobs may point into
+  vector<shared_ptr<MappedWeights> > mapped_weights_;
   /// The root net that actually holds the shared layers in data parallelism
   const Net* const root_net_;
+  /// The net whose parameter blobs are shared, if any
+  const Net* const params_net_;
   DISABLE_COPY_AND_ASSIGN(Net);
 };
 
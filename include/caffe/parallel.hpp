@@ -13,6 +13,7 @@
 #include "caffe/solver.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/gradient_codec.hpp"
 
 namespace caffe {
 
@@ -116,6 +117,161 @@ class P2PSync : public GPUParams<Dtype>, public Solver<Dtype>::Callback,
   using Params<Dtype>::diff_;
 };
 
+// Shared memory through which CPU replicas of a solver average their
+// gradients, be they threads of one process or processes forked once the
+// group is created.
+template<typename Dtype>
+class CPUSyncGroup {
+ public:
+  explicit CPUSyncGroup(int replicas);
+  ~CPUSyncGroup();
+
+  inline int replicas() const {
+    return replicas_;
+  }
+  inline size_t size() const {
+    return size_;
+  }
+  // Maps a buffer of size values per replica, or of buffer_bytes if that is
+  // more, and one of size values for their average, unless mapped already in
+  // this process. Every process of the group maps the same buffers.
+  void Map(size_t size, size_t buffer_bytes = 0);
+  inline Dtype* buffer(int rank) const {
+    return buffers_ + rank * stride_;
+  }
+  inline Dtype* average() const {
+    return buffers_ + replicas_ * stride_;
+  }
+
+  // Waits for all replicas to reach the barrier, and returns true, or
+  // returns false once the group is aborted.
+  bool Barrier();
+  // Releases the replicas waiting at a barrier, and makes every barrier
+  // return false from now on, for replicas to stop when one of them does.
+  void Abort();
+  bool aborted();
+  // Averages the buffers of all replicas into the average buffer. Every
+  // replica calls it, and averages its own share of the values, so that the
+  // average is computed once for all. The buffers must not be written again
+  // before the replica is done reading the average. Returns false if the
+  // group was aborted, and the average is incomplete.
+  bool Allreduce(int rank) {
+    return Allreduce(rank, 0, size_);
+  }
+  // Averages the count values of the buffers from offset on.
+  bool Allreduce(int rank, size_t offset, size_t count);
+  // Averages count values into the average buffer from offset on, from
+  // their encodings by codec at the start of the buffers.
+  bool Allreduce(int rank, size_t offset, size_t count,
+      const GradientCodec<Dtype>& codec);
+
+ protected:
+  struct Shared;
+
+  const int replicas_;
+  // An unlinked file backing the buffers, inherited by forked replicas
+  int fd_;
+  Shared* shared_;
+  size_t size_;
+  // The number of values between the starts of the replica buffers
+  size_t stride_;
+  Dtype* buffers_;
+
+DISABLE_COPY_AND_ASSIGN(CPUSyncGroup);
+};
+
+// Synchronous data parallelism between CPU replicas of a solver, which
+// average their gradients through a CPUSyncGroup once they are ready. Each
+// replica reads its own slice of the data, so the effective batch size is
+// multiplied by the number of replicas.
+//
+// With a sync_bucket_mb in the solver parameters, the gradients are averaged
+// in buckets of about that size, from the last layers to the first, on a
+// thread of their own while the backward pass computes the gradients of the
+// layers below.
+//
+// With a sync_compression, each replica encodes its gradients with a
+// GradientCodec into its buffer, and keeps what the encoding lost in
+// residuals laid out as the flat gradients of its learnable params.
+//
+// The replica of rank 0 alone takes requests to snapshot or stop. When it
+// stops, it aborts the group, and the other replicas stop in turn.
+template<typename Dtype>
+class CPUSync : public Solver<Dtype>::Callback, public Net<Dtype>::Callback,
+    public InternalThread {
+ public:
+  virtual ~CPUSync();
+
+  // Trains solver with replicas - 1 worker solvers on threads of their own,
+  // which take the weights of solver before every iteration. The solver
+  // count must be set to replicas before solver is created.
+  static void RunThreads(shared_ptr<Solver<Dtype> > solver, int replicas);
+  // Trains solver as the replica of the given rank of group, one of as many
+  // processes which all apply the averaged gradients to weights of their own,
+  // starting from those of rank 0.
+  static void RunProcess(shared_ptr<Solver<Dtype> > solver,
+      shared_ptr<CPUSyncGroup<Dtype> > group, int rank);
+
+  inline const shared_ptr<Solver<Dtype> >& solver() const {
+    return solver_;
+  }
+
+ protected:
+  // The root solver is the solver of rank 0 for replicas on threads, and
+  // NULL for replicas in processes.
+  CPUSync(shared_ptr<Solver<Dtype> > solver,
+      shared_ptr<CPUSyncGroup<Dtype> > group, int rank,
+      Solver<Dtype>* root_solver);
+
+  // A range of the flat params, whose gradients are complete once the
+  // lowest layer of its params is done with backward.
+  struct Bucket {
+    size_t offset;
+    size_t count;
+    int ready_layer;
+  };
+
+  void on_start();
+  void on_gradients_ready();
+  // Queues the buckets complete after the backward pass of layer.
+  void run(int layer);
+  // The requests of the replicas other than rank 0: to stop once the group
+  // is aborted.
+  SolverAction::Enum GetRequestedAction();
+
+  void InternalThreadEntry();
+
+  // Splits the flat params into buckets of at most bucket_size values, or
+  // of a single param.
+  void InitBuckets(size_t bucket_size);
+  // Averages the gradients of the buckets queued, until -1 is.
+  void ReduceBuckets();
+  // Averages count values of the gradients from offset on.
+  void Reduce(size_t offset, size_t count);
+
+  shared_ptr<Solver<Dtype> > solver_;
+  shared_ptr<CPUSyncGroup<Dtype> > group_;
+  const int rank_;
+  Solver<Dtype>* const root_solver_;
+  const int initial_iter_;
+  // Whether replicas in processes have taken the weights of rank 0
+  bool synced_;
+  // The flat params of the net
+  Dtype* data_;
+  Dtype* diff_;
+
+  // The buckets, in the order they are completed
+  vector<Bucket> buckets_;
+  int next_bucket_;
+  int backward_passes_;
+  BlockingQueue<int> ready_buckets_;
+  BlockingQueue<int> reduced_buckets_;
+  shared_ptr<boost::thread> reduce_thread_;
+
+  shared_ptr<GradientCodec<Dtype> > codec_;
+  vector<Dtype> residuals_;
+};
+
 }  // namespace caffe
 
 #endif
@@ -5,9 +5,28 @@
 #include <vector>
 
 #include "caffe/solver.hpp"
+#include "caffe/util/packed_math.hpp"
 
 namespace caffe {
 
+/**
+ * @brief Normalizes and regularizes packs of gradients as
+ *        SGDSolver::Normalize and SGDSolver::Regularize do, for the fused
+ *        updates. The unused decay is zero, so that the loops do not branch.
+ */
+template <typename Dtype>
+struct FusedGradient {
+  Dtype scale;
+  Dtype l2_decay;
+  Dtype l1_decay;
+
+  template <typename Pack>
+  inline Pack operator()(Pack diff, Pack data) const {
+    return Pack(scale) * diff + Pack(l2_decay) * data +
+        Pack(l1_decay) * Sign(data);
+  }
+};
+
 /**
  * @brief Optimizes the parameters of a Net using
  *        stochastic gradient descent (SGD) with momentum.
@@ -30,6 +49,18 @@ class SGDSolver : public Solver<Dtype> {
   virtual void Normalize(int param_id);
   virtual void Regularize(int param_id);
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  /**
+   * @brief Updates a param on the CPU in a single pass over its values:
+   *        normalizes and regularizes each gradient as Normalize and
+   *        Regularize do, computes the update value as ComputeUpdateValue
+   *        does, stores it in the diff and applies it to the data.
+   *
+   * Returns false for solvers without a fused update, whose params are
+   * updated by the separate calls. That includes subclasses of the solvers
+   * here, whose overrides of Normalize, Regularize or ComputeUpdateValue
+   * the fused update would skip; they may override this to opt in.
+   */
+  virtual bool ApplyFusedUpdate(int param_id, Dtype rate);
   virtual void ClipGradients();
   virtual void SnapshotSolverState(const string& model_filename);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
@@ -41,6 +72,7 @@ class SGDSolver : public Solver<Dtype> {
   // temp maintains other information that might be needed in computation
   //   of gradients/updates and is not needed in snapshots
   vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
+  FusedGradient<Dtype> GetFusedGradient(int param_id) const;
 
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
@@ -56,6 +88,7 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual bool ApplyFusedUpdate(int param_id, Dtype rate);
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -71,6 +104,7 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual bool ApplyFusedUpdate(int param_id, Dtype rate);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -91,6 +125,7 @@ class RMSPropSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual bool ApplyFusedUpdate(int param_id, Dtype rate);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with RMSProp.";
@@ -115,6 +150,7 @@ class AdaDeltaSolver : public SGDSolver<Dtype> {
  protected:
   void AdaDeltaPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual bool ApplyFusedUpdate(int param_id, Dtype rate);
 
   DISABLE_COPY_AND_ASSIGN(AdaDeltaSolver);
 };
@@ -139,6 +175,7 @@ class AdamSolver : public SGDSolver<Dtype> {
  protected:
   void AdamPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual bool ApplyFusedUpdate(int param_id, Dtype rate);
 
   DISABLE_COPY_AND_ASSIGN(AdamSolver);
 };
@@ -7,6 +7,12 @@
 #include "caffe/net.hpp"
 #include "caffe/solver_factory.hpp"
 
+/**
+ Forward declare boost::thread instead of including boost/thread.hpp
+ to avoid a boost/NVCC issues (#1009, #1010) on OSX.
+ */
+namespace boost { class thread; }
+
 namespace caffe {
 
 /**
@@ -66,7 +72,10 @@ class Solver {
   // function that produces a SolverState protocol buffer that needs to be
   // written to disk together with the learned net.
   void Snapshot();
-  virtual ~Solver() {}
+  // Blocks until the files of the snapshot written in the background, if
+  // any, are complete.
+  void WaitForSnapshot();
+  virtual ~Solver();
   inline const SolverParameter& param() const { return param_; }
   inline shared_ptr<Net<Dtype> > net() { return net_; }
   inline const vector<shared_ptr<Net<Dtype> > >& test_nets() {
@@ -100,6 +109,10 @@ class Solver {
   string SnapshotFilename(const string extension);
   string SnapshotToBinaryProto();
   string SnapshotToHDF5();
+  // Writes a snapshot file, or stages it to be written in the background if
+  // snapshots are asynchronous.
+  void WriteSnapshotProto(const shared_ptr<google::protobuf::Message>& proto,
+      const string& filename);
   // The test routine
   void TestAll();
   void Test(const int test_net_id = 0);
@@ -129,6 +142,12 @@ class Solver {
   // True iff a request to stop early was received.
   bool requested_early_exit_;
 
+  // The files of the snapshot being taken, and the thread writing those of
+  // the previous one.
+  vector<shared_ptr<google::protobuf::Message> > staged_protos_;
+  vector<string> staged_filenames_;
+  shared_ptr<boost::thread> snapshot_thread_;
+
   DISABLE_COPY_AND_ASSIGN(Solver);
 };
 
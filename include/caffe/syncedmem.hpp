@@ -4,6 +4,7 @@
 #include <cstdlib>
 
 #include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
 
 namespace caffe {
 
@@ -12,7 +13,11 @@ namespace caffe {
 // The improvement in performance seems negligible in the single GPU case,
 // but might be more significant for parallel training. Most importantly,
 // it improved stability for large models on many GPUs.
-inline void CaffeMallocHost(void** ptr, size_t size, bool* use_cuda) {
+// Otherwise, memory comes from the HostAllocator of the thread, which is
+// returned through allocator so that the memory can be freed to the same
+// allocator.
+inline void CaffeMallocHost(void** ptr, size_t size, bool* use_cuda,
+    shared_ptr<HostAllocator>* allocator) {
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
     CUDA_CHECK(cudaMallocHost(ptr, size));
@@ -20,19 +25,21 @@ inline void CaffeMallocHost(void** ptr, size_t size, bool* use_cuda) {
     return;
   }
 #endif
-  *ptr = malloc(size);
+  *allocator = Caffe::host_allocator();
+  *ptr = (*allocator)->Allocate(size);
   *use_cuda = false;
   CHECK(*ptr) << "host allocation of size " << size << " failed";
 }
 
-inline void CaffeFreeHost(void* ptr, bool use_cuda) {
+inline void CaffeFreeHost(void* ptr, size_t size, bool use_cuda,
+    const shared_ptr<HostAllocator>& allocator) {
 #ifndef CPU_ONLY
   if (use_cuda) {
     CUDA_CHECK(cudaFreeHost(ptr));
     return;
   }
 #endif
-  free(ptr);
+  allocator->Free(ptr, size);
 }
 
 
@@ -47,11 +54,11 @@ class SyncedMemory {
   SyncedMemory()
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
         own_cpu_data_(false), cpu_malloc_use_cuda_(false), own_gpu_data_(false),
-        gpu_device_(-1) {}
+        gpu_device_(-1), version_(0) {}
   explicit SyncedMemory(size_t size)
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
         own_cpu_data_(false), cpu_malloc_use_cuda_(false), own_gpu_data_(false),
-        gpu_device_(-1) {}
+        gpu_device_(-1), version_(0) {}
   ~SyncedMemory();
   const void* cpu_data();
   void set_cpu_data(void* data);
@@ -62,6 +69,10 @@ class SyncedMemory {
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
   SyncedHead head() { return head_; }
   size_t size() { return size_; }
+  /// @brief Changes on every call that hands out the data for writing or
+  ///        replaces it, so that caches derived from the data can tell
+  ///        whether it may have changed without comparing it.
+  size_t version() const { return version_; }
 
 #ifndef CPU_ONLY
   void async_gpu_push(const cudaStream_t& stream);
@@ -76,8 +87,10 @@ class SyncedMemory {
   SyncedHead head_;
   bool own_cpu_data_;
   bool cpu_malloc_use_cuda_;
+  shared_ptr<HostAllocator> cpu_allocator_;
   bool own_gpu_data_;
   int gpu_device_;
+  size_t version_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
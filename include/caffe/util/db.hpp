@@ -19,6 +19,13 @@ class Cursor {
   virtual string key() = 0;
   virtual string value() = 0;
   virtual bool valid() = 0;
+  /**
+   * @brief Points data at the value at the cursor without copying it. The
+   *        value stays valid until the cursor moves, or for as long as the
+   *        cursor exists if pins_values().
+   */
+  virtual void value_data(const char** data, size_t* size) = 0;
+  virtual bool pins_values() const { return false; }
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
 };
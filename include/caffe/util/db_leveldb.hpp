@@ -21,6 +21,10 @@ class LevelDBCursor : public Cursor {
   virtual string key() { return iter_->key().ToString(); }
   virtual string value() { return iter_->value().ToString(); }
   virtual bool valid() { return iter_->Valid(); }
+  virtual void value_data(const char** data, size_t* size) {
+    *data = iter_->value().data();
+    *size = iter_->value().size();
+  }
 
  private:
   leveldb::Iterator* iter_;
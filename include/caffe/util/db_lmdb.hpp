@@ -35,6 +35,13 @@ class LMDBCursor : public Cursor {
         mdb_value_.mv_size);
   }
   virtual bool valid() { return valid_; }
+  virtual void value_data(const char** data, size_t* size) {
+    *data = static_cast<const char*>(mdb_value_.mv_data);
+    *size = mdb_value_.mv_size;
+  }
+  // The values of a read-only transaction stay mapped until it ends, which
+  // is when the cursor is destroyed.
+  virtual bool pins_values() const { return true; }
 
  private:
   void Seek(MDB_cursor_op op) {
@@ -0,0 +1,123 @@
+#ifndef CAFFE_UTIL_DB_RECORD_FILE_HPP
+#define CAFFE_UTIL_DB_RECORD_FILE_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+/**
+ * A record file database is a directory of shards, each an append-only file
+ * of chunks of length-prefixed records, in native byte order:
+ *   chunk:  uint32 magic, uint32 number of records, uint64 payload size,
+ *           followed by the records as payload;
+ *   record: uint32 key size, uint32 value size, key, value.
+ * Every shard has an index file listing the offset and size of its chunks,
+ * extended only once a chunk is written, so that readers ignore a chunk
+ * left incomplete by an interrupted writer.
+ *
+ * Cursors read a whole chunk at a time and have the kernel read ahead the
+ * next one, so that the records stream sequentially from disk instead of
+ * being gathered from the pages of a B-tree.
+ */
+class RecordFileCursor : public Cursor {
+ public:
+  explicit RecordFileCursor(const vector<string>& shards);
+  virtual ~RecordFileCursor();
+  virtual void SeekToFirst();
+  virtual void Next();
+  virtual string key() { return string(key_, key_size_); }
+  virtual string value() { return string(value_, value_size_); }
+  virtual bool valid() { return valid_; }
+  virtual void value_data(const char** data, size_t* size) {
+    *data = value_;
+    *size = value_size_;
+  }
+
+ private:
+  // Moves to the first record of the next non-empty chunk, opening the next
+  // shards as needed; the cursor becomes invalid after the last one.
+  void NextChunk();
+  void ReadRecord();
+
+  vector<string> shards_;
+  int shard_;
+  int fd_;
+  // The offsets and sizes of the chunks of the current shard.
+  vector<std::pair<int64_t, int64_t> > chunks_;
+  int chunk_;
+  vector<char> buffer_;
+  size_t position_;
+  uint32_t records_left_;
+  const char* key_;
+  uint32_t key_size_;
+  const char* value_;
+  uint32_t value_size_;
+  bool valid_;
+};
+
+class RecordFile;
+
+class RecordFileTransaction : public Transaction {
+ public:
+  explicit RecordFileTransaction(RecordFile* db) : db_(db) { }
+  virtual void Put(const string& key, const string& value);
+  virtual void Commit();
+
+ private:
+  RecordFile* db_;
+  vector<string> keys_, values_;
+
+  DISABLE_COPY_AND_ASSIGN(RecordFileTransaction);
+};
+
+class RecordFile : public DB {
+ public:
+  static const int64_t kDefaultChunkSize = 4 << 20;
+  static const int64_t kDefaultShardSize = 1 << 30;
+
+  /**
+   * @param chunk_size the payload size from which a chunk is written.
+   * @param shard_size the size from which new chunks go to a new shard.
+   */
+  explicit RecordFile(int64_t chunk_size = kDefaultChunkSize,
+      int64_t shard_size = kDefaultShardSize);
+  virtual ~RecordFile() { Close(); }
+  /// Opening in WRITE mode appends to new shards after the existing ones.
+  virtual void Open(const string& source, Mode mode);
+  /// Writes the last chunk, which may not be full, when writing.
+  virtual void Close();
+  virtual RecordFileCursor* NewCursor();
+  virtual RecordFileTransaction* NewTransaction();
+
+  /// Appends records to the chunk being filled, written once full.
+  void Append(const string& key, const string& value);
+
+ private:
+  void WriteChunk();
+  void NewShard();
+
+  int64_t chunk_size_;
+  int64_t shard_size_;
+  string source_;
+  Mode mode_;
+  // The paths of the shards, without extension.
+  vector<string> shards_;
+  int fd_;
+  int index_fd_;
+  int64_t shard_offset_;
+  string chunk_;
+  uint32_t chunk_records_;
+
+  DISABLE_COPY_AND_ASSIGN(RecordFile);
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DB_RECORD_FILE_HPP
@@ -0,0 +1,40 @@
+#ifndef CAFFE_UTIL_FUSE_LAYERS_HPP_
+#define CAFFE_UTIL_FUSE_LAYERS_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// The names of the layers whose weights FuseLayers folded into a
+// convolution; batch_norm or scale is empty where the chain has none.
+struct FusedLayers {
+  string convolution;
+  string batch_norm;
+  string scale;
+};
+
+// Copy NetParameters with chains of Convolution -> BatchNorm -> Scale -> ReLU
+// (each of the last three optional) folded into the convolution, for
+// inference. A chain is only folded where every intermediate top is consumed
+// by the next layer of the chain alone, and the BatchNorm uses global stats.
+// If the layers carry blobs, the BatchNorm statistics and the Scale factors
+// and biases are folded into the convolution weights and bias; otherwise the
+// fused convolution gets no blobs. The chains whose weights are folded are
+// recorded in fused_layers.
+void FuseLayers(const NetParameter& param, NetParameter* param_fused,
+    vector<FusedLayers>* fused_layers);
+
+// Copy the layers of a trained model with the weights of the chains in
+// fused_layers folded into their convolutions, and their BatchNorm and Scale
+// layers left out. The chains are found by name, so the model may come from
+// a net of another topology, such as the TRAIN net.
+void FoldTrainedLayers(const NetParameter& param,
+    const vector<FusedLayers>& fused_layers, NetParameter* param_folded);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FUSE_LAYERS_HPP_
@@ -0,0 +1,75 @@
+#ifndef CAFFE_UTIL_GRADIENT_CODEC_HPP_
+#define CAFFE_UTIL_GRADIENT_CODEC_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Encodes gradients into fewer bytes for data parallel replicas to
+ *        exchange, with error feedback: what an encoding loses of the
+ *        gradients is kept as a residual, added to the gradients encoded
+ *        next, so that it is exchanged later instead of never.
+ *
+ * The encodings of count values are:
+ *   NONE:  the Dtype values;
+ *   FP16:  the values as IEEE half precision floats, saturated to the
+ *          largest finite one;
+ *   INT8:  a float scale for every block of kBlockSize values, followed by
+ *          the values divided by the scale of their block and rounded to
+ *          int8 in [-127, 127];
+ *   TOP_K: the Dtype values of the top_k fraction of the values of largest
+ *          magnitude, rounded and at least one, followed by their uint32
+ *          indices in increasing order.
+ */
+template <typename Dtype>
+class GradientCodec {
+ public:
+  static const int kBlockSize = 256;
+
+  /**
+   * @param compression the encoding.
+   * @param top_k the fraction of the values TOP_K keeps, in (0, 1].
+   */
+  GradientCodec(SolverParameter_SyncCompression compression, float top_k);
+
+  inline SolverParameter_SyncCompression compression() const {
+    return compression_;
+  }
+
+  /// @brief The number of bytes the encoding of count values takes at most.
+  size_t EncodedBytes(size_t count) const;
+  /**
+   * @brief Encodes count values plus their residual into encoded, aligned
+   *        for Dtype, and sets the residual to what the encoding lost of
+   *        them.
+   */
+  void Encode(size_t count, const Dtype* values, Dtype* residual,
+      void* encoded);
+  /**
+   * @brief Adds the values from begin to end of count values encoded by
+   *        Encode to sum, which holds end - begin values.
+   */
+  void DecodeAdd(size_t count, const void* encoded, size_t begin,
+      size_t end, Dtype* sum) const;
+
+ private:
+  // The number of values TOP_K keeps of count values.
+  size_t TopK(size_t count) const;
+
+  const SolverParameter_SyncCompression compression_;
+  const float top_k_;
+  // The indices of the values TOP_K sorts by magnitude
+  vector<uint32_t> indices_;
+
+  DISABLE_COPY_AND_ASSIGN(GradientCodec);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_GRADIENT_CODEC_HPP_
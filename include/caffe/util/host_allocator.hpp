@@ -0,0 +1,127 @@
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+#define CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+
+#include <map>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Allocation counters of a HostAllocator.
+ */
+struct HostAllocatorStats {
+  HostAllocatorStats()
+      : bytes_in_use(0), peak_bytes_in_use(0), bytes_cached(0),
+        num_allocations(0), num_cache_hits(0) {}
+  /// @brief Fraction of the allocations served without calling the system.
+  double hit_rate() const {
+    return num_allocations ?
+        static_cast<double>(num_cache_hits) / num_allocations : 0.;
+  }
+  size_t bytes_in_use;
+  size_t peak_bytes_in_use;
+  size_t bytes_cached;
+  size_t num_allocations;
+  size_t num_cache_hits;
+};
+
+/**
+ * @brief Serves the host memory of SyncedMemory when it is not allocated
+ *        pinned through CUDA.
+ *
+ * SyncedMemory allocates from the allocator of its thread,
+ * Caffe::host_allocator(), which threads start with from the process-wide
+ * HostAllocator::Get() and which may be replaced at any time with
+ * Caffe::set_host_allocator: memory is always returned to the allocator it
+ * came from, which SyncedMemory keeps alive for as long as it holds memory
+ * from it. Implementations must be thread-safe, as prefetching
+ * threads allocate too.
+ */
+class HostAllocator {
+ public:
+  HostAllocator();
+  virtual ~HostAllocator() {}
+
+  /// @brief Returns at least size bytes, or NULL on failure.
+  virtual void* Allocate(size_t size) = 0;
+  /// @brief Returns the memory of an earlier Allocate(size) call.
+  virtual void Free(void* ptr, size_t size) = 0;
+  /// @brief Returns cached memory, if any, to the system.
+  virtual void ReleaseCache() {}
+
+  HostAllocatorStats stats() const;
+
+  /// @brief The process-wide allocator that threads start with.
+  static shared_ptr<HostAllocator> Get();
+  /// @brief Sets the process-wide allocator, for threads started afterwards.
+  static void Set(shared_ptr<HostAllocator> allocator);
+
+ protected:
+  /// Update the counters; to be called by implementations of Allocate, Free
+  /// and ReleaseCache.
+  void RecordAllocation(size_t size, bool cache_hit);
+  void RecordFree(size_t size, bool cached);
+  void RecordRelease(size_t size);
+
+  /**
+   Move synchronization fields out instead of including boost/thread.hpp
+   to avoid a boost/NVCC issues (#1009, #1010) on OSX.
+   */
+  class sync;
+  shared_ptr<sync> sync_;
+  HostAllocatorStats stats_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+/**
+ * @brief The default allocator, calling malloc and free for every request.
+ */
+class MallocHostAllocator : public HostAllocator {
+ public:
+  MallocHostAllocator() {}
+  virtual void* Allocate(size_t size);
+  virtual void Free(void* ptr, size_t size);
+};
+
+/**
+ * @brief Caches freed memory by size class and serves later requests of the
+ *        same class from the cache.
+ *
+ * Requests are rounded up to one of four classes per power of two, which
+ * bounds the wasted memory to 25%, and are aligned to kAlignment bytes for
+ * vectorized kernels. This avoids the malloc and page-fault cost of nets that
+ * reshape their blobs repeatedly, e.g. to serve inputs of varying shapes.
+ */
+class PoolHostAllocator : public HostAllocator {
+ public:
+  static const size_t kAlignment = 64;
+
+  /**
+   * @param max_bytes_cached memory freed beyond this amount of cached memory
+   *        is returned to the system; 0 means no limit.
+   */
+  explicit PoolHostAllocator(size_t max_bytes_cached = 0);
+  virtual ~PoolHostAllocator();
+
+  virtual void* Allocate(size_t size);
+  virtual void Free(void* ptr, size_t size);
+  virtual void ReleaseCache();
+
+  /// @brief The number of bytes actually reserved for a request of size.
+  static size_t SizeClass(size_t size);
+
+ protected:
+  class cache_sync;
+  shared_ptr<cache_sync> cache_sync_;
+  size_t max_bytes_cached_;
+  size_t bytes_cached_;
+  /// Cached blocks indexed by size class.
+  std::map<size_t, std::vector<void*> > free_blocks_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HOST_ALLOCATOR_HPP_
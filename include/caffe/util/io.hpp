@@ -126,6 +126,14 @@ inline bool ReadImageToDatum(const string& filename, const int label,
   return ReadImageToDatum(filename, label, 0, 0, true, encoding, datum);
 }
 
+/**
+ * @brief Parses the serialized Datum at serialized, except for the bytes of
+ *        its data field, which are left in place and pointed to by data, or
+ *        NULL if it has none.
+ */
+bool ParseDatumInPlace(const char* serialized, size_t size, Datum* datum,
+    const char** data, size_t* data_size);
+
 bool DecodeDatumNative(Datum* datum);
 bool DecodeDatum(Datum* datum, bool is_color);
 
@@ -0,0 +1,89 @@
+#ifndef CAFFE_UTIL_LRU_CACHE_HPP_
+#define CAFFE_UTIL_LRU_CACHE_HPP_
+
+#include <list>
+#include <map>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Keeps the most recently used values up to a total size, evicting
+ *        the least recently used ones to make room for new values.
+ *
+ * The cache is not synchronized; callers sharing it between threads should
+ * lock around its calls.
+ */
+template <typename Key, typename Value>
+class LRUCache {
+ public:
+  /// @param capacity the total size of the values kept, in the units of the
+  ///        sizes given to Put.
+  explicit LRUCache(size_t capacity) : capacity_(capacity), size_(0) {}
+
+  /// @brief Copies the value of key, if cached, and marks it as the most
+  ///        recently used.
+  bool Get(const Key& key, Value* value) {
+    typename Index::iterator it = index_.find(key);
+    if (it == index_.end()) {
+      return false;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    *value = it->second->value;
+    return true;
+  }
+
+  /// @brief Caches the value of key, of the given size, in place of any
+  ///        previous value. Values larger than the capacity are not cached.
+  void Put(const Key& key, const Value& value, size_t size) {
+    Erase(key);
+    if (size > capacity_) {
+      return;
+    }
+    while (size_ + size > capacity_) {
+      Erase(entries_.back().key);
+    }
+    Entry entry = { key, value, size };
+    entries_.push_front(entry);
+    index_[key] = entries_.begin();
+    size_ += size;
+  }
+
+  /// @brief Removes the value of key, if cached.
+  void Erase(const Key& key) {
+    typename Index::iterator it = index_.find(key);
+    if (it == index_.end()) {
+      return;
+    }
+    size_ -= it->second->size;
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+
+  inline size_t capacity() const { return capacity_; }
+  /// @brief The total size of the cached values.
+  inline size_t size() const { return size_; }
+  /// @brief The number of cached values.
+  inline int count() const { return index_.size(); }
+
+ private:
+  struct Entry {
+    Key key;
+    Value value;
+    size_t size;
+  };
+  typedef std::map<Key, typename std::list<Entry>::iterator> Index;
+
+  size_t capacity_;
+  size_t size_;
+  // The entries from the most to the least recently used.
+  std::list<Entry> entries_;
+  Index index_;
+
+  DISABLE_COPY_AND_ASSIGN(LRUCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_LRU_CACHE_HPP_
@@ -0,0 +1,72 @@
+#ifndef CAFFE_UTIL_MAPPED_WEIGHTS_HPP_
+#define CAFFE_UTIL_MAPPED_WEIGHTS_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief A weights file laid out to be memory mapped, so that the parameter
+ *        blobs of a net can point at its pages instead of being parsed and
+ *        copied from a binary proto.
+ *
+ * The file is in native byte order:
+ *   header: char[8] magic "CAFFEWTS", uint32 version, uint32 number of
+ *           params, uint64 size of the index;
+ *   index:  for every param, uint32 layer name size, layer name, uint32
+ *           index of the param in its layer, uint32 data type (0 for float,
+ *           1 for double), uint32 flags (1 if the shape is the legacy
+ *           num, channels, height, width), uint32 number of axes, int64
+ *           dimensions, uint64 offset of the data, uint64 count;
+ *   data:   the values of every param, starting at offsets aligned to
+ *           kAlignment bytes.
+ * Net::CopyTrainedLayersFrom loads files with the .caffeweights extension
+ * this way. The pages are mapped copy-on-write: reads share the page cache,
+ * and nets updating the weights write to private copies of the pages they
+ * touch.
+ */
+class MappedWeights {
+ public:
+  static const int kAlignment = 64;
+
+  enum DataType { FLOAT = 0, DOUBLE = 1 };
+
+  struct Param {
+    string layer_name;
+    int index;
+    DataType type;
+    // The shape in the form Blob::ShapeEquals expects, without data.
+    BlobProto shape;
+    const void* data;
+    int64_t count;
+  };
+
+  /// @brief Maps filename, and dies if it is not a valid weights file.
+  explicit MappedWeights(const string& filename);
+  ~MappedWeights();
+
+  /// @brief The params in the order they were written, grouped by layer.
+  inline const vector<Param>& params() const { return params_; }
+
+  /// @brief Writes the params of the layers of param to filename, in double
+  ///        precision for the blobs that have double_data.
+  static void Write(const NetParameter& param, const string& filename);
+
+ private:
+  string filename_;
+  char* data_;
+  size_t size_;
+  vector<Param> params_;
+
+  DISABLE_COPY_AND_ASSIGN(MappedWeights);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MAPPED_WEIGHTS_HPP_
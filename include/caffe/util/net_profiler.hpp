@@ -0,0 +1,104 @@
+#ifndef CAFFE_UTIL_NET_PROFILER_HPP_
+#define CAFFE_UTIL_NET_PROFILER_HPP_
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <stdint.h>
+
+#include <ostream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/benchmark.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Records the wall time of every layer Forward and Backward of a Net,
+ *        with estimates of the bytes each one reads and writes and of its
+ *        floating point operations, derived from the blob shapes.
+ *
+ * Times are kept as histograms with power of two buckets of microseconds,
+ * and the most recent calls as events for a timeline. The profile can be
+ * written as JSON, or as a Chrome trace to load in chrome://tracing.
+ */
+template <typename Dtype>
+class NetProfiler {
+ public:
+  enum Pass { FORWARD, BACKWARD };
+  static const int kNumBuckets = 32;
+
+  /**
+   * @param layer_names, layer_types the layers of the net, by layer id.
+   * @param max_events the number of most recent calls kept for the trace.
+   */
+  NetProfiler(const vector<string>& layer_names,
+      const vector<string>& layer_types, int max_events = 100000);
+
+  /// @brief Starts timing the call of a layer.
+  void Start();
+  /// @brief Stops timing the call of a layer and records it.
+  void Stop(int layer_id, Pass pass, Layer<Dtype>* layer,
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top);
+  /// @brief Clears everything recorded so far.
+  void Reset();
+
+  /// @brief Writes the per layer statistics as a JSON object.
+  void WriteJSON(std::ostream* out) const;
+  /// @brief Writes the recorded calls in the Chrome trace event format.
+  void WriteChromeTrace(std::ostream* out) const;
+
+  /// @brief The statistics of the calls of one layer in one pass.
+  struct Stats {
+    Stats();
+    void Add(int64_t duration_us, int64_t bytes_read, int64_t bytes_written,
+        int64_t flops);
+    /// The upper bound of the bucket holding the given quantile.
+    int64_t Quantile(double q) const;
+
+    int64_t count;
+    int64_t total_us;
+    int64_t min_us;
+    int64_t max_us;
+    int64_t bytes_read;
+    int64_t bytes_written;
+    int64_t flops;
+    /// Bucket 0 counts calls under 1 us, bucket b those under 2^b us.
+    vector<int64_t> histogram;
+  };
+  inline const Stats& stats(int layer_id, Pass pass) const {
+    return stats_[pass][layer_id];
+  }
+
+  /// @brief The floating point operations of a Forward of layer, estimated
+  ///        from its type and blob shapes.
+  static int64_t ForwardFlops(Layer<Dtype>* layer,
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top);
+
+ protected:
+  struct Event {
+    int layer_id;
+    Pass pass;
+    int64_t start_us;
+    int64_t duration_us;
+  };
+
+  vector<string> layer_names_;
+  vector<string> layer_types_;
+  vector<Stats> stats_[2];
+  /// A ring of the most recent calls, the oldest at next_event_ once full.
+  vector<Event> events_;
+  int max_events_;
+  int next_event_;
+  Timer timer_;
+  boost::posix_time::ptime origin_;
+  int64_t start_us_;
+
+  DISABLE_COPY_AND_ASSIGN(NetProfiler);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_NET_PROFILER_HPP_
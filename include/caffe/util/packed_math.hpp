@@ -0,0 +1,136 @@
+#ifndef CAFFE_UTIL_PACKED_MATH_HPP_
+#define CAFFE_UTIL_PACKED_MATH_HPP_
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif  // __SSE2__
+
+#include <cmath>
+
+namespace caffe {
+
+/**
+ * @brief Packs of consecutive values computed on together, so that
+ *        elementwise loops written once over a pack type run on the widest
+ *        SIMD registers the build targets: AVX, else SSE2 on x86, else one
+ *        value at a time.
+ *
+ * Packs convert implicitly from a single value, which they hold in every
+ * lane, and support +, -, *, /, Sqrt and Sign. ForEachPack drives loops over
+ * them.
+ */
+template <typename Dtype>
+struct ScalarPack {
+  static const int kSize = 1;
+  Dtype v;
+
+  ScalarPack() {}
+  ScalarPack(Dtype x) : v(x) {}  // NOLINT(runtime/explicit)
+  static inline ScalarPack Load(const Dtype* p) { return ScalarPack(*p); }
+  inline void Store(Dtype* p) const { *p = v; }
+};
+
+#define CAFFE_SCALAR_PACK_OPERATOR(op) \
+template <typename Dtype> \
+inline ScalarPack<Dtype> operator op(ScalarPack<Dtype> a, \
+    ScalarPack<Dtype> b) { \
+  return ScalarPack<Dtype>(a.v op b.v); \
+}
+
+CAFFE_SCALAR_PACK_OPERATOR(+)
+CAFFE_SCALAR_PACK_OPERATOR(-)
+CAFFE_SCALAR_PACK_OPERATOR(*)
+CAFFE_SCALAR_PACK_OPERATOR(/)
+
+template <typename Dtype>
+inline ScalarPack<Dtype> Sqrt(ScalarPack<Dtype> a) {
+  return ScalarPack<Dtype>(std::sqrt(a.v));
+}
+
+template <typename Dtype>
+inline ScalarPack<Dtype> Sign(ScalarPack<Dtype> a) {
+  return ScalarPack<Dtype>((Dtype(0) < a.v) - (a.v < Dtype(0)));
+}
+
+/// @brief The widest pack of Dtype values the build targets.
+template <typename Dtype>
+struct SimdPack {
+  typedef ScalarPack<Dtype> Type;
+};
+
+// Defines Name, a pack of kN Dtype values in a Reg register, with the
+// intrinsics of the given prefix and suffix, and Less(a, b) the all-ones
+// lanes where a < b.
+#define CAFFE_SIMD_PACK(Name, Dtype, Reg, kN, prefix, suffix, Less) \
+struct Name { \
+  static const int kSize = kN; \
+  Reg v; \
+  Name() {} \
+  Name(Dtype x) : v(prefix##set1_##suffix(x)) {}  /* NOLINT */ \
+  explicit Name(Reg x) : v(x) {} \
+  static inline Name Load(const Dtype* p) { \
+    return Name(prefix##loadu_##suffix(p)); \
+  } \
+  inline void Store(Dtype* p) const { prefix##storeu_##suffix(p, v); } \
+}; \
+inline Name operator+(Name a, Name b) { \
+  return Name(prefix##add_##suffix(a.v, b.v)); \
+} \
+inline Name operator-(Name a, Name b) { \
+  return Name(prefix##sub_##suffix(a.v, b.v)); \
+} \
+inline Name operator*(Name a, Name b) { \
+  return Name(prefix##mul_##suffix(a.v, b.v)); \
+} \
+inline Name operator/(Name a, Name b) { \
+  return Name(prefix##div_##suffix(a.v, b.v)); \
+} \
+inline Name Sqrt(Name a) { return Name(prefix##sqrt_##suffix(a.v)); } \
+inline Name Sign(Name a) { \
+  const Reg zero = prefix##setzero_##suffix(); \
+  const Reg one = prefix##set1_##suffix(1); \
+  return Name(prefix##sub_##suffix( \
+      prefix##and_##suffix(Less(zero, a.v), one), \
+      prefix##and_##suffix(Less(a.v, zero), one))); \
+} \
+template <> \
+struct SimdPack<Dtype> { \
+  typedef Name Type; \
+};
+
+#if defined(__AVX__)
+#define CAFFE_AVX_LESS_PS(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define CAFFE_AVX_LESS_PD(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+CAFFE_SIMD_PACK(FloatPack, float, __m256, 8, _mm256_, ps, CAFFE_AVX_LESS_PS)
+CAFFE_SIMD_PACK(DoublePack, double, __m256d, 4, _mm256_, pd,
+    CAFFE_AVX_LESS_PD)
+#undef CAFFE_AVX_LESS_PS
+#undef CAFFE_AVX_LESS_PD
+#elif defined(__SSE2__)
+CAFFE_SIMD_PACK(FloatPack, float, __m128, 4, _mm_, ps, _mm_cmplt_ps)
+CAFFE_SIMD_PACK(DoublePack, double, __m128d, 2, _mm_, pd, _mm_cmplt_pd)
+#endif
+
+#undef CAFFE_SIMD_PACK
+#undef CAFFE_SCALAR_PACK_OPERATOR
+
+/**
+ * @brief Calls kernel.template Apply<P>(i) over the values i in [0, n), with
+ *        P the widest pack of Dtype values and single values for the rest,
+ *        such that Apply computes on the P::kSize values from i.
+ */
+template <typename Dtype, typename Kernel>
+inline void ForEachPack(int n, const Kernel& kernel) {
+  typedef typename SimdPack<Dtype>::Type Pack;
+  int i = 0;
+  for (; i + Pack::kSize <= n; i += Pack::kSize) {
+    kernel.template Apply<Pack>(i);
+  }
+  for (; i < n; ++i) {
+    kernel.template Apply<ScalarPack<Dtype> >(i);
+  }
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PACKED_MATH_HPP_
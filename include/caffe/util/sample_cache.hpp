@@ -0,0 +1,79 @@
+#ifndef CAFFE_UTIL_SAMPLE_CACHE_HPP_
+#define CAFFE_UTIL_SAMPLE_CACHE_HPP_
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+/*
+ Forward declare boost::mutex instead of including boost/thread.hpp
+ to avoid a boost/NVCC issues (#1009, #1010) on OSX.
+ */
+namespace boost { class mutex; }
+
+namespace caffe {
+
+/**
+ * @brief Keeps the uint8 pixels of decoded samples, identified by their
+ *        position in the database, packed in large blocks of memory, so that
+ *        data layers decode every sample only once.
+ *
+ * The cache only grows: once its capacity is used, further samples are not
+ * cached. Its calls may be made from several threads.
+ */
+class SampleCache {
+ public:
+  static const size_t kBlockSize = 64 << 20;
+
+  /**
+   * @param capacity the number of bytes of pixels kept at most.
+   * @param block_size the size of the blocks of memory allocated.
+   */
+  explicit SampleCache(size_t capacity, size_t block_size = kBlockSize);
+
+  /**
+   * @brief Gets the shape of a cached sample in shape and points data at
+   *        its pixels, which stay valid as long as the cache.
+   * @return false if the sample is not cached.
+   */
+  bool Get(int index, Datum* shape, const char** data,
+      size_t* data_size) const;
+  /**
+   * @brief Caches the pixels of datum, a decoded (not encoded) datum, as
+   *        the sample at index.
+   * @return false if they do not fit.
+   */
+  bool Put(int index, const Datum& datum);
+
+  /// @brief The number of bytes of pixels cached.
+  size_t size() const;
+  /// @brief The number of samples cached.
+  int count() const;
+
+ private:
+  struct Entry {
+    const char* data;
+    size_t data_size;
+    int channels;
+    int height;
+    int width;
+  };
+
+  size_t capacity_;
+  size_t block_size_;
+  size_t size_;
+  int count_;
+  // The entries by index, with NULL data for the samples not cached.
+  vector<Entry> entries_;
+  vector<shared_ptr<vector<char> > > blocks_;
+  // The bytes used of the last block.
+  size_t block_used_;
+  shared_ptr<boost::mutex> mutex_;
+
+  DISABLE_COPY_AND_ASSIGN(SampleCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SAMPLE_CACHE_HPP_
@@ -0,0 +1,65 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <boost/function.hpp>
+
+#include <deque>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace boost { class thread; }
+
+namespace caffe {
+
+/**
+ * @brief A fixed set of worker threads running CPU work on behalf of layers
+ *        and data loaders.
+ *
+ * Workers do not set up the thread-local Caffe state (mode, RNG, device),
+ * so tasks should only compute on the CPU memory they are handed.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  int num_threads() const { return threads_.size(); }
+
+  /// @brief Queues task to run on one of the workers.
+  void Schedule(const boost::function<void()>& task);
+
+  /**
+   * @brief Calls task(i) for every i in [0, n) and returns once all calls
+   *        have completed.
+   *
+   * The calling thread takes part in the work, so Run makes progress (and
+   * may be nested) even when every worker is busy.
+   */
+  void Run(int n, const boost::function<void(int)>& task);
+
+  /**
+   * @brief The process-wide pool, with one thread per hardware thread
+   *        besides the caller.
+   */
+  static ThreadPool& Global();
+
+  /// @brief Resolves a user-facing thread count, where 0 means one per core.
+  static int ResolveNumThreads(int num_threads);
+
+ private:
+  class sync;
+  class Batch;
+  void WorkerEntry();
+
+  shared_ptr<sync> sync_;
+  std::deque<boost::function<void()> > tasks_;
+  bool stopping_;
+  vector<shared_ptr<boost::thread> > threads_;
+
+  DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
@@ -5,6 +5,7 @@
 #include <ctime>
 
 #include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
@@ -53,7 +54,8 @@ void GlobalInit(int* pargc, char*** pargv) {
 
 Caffe::Caffe()
     : random_generator_(), mode_(Caffe::CPU),
-      solver_count_(1), root_solver_(true) { }
+      solver_count_(1), solver_rank_(0), multiprocess_(false),
+      root_solver_(true), host_allocator_(HostAllocator::Get()) { }
 
 Caffe::~Caffe() { }
 
@@ -106,7 +108,9 @@ void* Caffe::RNG::generator() {
 
 Caffe::Caffe()
     : cublas_handle_(NULL), curand_generator_(NULL), random_generator_(),
-    mode_(Caffe::CPU), solver_count_(1), root_solver_(true) {
+    mode_(Caffe::CPU), solver_count_(1), solver_rank_(0),
+    multiprocess_(false), root_solver_(true),
+    host_allocator_(HostAllocator::Get()) {
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
   if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
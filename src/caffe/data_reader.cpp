@@ -1,4 +1,5 @@
 #include <boost/thread.hpp>
+#include <algorithm>
 #include <map>
 #include <string>
 #include <vector>
@@ -7,6 +8,9 @@
 #include "caffe/data_reader.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
@@ -44,17 +48,17 @@ DataReader::~DataReader() {
 DataReader::QueuePair::QueuePair(int size) {
   // Initialize the free queue with requested number of datums
   for (int i = 0; i < size; ++i) {
-    free_.push(new Datum());
+    free_.push(new Item());
   }
 }
 
 DataReader::QueuePair::~QueuePair() {
-  Datum* datum;
-  while (free_.try_pop(&datum)) {
-    delete datum;
+  Item* item;
+  while (free_.try_pop(&item)) {
+    delete item;
   }
-  while (full_.try_pop(&datum)) {
-    delete datum;
+  while (full_.try_pop(&item)) {
+    delete item;
   }
 }
 
@@ -62,21 +66,41 @@ DataReader::QueuePair::~QueuePair() {
 
 DataReader::Body::Body(const LayerParameter& param)
     : param_(param),
-      new_queue_pairs_() {
+      new_queue_pairs_(),
+      shuffle_seed_(0),
+      epoch_(0),
+      record_index_(0),
+      stride_(1) {
   StartInternalThread();
 }
 
 DataReader::Body::~Body() {
   StopInternalThread();
+  for (int i = 0; i < shuffle_buffer_.size(); ++i) {
+    delete shuffle_buffer_[i];
+  }
 }
 
 void DataReader::Body::InternalThreadEntry() {
   shared_ptr<db::DB> db(db::GetDB(param_.data_param().backend()));
   db->Open(param_.data_param().source(), db::READ);
   shared_ptr<db::Cursor> cursor(db->NewCursor());
+  // The thread is seeded from the thread creating it, so seeded runs
+  // shuffle the same way.
+  shuffle_seed_ = caffe_rng_rand();
+  shuffle_rng_.reset(new Caffe::RNG(shuffle_seed_));
   vector<shared_ptr<QueuePair> > qps;
   try {
     int solver_count = param_.phase() == TRAIN ? Caffe::solver_count() : 1;
+    // Replicas in processes of their own have a reader each, which reads
+    // every solver_count-th record from the one of its rank.
+    if (solver_count > 1 && Caffe::multiprocess()) {
+      stride_ = solver_count;
+      for (int i = 0; i < Caffe::solver_rank(); ++i) {
+        next(cursor.get());
+      }
+      solver_count = 1;
+    }
 
     // To ensure deterministic runs, only start running once all solvers
     // are ready. But solvers need to peek on one item during initialization,
@@ -103,16 +127,60 @@ void DataReader::Body::InternalThreadEntry() {
 }
 
 void DataReader::Body::read_one(db::Cursor* cursor, QueuePair* qp) {
-  Datum* datum = qp->free_.pop();
-  // TODO deserialize in-place instead of copy?
-  datum->ParseFromString(cursor->value());
-  qp->full_.push(datum);
+  Item* item = qp->free_.pop();
+  const int shuffle_buffer_size = param_.data_param().shuffle_buffer_size();
+  if (shuffle_buffer_size > 0) {
+    // Fill the buffer first, then emit a random record of the buffer and
+    // read the next record into the free item taking its place.
+    while (shuffle_buffer_.size() < shuffle_buffer_size) {
+      shuffle_buffer_.push_back(new Item());
+      read(cursor, shuffle_buffer_.back());
+    }
+    caffe::rng_t* rng = static_cast<caffe::rng_t*>(shuffle_rng_->generator());
+    const int i = (*rng)() % shuffle_buffer_size;
+    std::swap(item, shuffle_buffer_[i]);
+    read(cursor, shuffle_buffer_[i]);
+  } else {
+    read(cursor, item);
+  }
+  qp->full_.push(item);
+}
 
-  // go to the next iter
+void DataReader::Body::read(db::Cursor* cursor, Item* item) {
+  const char* value;
+  size_t value_size;
+  cursor->value_data(&value, &value_size);
+  if (cursor->pins_values()) {
+    CHECK(ParseDatumInPlace(value, value_size, &item->datum, &item->data,
+        &item->data_size)) << "Cannot parse the datum at " << cursor->key();
+    // Encoded datums are decoded from their data, so they get their copy.
+    if (item->datum.encoded() && item->data) {
+      item->datum.set_data(item->data, item->data_size);
+      item->data = NULL;
+      item->data_size = 0;
+    }
+  } else {
+    item->datum.ParseFromArray(value, value_size);
+    item->data = NULL;
+    item->data_size = 0;
+  }
+  item->index = record_index_;
+  for (int i = 0; i < stride_; ++i) {
+    next(cursor);
+  }
+}
+
+void DataReader::Body::next(db::Cursor* cursor) {
+  ++record_index_;
   cursor->Next();
   if (!cursor->valid()) {
     DLOG(INFO) << "Restarting data prefetching from start.";
     cursor->SeekToFirst();
+    record_index_ = 0;
+    ++epoch_;
+    if (param_.data_param().shuffle_reseed_per_epoch()) {
+      shuffle_rng_.reset(new Caffe::RNG(shuffle_seed_ + epoch_));
+    }
   }
 }
 
@@ -0,0 +1,54 @@
+#include <string>
+#include <vector>
+
+#include "caffe/inference_pool.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+InferencePool<Dtype>::InferencePool(const NetParameter& param,
+    const string& trained_filename, int num_sessions) {
+  CHECK_GE(num_sessions, 1);
+  CHECK_EQ(param.state().phase(), TEST)
+      << "Inference sessions need a TEST phase net.";
+  sessions_.push_back(shared_ptr<Net<Dtype> >(new Net<Dtype>(param)));
+  if (!trained_filename.empty()) {
+    sessions_[0]->CopyTrainedLayersFrom(trained_filename);
+  }
+  // Move the weights to where Forward reads them now, so that concurrent
+  // sessions never race to synchronize them.
+  const vector<shared_ptr<Blob<Dtype> > >& params = sessions_[0]->params();
+  for (int i = 0; i < params.size(); ++i) {
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      params[i]->cpu_data();
+      break;
+    case Caffe::GPU:
+      params[i]->gpu_data();
+      break;
+    }
+  }
+  for (int i = 1; i < num_sessions; ++i) {
+    sessions_.push_back(shared_ptr<Net<Dtype> >(
+        new Net<Dtype>(param, NULL, sessions_[0].get())));
+  }
+  for (int i = 0; i < num_sessions; ++i) {
+    free_sessions_.push(sessions_[i].get());
+  }
+  LOG(INFO) << "Created " << num_sessions << " inference sessions of net "
+      << sessions_[0]->name();
+}
+
+template <typename Dtype>
+Net<Dtype>* InferencePool<Dtype>::Acquire() {
+  return free_sessions_.pop("Waiting for a free inference session");
+}
+
+template <typename Dtype>
+void InferencePool<Dtype>::Release(Net<Dtype>* net) {
+  free_sessions_.push(net);
+}
+
+INSTANTIATE_CLASS(InferencePool);
+
+}  // namespace caffe
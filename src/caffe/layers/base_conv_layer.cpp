@@ -256,17 +256,25 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
     const Dtype* weights, Dtype* output, bool skip_im2col) {
-  const Dtype* col_buff = input;
+  forward_cpu_gemm(input, weights, output,
+      is_1x1_ ? NULL : col_buffer_.mutable_cpu_data(), skip_im2col);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
+    const Dtype* weights, Dtype* output, Dtype* col_buff,
+    bool skip_im2col) {
+  const Dtype* col_input = input;
   if (!is_1x1_) {
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+      conv_im2col_cpu(input, col_buff);
     }
-    col_buff = col_buffer_.cpu_data();
+    col_input = col_buff;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
         group_, conv_out_spatial_dim_, kernel_dim_,
-        (Dtype)1., weights + weight_offset_ * g, col_buff + col_offset_ * g,
+        (Dtype)1., weights + weight_offset_ * g, col_input + col_offset_ * g,
         (Dtype)0., output + output_offset_ * g);
   }
 }
@@ -282,7 +290,13 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data();
+  backward_cpu_gemm(output, weights, input,
+      is_1x1_ ? NULL : col_buffer_.mutable_cpu_data());
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
+    const Dtype* weights, Dtype* input, Dtype* col_buff) {
   if (is_1x1_) {
     col_buff = input;
   }
@@ -300,15 +314,22 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
     const Dtype* output, Dtype* weights) {
-  const Dtype* col_buff = input;
+  weight_cpu_gemm(input, output, weights,
+      is_1x1_ ? NULL : col_buffer_.mutable_cpu_data());
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
+    const Dtype* output, Dtype* weights, Dtype* col_buff) {
+  const Dtype* col_input = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
-    col_buff = col_buffer_.cpu_data();
+    conv_im2col_cpu(input, col_buff);
+    col_input = col_buff;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
         kernel_dim_, conv_out_spatial_dim_,
-        (Dtype)1., output + output_offset_ * g, col_buff + col_offset_ * g,
+        (Dtype)1., output + output_offset_ * g, col_input + col_offset_ * g,
         (Dtype)1., weights + weight_offset_ * g);
   }
 }
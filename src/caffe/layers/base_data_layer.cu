@@ -7,9 +7,26 @@ namespace caffe {
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  // The previous batch is no longer used by the tops.
+  if (prefetch_current_) {
+    prefetch_free_.push(prefetch_current_);
+    prefetch_current_ = NULL;
+  }
   Batch<Dtype>* batch = prefetch_full_.pop("Data layer prefetch queue empty");
   // Reshape to loaded data.
   top[0]->ReshapeLike(batch->data_);
+  if (this->layer_param_.data_param().share_prefetched_batches()) {
+    // Point the tops at the batch, kept until the next Forward. The batch
+    // stays synced, as mutable_gpu_data would have the next load_batch copy
+    // it back to the host before overwriting it.
+    top[0]->set_gpu_data(const_cast<Dtype*>(batch->data_.gpu_data()));
+    if (this->output_labels_) {
+      top[1]->ReshapeLike(batch->label_);
+      top[1]->set_gpu_data(const_cast<Dtype*>(batch->label_.gpu_data()));
+    }
+    prefetch_current_ = batch;
+    return;
+  }
   // Copy the data
   caffe_copy(batch->data_.count(), batch->data_.gpu_data(),
       top[0]->mutable_gpu_data());
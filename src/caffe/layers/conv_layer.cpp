@@ -1,9 +1,59 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  BaseConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  // A single channel convolution is one group too, but gemm does it best.
+  depthwise_ = this->num_spatial_axes_ == 2 && !this->force_nd_im2col_ &&
+      this->channels_ > 1 && this->group_ == this->channels_;
+  const ConvolutionParameter& conv_param =
+      this->layer_param_.convolution_param();
+  num_threads_ = ThreadPool::ResolveNumThreads(conv_param.num_threads());
+  fused_relu_ = conv_param.fused_relu();
+  fused_relu_negative_slope_ = conv_param.fused_relu_negative_slope();
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  BaseConvolutionLayer<Dtype>::Reshape(bottom, top);
+  // Split the batch into one chunk per thread; the buffers of each chunk are
+  // only allocated once used, so 1x1 and depthwise convolution need no
+  // column buffers.
+  const int num_chunks = std::min(num_threads_, this->num_);
+  if (num_chunks <= 1) {
+    chunk_col_buffers_.clear();
+    chunk_weight_diffs_.clear();
+    return;
+  }
+  chunk_col_buffers_.resize(num_chunks);
+  for (int c = 0; c < num_chunks; ++c) {
+    if (!chunk_col_buffers_[c]) {
+      chunk_col_buffers_[c].reset(new Blob<Dtype>());
+    }
+    if (!depthwise_) {
+      chunk_col_buffers_[c]->Reshape(this->col_buffer_shape_);
+    }
+  }
+  chunk_weight_diffs_.resize(num_chunks - 1);
+  for (int c = 0; c < num_chunks - 1; ++c) {
+    if (!chunk_weight_diffs_[c]) {
+      chunk_weight_diffs_[c].reset(new Blob<Dtype>());
+    }
+    chunk_weight_diffs_[c]->ReshapeLike(*this->blobs_[0]);
+  }
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::compute_output_shape() {
   const int* kernel_shape_data = this->kernel_shape_.cpu_data();
@@ -28,13 +78,29 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
+    if (!chunk_col_buffers_.empty()) {
+      const Dtype* bias =
+          this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+      ThreadPool::Global().Run(chunk_col_buffers_.size(), boost::bind(
+          &ConvolutionLayer<Dtype>::forward_cpu_chunk, this, _1, bottom_data,
+          weight, bias, top_data));
+      continue;
+    }
     for (int n = 0; n < this->num_; ++n) {
-      this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
-          top_data + n * this->top_dim_);
+      if (depthwise_) {
+        forward_cpu_depthwise(bottom_data + n * this->bottom_dim_, weight,
+            top_data + n * this->top_dim_);
+      } else {
+        this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
+            top_data + n * this->top_dim_);
+      }
       if (this->bias_term_) {
         const Dtype* bias = this->blobs_[1]->cpu_data();
         this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
       }
+      if (fused_relu_) {
+        forward_cpu_relu(top_data + n * this->top_dim_);
+      }
     }
   }
 }
@@ -42,6 +108,8 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!fused_relu_) << "Layer " << this->layer_param_.name()
+      << " has a fused ReLU and cannot be backpropagated.";
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   for (int i = 0; i < top.size(); ++i) {
@@ -55,15 +123,36 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
       }
     }
-    if (this->param_propagate_down_[0] || propagate_down[i]) {
+    if (!chunk_col_buffers_.empty() &&
+        (this->param_propagate_down_[0] || propagate_down[i])) {
+      ThreadPool::Global().Run(chunk_col_buffers_.size(), boost::bind(
+          &ConvolutionLayer<Dtype>::backward_cpu_chunk, this, _1, top_diff,
+          bottom_data, weight,
+          this->param_propagate_down_[0] ? weight_diff : NULL,
+          propagate_down[i] ? bottom_diff : NULL));
+      // Reduce the weight gradients of the chunks in a fixed order, so that
+      // the result does not depend on scheduling.
+      if (this->param_propagate_down_[0]) {
+        for (int c = 0; c < chunk_weight_diffs_.size(); ++c) {
+          caffe_axpy<Dtype>(this->blobs_[0]->count(), Dtype(1),
+              chunk_weight_diffs_[c]->cpu_data(), weight_diff);
+        }
+      }
+    } else if (this->param_propagate_down_[0] || propagate_down[i]) {
       for (int n = 0; n < this->num_; ++n) {
         // gradient w.r.t. weight. Note that we will accumulate diffs.
-        if (this->param_propagate_down_[0]) {
+        if (this->param_propagate_down_[0] && depthwise_) {
+          weight_cpu_depthwise(bottom_data + n * this->bottom_dim_,
+              top_diff + n * this->top_dim_, weight_diff);
+        } else if (this->param_propagate_down_[0]) {
           this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
               top_diff + n * this->top_dim_, weight_diff);
         }
         // gradient w.r.t. bottom data, if necessary.
-        if (propagate_down[i]) {
+        if (propagate_down[i] && depthwise_) {
+          backward_cpu_depthwise(top_diff + n * this->top_dim_, weight,
+              bottom_diff + n * this->bottom_dim_);
+        } else if (propagate_down[i]) {
           this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
               bottom_diff + n * this->bottom_dim_);
         }
@@ -72,6 +161,221 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
 }
 
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_cpu_chunk(int chunk,
+      const Dtype* bottom_data, const Dtype* weight, const Dtype* bias,
+      Dtype* top_data) {
+  const int num_chunks = chunk_col_buffers_.size();
+  Dtype* col_buff = this->is_1x1_ || depthwise_ ?
+      NULL : chunk_col_buffers_[chunk]->mutable_cpu_data();
+  for (int n = this->num_ * chunk / num_chunks;
+       n < this->num_ * (chunk + 1) / num_chunks; ++n) {
+    if (depthwise_) {
+      forward_cpu_depthwise(bottom_data + n * this->bottom_dim_, weight,
+          top_data + n * this->top_dim_);
+    } else {
+      this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
+          top_data + n * this->top_dim_, col_buff);
+    }
+    if (bias) {
+      this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+    }
+    if (fused_relu_) {
+      forward_cpu_relu(top_data + n * this->top_dim_);
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_cpu_relu(Dtype* output) {
+  for (int i = 0; i < this->top_dim_; ++i) {
+    if (output[i] < 0) {
+      output[i] *= fused_relu_negative_slope_;
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_cpu_chunk(int chunk,
+      const Dtype* top_diff, const Dtype* bottom_data, const Dtype* weight,
+      Dtype* weight_diff, Dtype* bottom_diff) {
+  const int num_chunks = chunk_col_buffers_.size();
+  Dtype* col_buff = this->is_1x1_ || depthwise_ ?
+      NULL : chunk_col_buffers_[chunk]->mutable_cpu_data();
+  // All chunks but the first accumulate into a weight gradient of their own.
+  if (weight_diff && chunk > 0) {
+    weight_diff = chunk_weight_diffs_[chunk - 1]->mutable_cpu_data();
+    caffe_set(chunk_weight_diffs_[chunk - 1]->count(), Dtype(0), weight_diff);
+  }
+  for (int n = this->num_ * chunk / num_chunks;
+       n < this->num_ * (chunk + 1) / num_chunks; ++n) {
+    if (weight_diff && depthwise_) {
+      weight_cpu_depthwise(bottom_data + n * this->bottom_dim_,
+          top_diff + n * this->top_dim_, weight_diff);
+    } else if (weight_diff) {
+      this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
+          top_diff + n * this->top_dim_, weight_diff, col_buff);
+    }
+    if (bottom_diff && depthwise_) {
+      backward_cpu_depthwise(top_diff + n * this->top_dim_, weight,
+          bottom_diff + n * this->bottom_dim_);
+    } else if (bottom_diff) {
+      this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
+          bottom_diff + n * this->bottom_dim_, col_buff);
+    }
+  }
+}
+
+// The range [*begin, *end) of the output columns whose input column,
+// column * stride + offset, lies inside [0, width).
+static void depthwise_column_range(int offset, int stride, int width,
+    int output_width, int* begin, int* end) {
+  *begin = offset < 0 ? (-offset + stride - 1) / stride : 0;
+  *end = width - 1 - offset < 0 ? 0 :
+      std::min(output_width, (width - 1 - offset) / stride + 1);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_cpu_depthwise(const Dtype* input,
+      const Dtype* weights, Dtype* output) {
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* pad = this->pad_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  const int height = this->input_shape(1);
+  const int width = this->input_shape(2);
+  const int output_height = this->output_shape_[0];
+  const int output_width = this->output_shape_[1];
+  const int kernel_size = kernel_shape[0] * kernel_shape[1];
+  const int multiplier = this->num_output_ / this->group_;
+  caffe_set(this->top_dim_, Dtype(0), output);
+  for (int c = 0; c < this->num_output_; ++c) {
+    const Dtype* input_map = input + c / multiplier * height * width;
+    const Dtype* kernel = weights + c * kernel_size;
+    Dtype* output_map = output + c * output_height * output_width;
+    for (int h = 0; h < output_height; ++h) {
+      Dtype* output_row = output_map + h * output_width;
+      for (int kh = 0; kh < kernel_shape[0]; ++kh) {
+        const int input_h = h * stride[0] - pad[0] + kh * dilation[0];
+        if (input_h < 0 || input_h >= height) {
+          continue;
+        }
+        const Dtype* input_row = input_map + input_h * width;
+        for (int kw = 0; kw < kernel_shape[1]; ++kw) {
+          const int offset = kw * dilation[1] - pad[1];
+          const Dtype w = kernel[kh * kernel_shape[1] + kw];
+          int begin, end;
+          depthwise_column_range(offset, stride[1], width, output_width,
+              &begin, &end);
+          if (stride[1] == 1) {
+            for (int x = begin; x < end; ++x) {
+              output_row[x] += w * input_row[x + offset];
+            }
+          } else {
+            for (int x = begin; x < end; ++x) {
+              output_row[x] += w * input_row[x * stride[1] + offset];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_cpu_depthwise(const Dtype* output,
+      const Dtype* weights, Dtype* input) {
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* pad = this->pad_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  const int height = this->input_shape(1);
+  const int width = this->input_shape(2);
+  const int output_height = this->output_shape_[0];
+  const int output_width = this->output_shape_[1];
+  const int kernel_size = kernel_shape[0] * kernel_shape[1];
+  const int multiplier = this->num_output_ / this->group_;
+  caffe_set(this->bottom_dim_, Dtype(0), input);
+  for (int c = 0; c < this->num_output_; ++c) {
+    Dtype* input_map = input + c / multiplier * height * width;
+    const Dtype* kernel = weights + c * kernel_size;
+    const Dtype* output_map = output + c * output_height * output_width;
+    for (int h = 0; h < output_height; ++h) {
+      const Dtype* output_row = output_map + h * output_width;
+      for (int kh = 0; kh < kernel_shape[0]; ++kh) {
+        const int input_h = h * stride[0] - pad[0] + kh * dilation[0];
+        if (input_h < 0 || input_h >= height) {
+          continue;
+        }
+        Dtype* input_row = input_map + input_h * width;
+        for (int kw = 0; kw < kernel_shape[1]; ++kw) {
+          const int offset = kw * dilation[1] - pad[1];
+          const Dtype w = kernel[kh * kernel_shape[1] + kw];
+          int begin, end;
+          depthwise_column_range(offset, stride[1], width, output_width,
+              &begin, &end);
+          if (stride[1] == 1) {
+            for (int x = begin; x < end; ++x) {
+              input_row[x + offset] += w * output_row[x];
+            }
+          } else {
+            for (int x = begin; x < end; ++x) {
+              input_row[x * stride[1] + offset] += w * output_row[x];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::weight_cpu_depthwise(const Dtype* input,
+      const Dtype* output, Dtype* weights) {
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* pad = this->pad_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  const int height = this->input_shape(1);
+  const int width = this->input_shape(2);
+  const int output_height = this->output_shape_[0];
+  const int output_width = this->output_shape_[1];
+  const int kernel_size = kernel_shape[0] * kernel_shape[1];
+  const int multiplier = this->num_output_ / this->group_;
+  for (int c = 0; c < this->num_output_; ++c) {
+    const Dtype* input_map = input + c / multiplier * height * width;
+    Dtype* kernel = weights + c * kernel_size;
+    const Dtype* output_map = output + c * output_height * output_width;
+    for (int h = 0; h < output_height; ++h) {
+      const Dtype* output_row = output_map + h * output_width;
+      for (int kh = 0; kh < kernel_shape[0]; ++kh) {
+        const int input_h = h * stride[0] - pad[0] + kh * dilation[0];
+        if (input_h < 0 || input_h >= height) {
+          continue;
+        }
+        const Dtype* input_row = input_map + input_h * width;
+        for (int kw = 0; kw < kernel_shape[1]; ++kw) {
+          const int offset = kw * dilation[1] - pad[1];
+          int begin, end;
+          depthwise_column_range(offset, stride[1], width, output_width,
+              &begin, &end);
+          Dtype sum = 0;
+          if (stride[1] == 1) {
+            for (int x = begin; x < end; ++x) {
+              sum += output_row[x] * input_row[x + offset];
+            }
+          } else {
+            for (int x = begin; x < end; ++x) {
+              sum += output_row[x] * input_row[x * stride[1] + offset];
+            }
+          }
+          kernel[kh * kernel_shape[1] + kw] += sum;
+        }
+      }
+    }
+  }
+}
+
 #ifdef CPU_ONLY
 STUB_GPU(ConvolutionLayer);
 #endif
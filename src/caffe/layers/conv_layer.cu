@@ -4,6 +4,23 @@
 
 namespace caffe {
 
+template <typename Dtype>
+__global__ void FusedReLUForward(const int n, Dtype* out,
+    Dtype negative_slope) {
+  CUDA_KERNEL_LOOP(index, n) {
+    out[index] = out[index] > 0 ? out[index] : out[index] * negative_slope;
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_gpu_relu(Blob<Dtype>* top) {
+  const int count = top->count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  FusedReLUForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+      count, top->mutable_gpu_data(), fused_relu_negative_slope_);
+  CUDA_POST_KERNEL_CHECK;
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -19,12 +36,17 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
         this->forward_gpu_bias(top_data + n * this->top_dim_, bias);
       }
     }
+    if (fused_relu_) {
+      forward_gpu_relu(top[i]);
+    }
   }
 }
 
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!fused_relu_) << "Layer " << this->layer_param_.name()
+      << " has a fused ReLU and cannot be backpropagated.";
   const Dtype* weight = this->blobs_[0]->gpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
   for (int i = 0; i < top.size(); ++i) {
@@ -56,5 +78,7 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS(ConvolutionLayer);
+template void ConvolutionLayer<float>::forward_gpu_relu(Blob<float>* top);
+template void ConvolutionLayer<double>::forward_gpu_relu(Blob<double>* top);
 
 }  // namespace caffe
@@ -3,11 +3,15 @@
 #endif  // USE_OPENCV
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+
+#include <algorithm>
 #include <vector>
 
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
 
 namespace caffe {
 
@@ -27,7 +31,7 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const int batch_size = this->layer_param_.data_param().batch_size();
   // Read a data point, and use it to initialize the top blob.
-  Datum& datum = *(reader_.full().peek());
+  Datum& datum = reader_.full().peek()->datum;
 
   // Use data_transformer to infer the expected blob shape from datum.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
@@ -35,8 +39,8 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Reshape top[0] and prefetch_data according to the batch_size.
   top_shape[0] = batch_size;
   top[0]->Reshape(top_shape);
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].data_.Reshape(top_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.Reshape(top_shape);
   }
   LOG(INFO) << "output data size: " << top[0]->num() << ","
       << top[0]->channels() << "," << top[0]->height() << ","
@@ -45,9 +49,37 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   if (this->output_labels_) {
     vector<int> label_shape(1, batch_size);
     top[1]->Reshape(label_shape);
-    for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-      this->prefetch_[i].label_.Reshape(label_shape);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->label_.Reshape(label_shape);
+    }
+  }
+  // The first chunk uses the transformer of the layer, the others their own,
+  // seeded here in order so that seeded runs are repeatable.
+  num_threads_ = std::min(batch_size, ThreadPool::ResolveNumThreads(
+      this->layer_param_.data_param().num_threads()));
+  chunk_transformers_.resize(num_threads_);
+  chunk_transformed_data_.resize(num_threads_);
+  for (int c = 0; c < num_threads_; ++c) {
+    if (c == 0) {
+      chunk_transformers_[c] = this->data_transformer_;
+    } else {
+      chunk_transformers_[c].reset(
+          new DataTransformer<Dtype>(this->transform_param_, this->phase_));
+      chunk_transformers_[c]->InitRand();
     }
+    chunk_transformed_data_[c].reset(new Blob<Dtype>());
+  }
+  // The prefetch thread takes part in the work, so it needs one worker less.
+  if (num_threads_ > 1) {
+    thread_pool_.reset(new ThreadPool(num_threads_ - 1));
+    LOG(INFO) << "Transforming data with " << num_threads_ << " threads";
+  }
+  const size_t decoded_cache_size_mb =
+      this->layer_param_.data_param().decoded_cache_size_mb();
+  if (decoded_cache_size_mb > 0) {
+    sample_cache_.reset(new SampleCache(decoded_cache_size_mb << 20));
+    LOG(INFO) << "Caching up to " << decoded_cache_size_mb
+        << " MB of decoded data";
   }
 }
 
@@ -62,13 +94,33 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
 
+  // Take the datums of the whole batch in order, and then decode and
+  // transform them in parallel, each chunk into its own items of the batch.
+  const int batch_size = this->layer_param_.data_param().batch_size();
+  timer.Start();
+  batch_items_.resize(batch_size);
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    batch_items_[item_id] = reader_.full().pop("Waiting for data");
+  }
+  read_time += timer.MicroSeconds();
+
   // Reshape according to the first datum of each batch
   // on single input batches allows for inputs of varying dimension.
-  const int batch_size = this->layer_param_.data_param().batch_size();
-  Datum& datum = *(reader_.full().peek());
+  const Datum* datum = &batch_items_[0]->datum;
+  Datum cached_shape;
+  const char* cached_data;
+  size_t cached_data_size;
+  if (sample_cache_ && datum->encoded() && sample_cache_->Get(
+      batch_items_[0]->index, &cached_shape, &cached_data,
+      &cached_data_size)) {
+    datum = &cached_shape;
+  }
   // Use data_transformer to infer the expected blob shape from datum.
-  vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
+  vector<int> top_shape = this->data_transformer_->InferBlobShape(*datum);
   this->transformed_data_.Reshape(top_shape);
+  for (int c = 0; c < num_threads_; ++c) {
+    chunk_transformed_data_[c]->Reshape(top_shape);
+  }
   // Reshape batch according to the batch_size.
   top_shape[0] = batch_size;
   batch->data_.Reshape(top_shape);
@@ -79,23 +131,16 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   if (this->output_labels_) {
     top_label = batch->label_.mutable_cpu_data();
   }
+  timer.Start();
+  if (num_threads_ > 1) {
+    thread_pool_->Run(num_threads_, boost::bind(
+        &DataLayer<Dtype>::transform_chunk, this, _1, top_data, top_label));
+  } else {
+    transform_chunk(0, top_data, top_label);
+  }
+  trans_time += timer.MicroSeconds();
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    timer.Start();
-    // get a datum
-    Datum& datum = *(reader_.full().pop("Waiting for data"));
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply data transformations (mirror, scale, crop...)
-    int offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    this->data_transformer_->Transform(datum, &(this->transformed_data_));
-    // Copy label.
-    if (this->output_labels_) {
-      top_label[item_id] = datum.label();
-    }
-    trans_time += timer.MicroSeconds();
-
-    reader_.free().push(const_cast<Datum*>(&datum));
+    reader_.free().push(batch_items_[item_id]);
   }
   timer.Stop();
   batch_timer.Stop();
@@ -104,6 +149,58 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
+template <typename Dtype>
+void DataLayer<Dtype>::transform_chunk(int chunk, Dtype* top_data,
+    Dtype* top_label) {
+  const int batch_size = batch_items_.size();
+  const int begin = chunk * batch_size / num_threads_;
+  const int end = (chunk + 1) * batch_size / num_threads_;
+  Blob<Dtype>* transformed_data = chunk_transformed_data_[chunk].get();
+  for (int item_id = begin; item_id < end; ++item_id) {
+    DataReader::Item& item = *batch_items_[item_id];
+    const Datum* datum = &item.datum;
+    // The pixels are still in place in the database, if data is set.
+    const char* data = item.data;
+    size_t data_size = item.data_size;
+    Datum cached_shape;
+    if (sample_cache_ && datum->encoded()) {
+      if (sample_cache_->Get(item.index, &cached_shape, &data, &data_size)) {
+        datum = &cached_shape;
+      } else {
+        // Decode the datum in place as the transformer would, and keep its
+        // pixels for the next epochs.
+#ifdef USE_OPENCV
+        const TransformationParameter& transform_param =
+            this->transform_param_;
+        CHECK(!(transform_param.force_color() && transform_param.force_gray()))
+            << "cannot set both force_color and force_gray";
+        if (transform_param.force_color() || transform_param.force_gray()) {
+          DecodeDatum(&item.datum, transform_param.force_color());
+        } else {
+          DecodeDatumNative(&item.datum);
+        }
+#else
+        LOG(FATAL) << "Encoded datum requires OpenCV; compile with USE_OPENCV.";
+#endif  // USE_OPENCV
+        sample_cache_->Put(item.index, item.datum);
+      }
+    }
+    // Apply data transformations (mirror, scale, crop...)
+    transformed_data->set_cpu_data(
+        top_data + item_id * transformed_data->count());
+    if (data) {
+      chunk_transformers_[chunk]->Transform(*datum, data, data_size,
+          transformed_data);
+    } else {
+      chunk_transformers_[chunk]->Transform(*datum, transformed_data);
+    }
+    // Copy label.
+    if (top_label) {
+      top_label[item_id] = item.datum.label();
+    }
+  }
+}
+
 INSTANTIATE_CLASS(DataLayer);
 REGISTER_LAYER_CLASS(Data);
 
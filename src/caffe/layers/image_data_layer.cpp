@@ -1,6 +1,9 @@
 #ifdef USE_OPENCV
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <opencv2/core/core.hpp>
 
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
 #include <string>
@@ -27,8 +30,8 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const int new_height = this->layer_param_.image_data_param().new_height();
   const int new_width  = this->layer_param_.image_data_param().new_width();
-  const bool is_color  = this->layer_param_.image_data_param().is_color();
-  string root_folder = this->layer_param_.image_data_param().root_folder();
+  const size_t cache_size_mb =
+      this->layer_param_.image_data_param().cache_size_mb();
 
   CHECK((new_height == 0 && new_width == 0) ||
       (new_height > 0 && new_width > 0)) << "Current implementation requires "
@@ -66,10 +69,13 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_GT(lines_.size(), skip) << "Not enough points to skip";
     lines_id_ = skip;
   }
+  if (cache_size_mb > 0) {
+    cache_.reset(new LRUCache<string, cv::Mat>(cache_size_mb << 20));
+    cache_mutex_.reset(new boost::mutex());
+    LOG(INFO) << "Caching up to " << cache_size_mb << " MB of images";
+  }
   // Read an image, and use it to initialize the top blob.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-                                    new_height, new_width, is_color);
-  CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
+  cv::Mat cv_img = ReadImage(lines_[lines_id_].first);
   // Use data_transformer to infer the expected blob shape from a cv_image.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
   this->transformed_data_.Reshape(top_shape);
@@ -77,8 +83,8 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   const int batch_size = this->layer_param_.image_data_param().batch_size();
   CHECK_GT(batch_size, 0) << "Positive batch size required";
   top_shape[0] = batch_size;
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].data_.Reshape(top_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.Reshape(top_shape);
   }
   top[0]->Reshape(top_shape);
 
@@ -88,9 +94,52 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // label
   vector<int> label_shape(1, batch_size);
   top[1]->Reshape(label_shape);
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].label_.Reshape(label_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->label_.Reshape(label_shape);
+  }
+  // The first chunk uses the transformer of the layer, the others their own,
+  // seeded here in order so that seeded runs are repeatable.
+  num_threads_ = std::min(batch_size, ThreadPool::ResolveNumThreads(
+      this->layer_param_.image_data_param().num_threads()));
+  chunk_transformers_.resize(num_threads_);
+  chunk_transformed_data_.resize(num_threads_);
+  for (int c = 0; c < num_threads_; ++c) {
+    if (c == 0) {
+      chunk_transformers_[c] = this->data_transformer_;
+    } else {
+      chunk_transformers_[c].reset(
+          new DataTransformer<Dtype>(this->transform_param_, this->phase_));
+      chunk_transformers_[c]->InitRand();
+    }
+    chunk_transformed_data_[c].reset(new Blob<Dtype>());
+  }
+  // The prefetch thread takes part in the work, so it needs one worker less.
+  if (num_threads_ > 1) {
+    thread_pool_.reset(new ThreadPool(num_threads_ - 1));
+    LOG(INFO) << "Loading images with " << num_threads_ << " threads";
+  }
+}
+
+template <typename Dtype>
+cv::Mat ImageDataLayer<Dtype>::ReadImage(const string& filename) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  cv::Mat cv_img;
+  if (cache_) {
+    boost::mutex::scoped_lock lock(*cache_mutex_);
+    if (cache_->Get(filename, &cv_img)) {
+      return cv_img;
+    }
+  }
+  cv_img = ReadImageToCVMat(image_data_param.root_folder() + filename,
+      image_data_param.new_height(), image_data_param.new_width(),
+      image_data_param.is_color());
+  CHECK(cv_img.data) << "Could not load " << filename;
+  if (cache_) {
+    boost::mutex::scoped_lock lock(*cache_mutex_);
+    cache_->Put(filename, cv_img, cv_img.total() * cv_img.elemSize());
   }
+  return cv_img;
 }
 
 template <typename Dtype>
@@ -110,21 +159,19 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CPUTimer timer;
   CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
-  ImageDataParameter image_data_param = this->layer_param_.image_data_param();
-  const int batch_size = image_data_param.batch_size();
-  const int new_height = image_data_param.new_height();
-  const int new_width = image_data_param.new_width();
-  const bool is_color = image_data_param.is_color();
-  string root_folder = image_data_param.root_folder();
+  const int batch_size = this->layer_param_.image_data_param().batch_size();
 
   // Reshape according to the first image of each batch
   // on single input batches allows for inputs of varying dimension.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-      new_height, new_width, is_color);
-  CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
+  timer.Start();
+  cv::Mat cv_img = ReadImage(lines_[lines_id_].first);
+  read_time += timer.MicroSeconds();
   // Use data_transformer to infer the expected blob shape from a cv_img.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
   this->transformed_data_.Reshape(top_shape);
+  for (int c = 0; c < num_threads_; ++c) {
+    chunk_transformed_data_[c]->Reshape(top_shape);
+  }
   // Reshape batch according to the batch_size.
   top_shape[0] = batch_size;
   batch->data_.Reshape(top_shape);
@@ -132,24 +179,13 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   Dtype* prefetch_data = batch->data_.mutable_cpu_data();
   Dtype* prefetch_label = batch->label_.mutable_cpu_data();
 
-  // datum scales
+  // Take the files of the whole batch in order, and then read and transform
+  // them in parallel, each chunk into its own items of the batch.
   const int lines_size = lines_.size();
+  batch_lines_.resize(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
-    timer.Start();
     CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    int offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + offset);
-    this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    trans_time += timer.MicroSeconds();
-
-    prefetch_label[item_id] = lines_[lines_id_].second;
+    batch_lines_[item_id] = lines_[lines_id_];
     // go to the next iter
     lines_id_++;
     if (lines_id_ >= lines_size) {
@@ -161,10 +197,36 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
       }
     }
   }
+  timer.Start();
+  if (num_threads_ > 1) {
+    thread_pool_->Run(num_threads_, boost::bind(
+        &ImageDataLayer<Dtype>::load_chunk, this, _1, prefetch_data,
+        prefetch_label));
+  } else {
+    load_chunk(0, prefetch_data, prefetch_label);
+  }
+  trans_time += timer.MicroSeconds();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
-  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  DLOG(INFO) << "Read and transform time: " << trans_time / 1000 << " ms.";
+}
+
+template <typename Dtype>
+void ImageDataLayer<Dtype>::load_chunk(int chunk, Dtype* top_data,
+    Dtype* top_label) {
+  const int batch_size = batch_lines_.size();
+  const int begin = chunk * batch_size / num_threads_;
+  const int end = (chunk + 1) * batch_size / num_threads_;
+  Blob<Dtype>* transformed_data = chunk_transformed_data_[chunk].get();
+  for (int item_id = begin; item_id < end; ++item_id) {
+    cv::Mat cv_img = ReadImage(batch_lines_[item_id].first);
+    // Apply transformations (mirror, crop...) to the image
+    transformed_data->set_cpu_data(
+        top_data + item_id * transformed_data->count());
+    chunk_transformers_[chunk]->Transform(cv_img, transformed_data);
+    top_label[item_id] = batch_lines_[item_id].second;
+  }
 }
 
 INSTANTIATE_CLASS(ImageDataLayer);
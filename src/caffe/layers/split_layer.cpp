@@ -19,6 +19,8 @@ void SplitLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
         "allow in-place computation.";
     top[i]->ReshapeLike(*bottom[0]);
     CHECK_EQ(count_, top[i]->count());
+    // Share data here already, so the net sees the tops alias the bottom.
+    top[i]->ShareData(*bottom[0]);
   }
 }
 
@@ -0,0 +1,220 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/winograd_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// The 16 elements of a transformed tile, one per gemm.
+static const int kTileElements = 16;
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  winograd_ = this->num_spatial_axes_ == 2 && this->group_ == 1;
+  for (int i = 0; i < this->num_spatial_axes_; ++i) {
+    winograd_ = winograd_ && kernel_shape[i] == 3 && stride[i] == 1 &&
+        dilation[i] == 1;
+  }
+  if (!winograd_) {
+    LOG(INFO) << "Layer " << this->layer_param_.name() << " uses the CAFFE "
+        << "engine: Winograd only supports ungrouped 2D 3x3 kernels with "
+        << "stride 1 and dilation 1.";
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  if (!winograd_) {
+    return;
+  }
+  tiles_h_ = (this->output_shape_[0] + 1) / 2;
+  tiles_w_ = (this->output_shape_[1] + 1) / 2;
+  const int num_chunks = std::max(1, std::min(this->num_threads_, this->num_));
+  vector<int> input_tiles_shape(3);
+  input_tiles_shape[0] = kTileElements;
+  input_tiles_shape[1] = this->channels_;
+  input_tiles_shape[2] = tiles_h_ * tiles_w_;
+  vector<int> output_tiles_shape(input_tiles_shape);
+  output_tiles_shape[1] = this->num_output_;
+  chunk_input_tiles_.resize(num_chunks);
+  chunk_output_tiles_.resize(num_chunks);
+  for (int c = 0; c < num_chunks; ++c) {
+    if (!chunk_input_tiles_[c]) {
+      chunk_input_tiles_[c].reset(new Blob<Dtype>());
+      chunk_output_tiles_[c].reset(new Blob<Dtype>());
+    }
+    chunk_input_tiles_[c]->Reshape(input_tiles_shape);
+    chunk_output_tiles_[c]->Reshape(output_tiles_shape);
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!winograd_) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  transform_weights();
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    ThreadPool::Global().Run(chunk_input_tiles_.size(), boost::bind(
+        &WinogradConvolutionLayer<Dtype>::forward_cpu_chunk, this, _1,
+        bottom_data, bias, top_data));
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::transform_weights() {
+  // The weights change through writes to their memory, which bump its
+  // version, or by being shared from other memory.
+  const shared_ptr<SyncedMemory>& weights = this->blobs_[0]->data();
+  if (transformed_from_ == weights &&
+      transformed_version_ == weights->version()) {
+    return;
+  }
+  const Dtype* weight_data = this->blobs_[0]->cpu_data();
+  transformed_from_ = weights;
+  transformed_version_ = weights->version();
+  const int num_filters = this->num_output_ * this->channels_;
+  vector<int> transformed_shape(3);
+  transformed_shape[0] = kTileElements;
+  transformed_shape[1] = this->num_output_;
+  transformed_shape[2] = this->channels_;
+  transformed_weights_.Reshape(transformed_shape);
+  Dtype* transformed = transformed_weights_.mutable_cpu_data();
+  // U = G g G^T with G = [1 0 0; .5 .5 .5; .5 -.5 .5; 0 0 1].
+  for (int i = 0; i < num_filters; ++i) {
+    const Dtype* g = weight_data + i * 9;
+    Dtype gg[4][3];
+    for (int j = 0; j < 3; ++j) {
+      gg[0][j] = g[j];
+      gg[1][j] = (g[j] + g[3 + j] + g[6 + j]) / 2;
+      gg[2][j] = (g[j] - g[3 + j] + g[6 + j]) / 2;
+      gg[3][j] = g[6 + j];
+    }
+    for (int r = 0; r < 4; ++r) {
+      Dtype* u = transformed + r * 4 * num_filters + i;
+      u[0] = gg[r][0];
+      u[num_filters] = (gg[r][0] + gg[r][1] + gg[r][2]) / 2;
+      u[2 * num_filters] = (gg[r][0] - gg[r][1] + gg[r][2]) / 2;
+      u[3 * num_filters] = gg[r][2];
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::forward_cpu_chunk(int chunk,
+    const Dtype* bottom_data, const Dtype* bias, Dtype* top_data) {
+  const int num_chunks = chunk_input_tiles_.size();
+  Dtype* input_tiles = chunk_input_tiles_[chunk]->mutable_cpu_data();
+  Dtype* output_tiles = chunk_output_tiles_[chunk]->mutable_cpu_data();
+  for (int n = this->num_ * chunk / num_chunks;
+       n < this->num_ * (chunk + 1) / num_chunks; ++n) {
+    forward_cpu_winograd(bottom_data + n * this->bottom_dim_,
+        top_data + n * this->top_dim_, input_tiles, output_tiles);
+    if (bias) {
+      this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+    }
+    if (this->fused_relu_) {
+      this->forward_cpu_relu(top_data + n * this->top_dim_);
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::forward_cpu_winograd(
+    const Dtype* input, Dtype* output, Dtype* input_tiles,
+    Dtype* output_tiles) {
+  const int* pad = this->pad_.cpu_data();
+  const int height = this->input_shape(1);
+  const int width = this->input_shape(2);
+  const int output_height = this->output_shape_[0];
+  const int output_width = this->output_shape_[1];
+  const int num_tiles = tiles_h_ * tiles_w_;
+  // V = B^T d B for every 4x4 input tile d, with
+  // B^T = [1 0 -1 0; 0 1 1 0; 0 -1 1 0; 0 1 0 -1].
+  const int input_step = this->channels_ * num_tiles;
+  for (int c = 0; c < this->channels_; ++c) {
+    const Dtype* input_map = input + c * height * width;
+    for (int th = 0; th < tiles_h_; ++th) {
+      for (int tw = 0; tw < tiles_w_; ++tw) {
+        const int h0 = th * 2 - pad[0];
+        const int w0 = tw * 2 - pad[1];
+        Dtype d[4][4];
+        for (int y = 0; y < 4; ++y) {
+          for (int x = 0; x < 4; ++x) {
+            const int h = h0 + y;
+            const int w = w0 + x;
+            d[y][x] = (h >= 0 && h < height && w >= 0 && w < width) ?
+                input_map[h * width + w] : Dtype(0);
+          }
+        }
+        Dtype t[4][4];
+        for (int x = 0; x < 4; ++x) {
+          t[0][x] = d[0][x] - d[2][x];
+          t[1][x] = d[1][x] + d[2][x];
+          t[2][x] = d[2][x] - d[1][x];
+          t[3][x] = d[1][x] - d[3][x];
+        }
+        Dtype* v = input_tiles + c * num_tiles + th * tiles_w_ + tw;
+        for (int y = 0; y < 4; ++y) {
+          v[(y * 4) * input_step] = t[y][0] - t[y][2];
+          v[(y * 4 + 1) * input_step] = t[y][1] + t[y][2];
+          v[(y * 4 + 2) * input_step] = t[y][2] - t[y][1];
+          v[(y * 4 + 3) * input_step] = t[y][1] - t[y][3];
+        }
+      }
+    }
+  }
+  // M = U V for each of the 16 tile elements, summing over channels.
+  const Dtype* transformed_weights = transformed_weights_.cpu_data();
+  const int output_step = this->num_output_ * num_tiles;
+  for (int e = 0; e < kTileElements; ++e) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->num_output_,
+        num_tiles, this->channels_, (Dtype)1.,
+        transformed_weights + e * this->num_output_ * this->channels_,
+        input_tiles + e * input_step, (Dtype)0.,
+        output_tiles + e * output_step);
+  }
+  // Y = A^T M A for every tile, with A^T = [1 1 1 0; 0 1 -1 -1].
+  for (int k = 0; k < this->num_output_; ++k) {
+    Dtype* output_map = output + k * output_height * output_width;
+    for (int th = 0; th < tiles_h_; ++th) {
+      for (int tw = 0; tw < tiles_w_; ++tw) {
+        const Dtype* m = output_tiles + k * num_tiles + th * tiles_w_ + tw;
+        Dtype t[2][4];
+        for (int x = 0; x < 4; ++x) {
+          t[0][x] = m[x * output_step] + m[(4 + x) * output_step] +
+              m[(8 + x) * output_step];
+          t[1][x] = m[(4 + x) * output_step] - m[(8 + x) * output_step] -
+              m[(12 + x) * output_step];
+        }
+        for (int y = 0; y < 2 && th * 2 + y < output_height; ++y) {
+          Dtype* output_row = output_map + (th * 2 + y) * output_width;
+          output_row[tw * 2] = t[y][0] + t[y][1] + t[y][2];
+          if (tw * 2 + 1 < output_width) {
+            output_row[tw * 2 + 1] = t[y][1] - t[y][2] - t[y][3];
+          }
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
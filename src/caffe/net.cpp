@@ -12,6 +12,7 @@
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fuse_layers.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -23,7 +24,14 @@ namespace caffe {
 
 template <typename Dtype>
 Net<Dtype>::Net(const NetParameter& param, const Net* root_net)
-    : root_net_(root_net) {
+    : root_net_(root_net), params_net_(NULL) {
+  Init(param);
+}
+
+template <typename Dtype>
+Net<Dtype>::Net(const NetParameter& param, const Net* root_net,
+    const Net* params_net)
+    : root_net_(root_net), params_net_(params_net) {
   Init(param);
 }
 
@@ -31,7 +39,7 @@ template <typename Dtype>
 Net<Dtype>::Net(const string& param_file, Phase phase,
     const int level, const vector<string>* stages,
     const Net* root_net)
-    : root_net_(root_net) {
+    : root_net_(root_net), params_net_(NULL) {
   NetParameter param;
   ReadNetParamsFromTextFileOrDie(param_file, &param);
   // Set phase, stages and level
@@ -55,6 +63,23 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
+  fuse_layers_ = filtered_param.fuse_layers();
+  if (fuse_layers_ && (phase_ != TEST || filtered_param.force_backward())) {
+    LOG(WARNING) << "fuse_layers only applies to TEST nets without "
+        << "force_backward; ignoring it for net " << filtered_param.name();
+    fuse_layers_ = false;
+  }
+  if (fuse_layers_) {
+    NetParameter fused_param;
+    FuseLayers(filtered_param, &fused_param, &fused_layers_);
+    filtered_param.CopyFrom(fused_param);
+  }
+  bool auto_in_place = filtered_param.auto_in_place();
+  if (auto_in_place && (phase_ != TEST || filtered_param.force_backward())) {
+    LOG(WARNING) << "auto_in_place only applies to TEST nets without "
+        << "force_backward; ignoring it for net " << filtered_param.name();
+    auto_in_place = false;
+  }
   LOG_IF(INFO, Caffe::root_solver())
       << "Initializing net from parameters: " << std::endl
       << filtered_param.DebugString();
@@ -65,6 +90,10 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   name_ = param.name();
   map<string, int> blob_name_to_idx;
   set<string> available_blobs;
+  // The blobs filled by layers without bottoms, and the old names of the
+  // blobs renamed by auto_in_place.
+  set<int> source_blob_ids;
+  vector<pair<string, int> > in_place_aliases;
   memory_used_ = 0;
   // For each layer, set up its input and output
   bottom_vecs_.resize(param.layer_size());
@@ -95,6 +124,12 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       layers_[layer_id]->SetShared(true);
     } else {
       layers_.push_back(LayerRegistry<Dtype>::CreateLayer(layer_param));
+      if (params_net_ && params_net_->has_layer(layer_param.name())) {
+        // Hand the parameters over before SetUp, which then skips their
+        // allocation and initialization.
+        layers_[layer_id]->blobs() =
+            params_net_->layer_by_name(layer_param.name())->blobs();
+      }
     }
     layer_names_.push_back(layer_param.name());
     LOG_IF(INFO, Caffe::root_solver())
@@ -109,8 +144,36 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       // If a blob needs backward, this layer should provide it.
       need_backward |= blob_need_backward_[blob_id];
     }
+    // Since InsertSplits leaves every top with one consumer at most, nothing
+    // reads the first bottom after this layer, which can then overwrite it.
+    bool in_place = false;
+    if (auto_in_place && !share_from_root && layer_param.bottom_size() > 0 &&
+        layer_param.top_size() > 0 &&
+        layer_param.top(0) != layer_param.bottom(0) &&
+        layers_[layer_id]->AllowsInPlace()) {
+      const int blob_id = bottom_id_vecs_[layer_id][0];
+      // Unless data layers fill the bottom only once, or it shares memory
+      // with other blobs, e.g. as a top of Split, Reshape or Parameter.
+      in_place = !source_blob_ids.count(blob_id) &&
+          blobs_[blob_id]->data().use_count() <= 1;
+    }
     int num_top = layer_param.top_size();
     for (int top_id = 0; top_id < num_top; ++top_id) {
+      if (top_id == 0 && in_place) {
+        const string& blob_name = layer_param.top(0);
+        const int blob_id = bottom_id_vecs_[layer_id][0];
+        CHECK(!blob_name_to_idx.count(blob_name)) << "Top blob '"
+            << blob_name << "' produced by multiple sources.";
+        LOG_IF(INFO, Caffe::root_solver()) << layer_param.name() << " -> "
+            << blob_name << " (in-place on " << blob_names_[blob_id] << ")";
+        in_place_aliases.push_back(make_pair(blob_names_[blob_id], blob_id));
+        blob_names_[blob_id] = blob_name;
+        blob_name_to_idx[blob_name] = blob_id;
+        available_blobs.insert(blob_name);
+        top_vecs_[layer_id].push_back(blobs_[blob_id].get());
+        top_id_vecs_[layer_id].push_back(blob_id);
+        continue;
+      }
       AppendTop(param, layer_id, top_id, &available_blobs, &blob_name_to_idx);
       // Collect Input layer tops as Net inputs.
       if (layer_param.type() == "Input") {
@@ -133,6 +196,10 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
         AppendTop(param, layer_id, num_top, NULL, NULL);
       }
     }
+    if (layer_param.bottom_size() == 0) {
+      source_blob_ids.insert(top_id_vecs_[layer_id].begin(),
+          top_id_vecs_[layer_id].end());
+    }
     // After this layer is connected, set it up.
     if (share_from_root) {
       // Set up size of top blobs using root_net_
@@ -275,11 +342,47 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   for (size_t blob_id = 0; blob_id < blob_names_.size(); ++blob_id) {
     blob_names_index_[blob_names_[blob_id]] = blob_id;
   }
+  for (int i = 0; i < in_place_aliases.size(); ++i) {
+    blob_names_index_.insert(in_place_aliases[i]);
+  }
   for (size_t layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   ShareWeights();
+  if (params_net_) {
+    // Also catch the layers that set up parameters of their own regardless.
+    ShareTrainedLayersWith(params_net_);
+  }
+  flat_param_data_.reset();
+  flat_param_diff_.reset();
+  flat_param_count_ = 0;
+  if (param.flat_params()) {
+    if (params_net_) {
+      LOG(WARNING) << "flat_params does not apply to nets sharing the params "
+          << "of another net; ignoring it for net " << name_;
+    } else {
+      FlattenParams();
+    }
+  }
   debug_info_ = param.debug_info();
+  profiling_ = false;
+  profiler_.reset();
+  optimize_memory_ = param.optimize_memory();
+  if (optimize_memory_ && (phase_ != TEST || param.force_backward())) {
+    LOG(WARNING) << "optimize_memory only applies to TEST nets without "
+        << "force_backward; ignoring it for net " << name_;
+    optimize_memory_ = false;
+  }
+  // Net inputs and outputs are read and written by the caller around Forward,
+  // so they always keep memory of their own.
+  blob_pinned_.assign(blobs_.size(), false);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    blob_pinned_[net_input_blob_indices_[i]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    blob_pinned_[net_output_blob_indices_[i]] = true;
+  }
+  PlanActivationMemory();
   LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
 }
 
@@ -544,10 +647,18 @@ template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
+  if (memory_plan_dirty_) { PlanActivationMemory(); }
+  CHECK(activation_slabs_.empty() || Caffe::mode() == Caffe::CPU)
+      << "Nets with shared activation memory can only run in CPU mode.";
   Dtype loss = 0;
   for (int i = start; i <= end; ++i) {
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
+    if (profiling_) { profiler_->Start(); }
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+    if (profiling_) {
+      profiler_->Stop(i, NetProfiler<Dtype>::FORWARD, layers_[i].get(),
+          bottom_vecs_[i], top_vecs_[i]);
+    }
     loss += layer_loss;
     if (debug_info_) { ForwardDebugInfo(i); }
   }
@@ -590,13 +701,35 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  CHECK(activation_slabs_.empty())
+      << "Backward is not supported for nets with shared activation memory.";
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
+      if (profiling_) { profiler_->Start(); }
       layers_[i]->Backward(
           top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+      if (profiling_) {
+        profiler_->Stop(i, NetProfiler<Dtype>::BACKWARD, layers_[i].get(),
+            bottom_vecs_[i], top_vecs_[i]);
+      }
       if (debug_info_) { BackwardDebugInfo(i); }
     }
+    for (int c = 0; c < after_backward_.size(); ++c) {
+      after_backward_[c]->run(i);
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::set_profiling(const bool value) {
+  if (value && !profiler_) {
+    vector<string> layer_types;
+    for (int i = 0; i < layers_.size(); ++i) {
+      layer_types.push_back(layers_[i]->type());
+    }
+    profiler_.reset(new NetProfiler<Dtype>(layer_names_, layer_types));
   }
+  profiling_ = value;
 }
 
 template <typename Dtype>
@@ -680,6 +813,9 @@ void Net<Dtype>::UpdateDebugInfo(const int param_id) {
 
 template <typename Dtype>
 void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
+  CHECK(!fuse_layers_ || other->fuse_layers_) << "Cannot share the weights "
+      << "of unfused layers with net " << name_ << "; load them with "
+      << "CopyTrainedLayersFrom.";
   int num_source_layers = other->layers().size();
   for (int i = 0; i < num_source_layers; ++i) {
     Layer<Dtype>* source_layer = other->layers()[i].get();
@@ -744,10 +880,17 @@ void Net<Dtype>::Reshape() {
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
   }
+  PlanActivationMemory();
 }
 
 template <typename Dtype>
-void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
+void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& in_param) {
+  // Fold the source weights of the layers fused at Init the same way.
+  NetParameter fused_param;
+  if (fuse_layers_) {
+    FoldTrainedLayers(in_param, fused_layers_, &fused_param);
+  }
+  const NetParameter& param = fuse_layers_ ? fused_param : in_param;
   int num_source_layers = param.layer_size();
   for (int i = 0; i < num_source_layers; ++i) {
     const LayerParameter& source_layer = param.layer(i);
@@ -786,9 +929,15 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const string trained_filename) {
+  const string kMappedWeightsExtension = ".caffeweights";
   if (trained_filename.size() >= 3 &&
       trained_filename.compare(trained_filename.size() - 3, 3, ".h5") == 0) {
     CopyTrainedLayersFromHDF5(trained_filename);
+  } else if (trained_filename.size() >= kMappedWeightsExtension.size() &&
+      trained_filename.compare(
+          trained_filename.size() - kMappedWeightsExtension.size(),
+          kMappedWeightsExtension.size(), kMappedWeightsExtension) == 0) {
+    CopyTrainedLayersFromMappedWeights(trained_filename);
   } else {
     CopyTrainedLayersFromBinaryProto(trained_filename);
   }
@@ -804,6 +953,8 @@ void Net<Dtype>::CopyTrainedLayersFromBinaryProto(
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
+  CHECK(!fuse_layers_) << "Net " << name_ << " fuses layers and can only "
+      << "load weights from binary protos.";
   hid_t file_hid = H5Fopen(trained_filename.c_str(), H5F_ACC_RDONLY,
                            H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open " << trained_filename;
@@ -852,6 +1003,71 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
   H5Fclose(file_hid);
 }
 
+template <typename Dtype>
+void Net<Dtype>::CopyTrainedLayersFromMappedWeights(
+    const string trained_filename) {
+  CHECK(!fuse_layers_) << "Net " << name_ << " fuses layers and can only "
+      << "load weights from binary protos.";
+  shared_ptr<MappedWeights> weights(new MappedWeights(trained_filename));
+  const MappedWeights::DataType type = sizeof(Dtype) == sizeof(double) ?
+      MappedWeights::DOUBLE : MappedWeights::FLOAT;
+  const vector<MappedWeights::Param>& params = weights->params();
+  bool mapped = false;
+  // The params of a layer are consecutive in the file.
+  for (int begin = 0, end = 0; begin < params.size(); begin = end) {
+    const string& source_layer_name = params[begin].layer_name;
+    while (end < params.size() &&
+        params[end].layer_name == source_layer_name) {
+      ++end;
+    }
+    if (!layer_names_index_.count(source_layer_name)) {
+      LOG(INFO) << "Ignoring source layer " << source_layer_name;
+      continue;
+    }
+    DLOG(INFO) << "Copying source layer " << source_layer_name;
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[layer_names_index_[source_layer_name]]->blobs();
+    CHECK_EQ(target_blobs.size(), end - begin)
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    for (int i = begin; i < end; ++i) {
+      const MappedWeights::Param& param = params[i];
+      Blob<Dtype>* target_blob = target_blobs[param.index].get();
+      if (!target_blob->ShapeEquals(param.shape)) {
+        Blob<Dtype> source_blob;
+        if (param.shape.has_shape()) {
+          source_blob.Reshape(param.shape.shape());
+        } else {
+          source_blob.Reshape(param.shape.num(), param.shape.channels(),
+              param.shape.height(), param.shape.width());
+        }
+        LOG(FATAL) << "Cannot copy param " << param.index << " weights from "
+            << "layer '" << source_layer_name << "'; shape mismatch.  Source "
+            << "param shape is " << source_blob.shape_string() << "; target "
+            << "param shape is " << target_blob->shape_string() << ".";
+      }
+      CHECK_EQ(target_blob->count(), param.count) << "Incorrect data field "
+          << "size " << param.count << " for layer " << source_layer_name;
+      if (param.count == 0) {
+        continue;
+      }
+      if (param.type == type && !has_flat_params()) {
+        target_blob->set_cpu_data(
+            static_cast<Dtype*>(const_cast<void*>(param.data)));
+        mapped = true;
+      } else if (param.type == MappedWeights::FLOAT) {
+        const float* data = static_cast<const float*>(param.data);
+        std::copy(data, data + param.count, target_blob->mutable_cpu_data());
+      } else {
+        const double* data = static_cast<const double*>(param.data);
+        std::copy(data, data + param.count, target_blob->mutable_cpu_data());
+      }
+    }
+  }
+  if (mapped) {
+    mapped_weights_.push_back(weights);
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
   param->Clear();
@@ -930,6 +1146,11 @@ void Net<Dtype>::Update() {
 
 template <typename Dtype>
 void Net<Dtype>::ClearParamDiffs() {
+  if (has_flat_params() && Caffe::mode() == Caffe::CPU) {
+    caffe_set(flat_param_count_, static_cast<Dtype>(0),
+        static_cast<Dtype*>(flat_param_diff_->mutable_cpu_data()));
+    return;
+  }
   for (int i = 0; i < learnable_params_.size(); ++i) {
     Blob<Dtype>* blob = learnable_params_[i];
     switch (Caffe::mode()) {
@@ -958,6 +1179,149 @@ void Net<Dtype>::ShareWeights() {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::FlattenParams() {
+  size_t count = 0;
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    count += learnable_params_[i]->count();
+  }
+  // Slabs are at least one value, as for an empty blob.
+  shared_ptr<SyncedMemory> data(
+      new SyncedMemory(std::max<size_t>(count, 1) * sizeof(Dtype)));
+  shared_ptr<SyncedMemory> diff(
+      new SyncedMemory(std::max<size_t>(count, 1) * sizeof(Dtype)));
+  Dtype* data_ptr = static_cast<Dtype*>(data->mutable_cpu_data());
+  Dtype* diff_ptr = static_cast<Dtype*>(diff->mutable_cpu_data());
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    Blob<Dtype>* param = learnable_params_[i];
+    const int param_count = param->count();
+    if (param_count == 0) { continue; }
+    std::copy(param->cpu_data(), param->cpu_data() + param_count, data_ptr);
+    std::copy(param->cpu_diff(), param->cpu_diff() + param_count, diff_ptr);
+    // Sharers of the param share its SyncedMemory, and follow it.
+    param->data()->set_cpu_data(data_ptr);
+    param->diff()->set_cpu_data(diff_ptr);
+    data_ptr += param_count;
+    diff_ptr += param_count;
+  }
+  flat_param_data_ = data;
+  flat_param_diff_ = diff;
+  flat_param_count_ = count;
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanActivationMemory() {
+  memory_plan_dirty_ = false;
+  if (!optimize_memory_) { return; }
+  if (Caffe::mode() != Caffe::CPU) {
+    LOG_FIRST_N(WARNING, 1)
+        << "Activation memory is only shared in CPU mode.";
+    return;
+  }
+  // Layers such as Split, Flatten and Reshape make their tops share the
+  // SyncedMemory of their bottoms, so the unit of planning is a SyncedMemory
+  // rather than a blob. Each one is live from the first to the last layer
+  // touching any blob that holds it.
+  vector<SyncedMemory*> mems;
+  vector<int> first_use, last_use;
+  vector<bool> pinned;
+  map<SyncedMemory*, int> mem_index;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    // Layers without bottoms (data and dummy layers) may fill their tops only
+    // once, so those are never shared.
+    const bool source_layer = bottom_id_vecs_[layer_id].empty();
+    for (int i = 0; i < 2; ++i) {
+      const vector<int>& blob_ids =
+          (i == 0) ? bottom_id_vecs_[layer_id] : top_id_vecs_[layer_id];
+      for (int j = 0; j < blob_ids.size(); ++j) {
+        const int blob_id = blob_ids[j];
+        if (blobs_[blob_id]->count() == 0) { continue; }
+        SyncedMemory* mem = blobs_[blob_id]->data().get();
+        map<SyncedMemory*, int>::iterator it = mem_index.find(mem);
+        int index;
+        if (it == mem_index.end()) {
+          index = mems.size();
+          mem_index[mem] = index;
+          mems.push_back(mem);
+          first_use.push_back(layer_id);
+          last_use.push_back(layer_id);
+          pinned.push_back(false);
+        } else {
+          index = it->second;
+          last_use[index] = layer_id;
+        }
+        if (blob_pinned_[blob_id] || (i == 1 && source_layer)) {
+          pinned[index] = true;
+        }
+      }
+    }
+  }
+  // Tops aliasing parameters (e.g. of a Parameter layer) hold the weights.
+  for (int i = 0; i < params_.size(); ++i) {
+    if (params_[i]->count() == 0) { continue; }
+    map<SyncedMemory*, int>::iterator it =
+        mem_index.find(params_[i]->data().get());
+    if (it != mem_index.end()) { pinned[it->second] = true; }
+  }
+  // Greedily place each memory, in order of first use, in the best fitting
+  // slab whose previous occupant is dead. Memory that was placed by an
+  // earlier plan but is now pinned gets a slab of its own.
+  vector<int> slab_of(mems.size(), -1);
+  vector<size_t> slab_size;
+  vector<int> slab_free_after;
+  size_t unshared_size = 0;
+  for (int i = 0; i < mems.size(); ++i) {
+    if (pinned[i] && !planned_memory_.count(mems[i])) { continue; }
+    const size_t size = mems[i]->size();
+    unshared_size += size;
+    int best = -1;
+    for (int s = 0; !pinned[i] && s < slab_size.size(); ++s) {
+      if (slab_free_after[s] >= first_use[i]) { continue; }
+      if (best < 0) {
+        best = s;
+      } else if (slab_size[best] < size) {
+        // Prefer growing the largest slab if none is large enough...
+        if (slab_size[s] > slab_size[best]) { best = s; }
+      } else if (slab_size[s] >= size && slab_size[s] < slab_size[best]) {
+        // ...and otherwise the smallest slab that is.
+        best = s;
+      }
+    }
+    if (best < 0) {
+      best = slab_size.size();
+      slab_size.push_back(0);
+      slab_free_after.push_back(-1);
+    }
+    slab_of[i] = best;
+    slab_size[best] = std::max(slab_size[best], size);
+    slab_free_after[best] = pinned[i] ? INT_MAX : last_use[i];
+  }
+  // Reuse the previous slabs when they are large enough, e.g. when reshaping
+  // to a smaller input, so that planning does not allocate.
+  vector<shared_ptr<SyncedMemory> > slabs(slab_size.size());
+  size_t shared_size = 0;
+  for (int s = 0; s < slabs.size(); ++s) {
+    if (s < activation_slabs_.size() &&
+        activation_slabs_[s]->size() >= slab_size[s]) {
+      slabs[s] = activation_slabs_[s];
+    } else {
+      slabs[s].reset(new SyncedMemory(slab_size[s]));
+    }
+    shared_size += slabs[s]->size();
+  }
+  planned_memory_.clear();
+  for (int i = 0; i < mems.size(); ++i) {
+    if (slab_of[i] < 0) { continue; }
+    mems[i]->set_cpu_data(slabs[slab_of[i]]->mutable_cpu_data());
+    planned_memory_.insert(mems[i]);
+  }
+  activation_slabs_.swap(slabs);
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Shared " << planned_memory_.size() << " activation buffers of "
+      << name_ << " in " << activation_slabs_.size() << " slabs: "
+      << shared_size << " bytes instead of " << unshared_size;
+}
+
 template <typename Dtype>
 bool Net<Dtype>::has_blob(const string& blob_name) const {
   return blob_names_index_.find(blob_name) != blob_names_index_.end();
@@ -968,7 +1332,14 @@ const shared_ptr<Blob<Dtype> > Net<Dtype>::blob_by_name(
     const string& blob_name) const {
   shared_ptr<Blob<Dtype> > blob_ptr;
   if (has_blob(blob_name)) {
-    blob_ptr = blobs_[blob_names_index_.find(blob_name)->second];
+    const int blob_id = blob_names_index_.find(blob_name)->second;
+    blob_ptr = blobs_[blob_id];
+    if (optimize_memory_ && !blob_pinned_[blob_id]) {
+      // The caller may read the blob after Forward, so from the next Forward
+      // on it must not share its memory anymore.
+      blob_pinned_[blob_id] = true;
+      memory_plan_dirty_ = true;
+    }
   } else {
     blob_ptr.reset((Blob<Dtype>*)(NULL));
     LOG(WARNING) << "Unknown blob name " << blob_name;
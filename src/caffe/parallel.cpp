@@ -2,12 +2,21 @@
 #include <cuda_runtime.h>
 #endif
 #include <glog/logging.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "boost/bind.hpp"
+#include "boost/filesystem.hpp"
 #include "boost/thread.hpp"
 #include "caffe/caffe.hpp"
 #include "caffe/parallel.hpp"
@@ -436,8 +445,428 @@ void P2PSync<Dtype>::Run(const vector<int>& gpus) {
   }
 }
 
+// The barrier of a CPUSyncGroup, in memory shared with forked replicas.
+template<typename Dtype>
+struct CPUSyncGroup<Dtype>::Shared {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int waiting;
+  int generation;
+  bool aborted;
+};
+
+template<typename Dtype>
+CPUSyncGroup<Dtype>::CPUSyncGroup(int replicas)
+    : replicas_(replicas),
+      fd_(-1),
+      shared_(),
+      size_(0),
+      stride_(0),
+      buffers_() {
+  CHECK_GT(replicas, 0);
+  void* shared = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANON, -1, 0);
+  CHECK(shared != MAP_FAILED) << "Cannot map shared memory: "
+      << strerror(errno);
+  shared_ = static_cast<Shared*>(shared);
+  pthread_mutexattr_t mutex_attr;
+  pthread_mutexattr_init(&mutex_attr);
+  pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+  CHECK_EQ(pthread_mutex_init(&shared_->mutex, &mutex_attr), 0);
+  pthread_mutexattr_destroy(&mutex_attr);
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+  CHECK_EQ(pthread_cond_init(&shared_->cond, &cond_attr), 0);
+  pthread_condattr_destroy(&cond_attr);
+  shared_->waiting = 0;
+  shared_->generation = 0;
+  shared_->aborted = false;
+
+  // The size of the buffers is only known once the replicas have created
+  // their nets, so they are mapped from a file opened now, in memory where
+  // /dev/shm exists.
+  const boost::filesystem::path dir =
+      boost::filesystem::is_directory("/dev/shm") ? "/dev/shm" :
+      boost::filesystem::temp_directory_path();
+  string path = (dir / "caffe_sync_XXXXXX").string();
+  fd_ = mkstemp(&path[0]);
+  CHECK_GE(fd_, 0) << "Cannot create " << path << ": " << strerror(errno);
+  unlink(path.c_str());
+}
+
+template<typename Dtype>
+CPUSyncGroup<Dtype>::~CPUSyncGroup() {
+  if (buffers_) {
+    munmap(buffers_, (stride_ * replicas_ + size_ + 1) * sizeof(Dtype));
+  }
+  close(fd_);
+  munmap(shared_, sizeof(Shared));
+}
+
+template<typename Dtype>
+void CPUSyncGroup<Dtype>::Map(size_t size, size_t buffer_bytes) {
+  if (buffers_) {
+    CHECK_EQ(size, size_) << "All replicas must have the same params";
+    CHECK_LE(buffer_bytes, stride_ * sizeof(Dtype));
+    return;
+  }
+  // Replicas all resize the file to the same size, whichever comes first.
+  // The mapping is at least one value, as for an empty blob.
+  const size_t stride = std::max(size,
+      (buffer_bytes + sizeof(Dtype) - 1) / sizeof(Dtype));
+  const size_t bytes = (stride * replicas_ + size + 1) * sizeof(Dtype);
+  CHECK_EQ(ftruncate(fd_, bytes), 0) << "Cannot allocate shared memory: "
+      << strerror(errno);
+  void* buffers = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+      0);
+  CHECK(buffers != MAP_FAILED) << "Cannot map shared memory: "
+      << strerror(errno);
+  size_ = size;
+  stride_ = stride;
+  buffers_ = static_cast<Dtype*>(buffers);
+}
+
+template<typename Dtype>
+bool CPUSyncGroup<Dtype>::Barrier() {
+  pthread_mutex_lock(&shared_->mutex);
+  const int generation = shared_->generation;
+  if (shared_->aborted) {
+    // Leave the waiting count alone; nobody will wait for it again.
+  } else if (++shared_->waiting == replicas_) {
+    shared_->waiting = 0;
+    ++shared_->generation;
+    pthread_cond_broadcast(&shared_->cond);
+  } else {
+    while (generation == shared_->generation && !shared_->aborted) {
+      pthread_cond_wait(&shared_->cond, &shared_->mutex);
+    }
+  }
+  // A barrier all replicas reached holds even if the group was aborted
+  // since.
+  const bool passed = generation != shared_->generation;
+  pthread_mutex_unlock(&shared_->mutex);
+  return passed;
+}
+
+template<typename Dtype>
+void CPUSyncGroup<Dtype>::Abort() {
+  pthread_mutex_lock(&shared_->mutex);
+  shared_->aborted = true;
+  pthread_cond_broadcast(&shared_->cond);
+  pthread_mutex_unlock(&shared_->mutex);
+}
+
+template<typename Dtype>
+bool CPUSyncGroup<Dtype>::aborted() {
+  pthread_mutex_lock(&shared_->mutex);
+  const bool aborted = shared_->aborted;
+  pthread_mutex_unlock(&shared_->mutex);
+  return aborted;
+}
+
+template<typename Dtype>
+bool CPUSyncGroup<Dtype>::Allreduce(int rank, size_t offset, size_t size) {
+  CHECK(buffers_) << "The buffers must be mapped first";
+  CHECK_LE(offset + size, size_);
+  if (!Barrier()) {
+    return false;
+  }
+  // Sum the share of the rank from its own buffer on, which is the one in
+  // its cache.
+  const size_t begin = offset + size * rank / replicas_;
+  const int count = offset + size * (rank + 1) / replicas_ - begin;
+  Dtype* sum = average() + begin;
+  caffe_copy(count, buffer(rank) + begin, sum);
+  for (int i = 1; i < replicas_; ++i) {
+    caffe_axpy<Dtype>(count, Dtype(1),
+        buffer((rank + i) % replicas_) + begin, sum);
+  }
+  caffe_scal<Dtype>(count, Dtype(1) / replicas_, sum);
+  return Barrier();
+}
+
+template<typename Dtype>
+bool CPUSyncGroup<Dtype>::Allreduce(int rank, size_t offset, size_t size,
+    const GradientCodec<Dtype>& codec) {
+  CHECK(buffers_) << "The buffers must be mapped first";
+  CHECK_LE(offset + size, size_);
+  CHECK_LE(codec.EncodedBytes(size), stride_ * sizeof(Dtype));
+  if (!Barrier()) {
+    return false;
+  }
+  // Decode the share of the rank of the values of every replica.
+  const size_t begin = size * rank / replicas_;
+  const size_t end = size * (rank + 1) / replicas_;
+  Dtype* sum = average() + offset + begin;
+  caffe_set<Dtype>(end - begin, Dtype(0), sum);
+  for (int i = 0; i < replicas_; ++i) {
+    codec.DecodeAdd(size, buffer((rank + i) % replicas_), begin, end, sum);
+  }
+  caffe_scal<Dtype>(end - begin, Dtype(1) / replicas_, sum);
+  return Barrier();
+}
+
+//
+
+// Marks the learnable params of net as written after their weights were
+// copied into its flat params, which bypasses the memory of each param, so
+// that layers caching values derived from the weights recompute them.
+template<typename Dtype>
+static void params_written(Net<Dtype>* net) {
+  const vector<Blob<Dtype>*>& params = net->learnable_params();
+  for (int i = 0; i < params.size(); ++i) {
+    params[i]->mutable_cpu_data();
+  }
+}
+
+template<typename Dtype>
+CPUSync<Dtype>::CPUSync(shared_ptr<Solver<Dtype> > solver,
+                        shared_ptr<CPUSyncGroup<Dtype> > group, int rank,
+                        Solver<Dtype>* root_solver)
+    : solver_(solver),
+      group_(group),
+      rank_(rank),
+      root_solver_(root_solver),
+      initial_iter_(root_solver ? root_solver->iter() : solver->iter()),
+      synced_(false),
+      next_bucket_(0),
+      backward_passes_(0) {
+  CHECK(Caffe::mode() == Caffe::CPU) << "CPUSync runs on the CPU";
+  CHECK_GE(rank, 0);
+  CHECK_LT(rank, group->replicas());
+  // The replicas exchange their params as single buffers.
+  Net<Dtype>* net = solver->net().get();
+  if (!net->has_flat_params()) {
+    net->FlattenParams();
+  }
+  data_ = static_cast<Dtype*>(net->flat_param_data()->mutable_cpu_data());
+  diff_ = static_cast<Dtype*>(net->flat_param_diff()->mutable_cpu_data());
+  const SolverParameter& param = solver->param();
+  if (param.sync_compression() != SolverParameter_SyncCompression_NONE) {
+    codec_.reset(new GradientCodec<Dtype>(param.sync_compression(),
+        param.sync_top_k()));
+    residuals_.resize(net->flat_param_count());
+    LOG_IF(INFO, rank == 0) << "Compressing the gradients exchanged from "
+        << net->flat_param_count() * sizeof(Dtype) << " to "
+        << codec_->EncodedBytes(net->flat_param_count()) << " bytes";
+  }
+  group->Map(net->flat_param_count(),
+      codec_ ? codec_->EncodedBytes(net->flat_param_count()) : 0);
+  solver->add_callback(this);
+  if (rank > 0) {
+    solver->SetActionFunction(
+        boost::bind(&CPUSync<Dtype>::GetRequestedAction, this));
+  }
+  const float bucket_mb = param.sync_bucket_mb();
+  if (bucket_mb > 0) {
+    InitBuckets(std::max<size_t>(bucket_mb * (1 << 20) / sizeof(Dtype), 1));
+    LOG_IF(INFO, rank == 0) << "Averaging gradients in " << buckets_.size()
+        << " buckets during the backward pass";
+    net->add_after_backward(this);
+    reduce_thread_.reset(
+        new boost::thread(&CPUSync<Dtype>::ReduceBuckets, this));
+  }
+}
+
+template<typename Dtype>
+CPUSync<Dtype>::~CPUSync() {
+  if (reduce_thread_) {
+    ready_buckets_.push(-1);
+    reduce_thread_->join();
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::InitBuckets(size_t bucket_size) {
+  Net<Dtype>* net = solver_->net().get();
+  const vector<Blob<Dtype>*>& params = net->learnable_params();
+  // The gradient of a param is complete after the backward pass of the
+  // lowest layer sharing it.
+  const int num_layers = static_cast<int>(net->layers().size());
+  vector<int> ready_layers(params.size(), num_layers);
+  for (int i = 0; i < net->learnable_param_ids().size(); ++i) {
+    int* ready_layer = &ready_layers[net->learnable_param_ids()[i]];
+    *ready_layer = std::min(*ready_layer, net->param_layer_indices()[i].first);
+  }
+  // Fill buckets from the last params of the flat params to the first.
+  size_t offset = net->flat_param_count();
+  Bucket bucket = { offset, 0, num_layers };
+  for (int i = params.size() - 1; i >= 0; --i) {
+    const size_t count = params[i]->count();
+    if (bucket.count > 0 && bucket.count + count > bucket_size) {
+      buckets_.push_back(bucket);
+      bucket.count = 0;
+      bucket.ready_layer = num_layers;
+    }
+    offset -= count;
+    bucket.offset = offset;
+    bucket.count += count;
+    bucket.ready_layer = std::min(bucket.ready_layer, ready_layers[i]);
+  }
+  if (bucket.count > 0) {
+    buckets_.push_back(bucket);
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::InternalThreadEntry() {
+  CHECK(Caffe::root_solver());
+  Caffe::set_root_solver(false);
+  Caffe::set_solver_rank(rank_);
+  // Seed every replica differently, as for multiple GPUs.
+  if (solver_->param().random_seed() >= 0) {
+    Caffe::set_random_seed(solver_->param().random_seed() + rank_);
+  }
+  solver_->Step(solver_->param().max_iter() - initial_iter_);
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_start() {
+  const int count = solver_->net()->flat_param_count();
+  next_bucket_ = 0;
+  backward_passes_ = 0;
+  if (root_solver_) {
+    // Wait for the root to update the weights, and take them.
+    group_->Barrier();
+    if (root_solver_ != solver_.get()) {
+      caffe_copy(count, static_cast<const Dtype*>(
+          root_solver_->net()->flat_param_data()->cpu_data()), data_);
+      params_written(solver_->net().get());
+    }
+  } else if (!synced_) {
+    // Start from the weights of rank 0, which the others take before the
+    // average of the gradients is written over them.
+    if (rank_ == 0) {
+      caffe_copy(count, data_, group_->average());
+    }
+    group_->Barrier();
+    if (rank_ != 0) {
+      caffe_copy(count, group_->average(), data_);
+      params_written(solver_->net().get());
+    }
+    synced_ = true;
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::run(int layer) {
+  // The gradients are complete in the last backward pass of an iteration.
+  if (backward_passes_ == solver_->param().iter_size() - 1) {
+    while (next_bucket_ < buckets_.size()
+        && buckets_[next_bucket_].ready_layer >= layer) {
+      ready_buckets_.push(next_bucket_++);
+    }
+  }
+  if (layer == 0) {
+    ++backward_passes_;
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_gradients_ready() {
+  if (buckets_.empty()) {
+    Reduce(0, solver_->net()->flat_param_count());
+    return;
+  }
+  CHECK_EQ(next_bucket_, buckets_.size())
+      << "The backward pass must run through all layers";
+  for (int i = 0; i < buckets_.size(); ++i) {
+    reduced_buckets_.pop();
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::ReduceBuckets() {
+  for (int i = ready_buckets_.pop(); i >= 0; i = ready_buckets_.pop()) {
+    Reduce(buckets_[i].offset, buckets_[i].count);
+    reduced_buckets_.push(i);
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Reduce(size_t offset, size_t count) {
+  bool reduced;
+  if (codec_) {
+    // Every bucket is encoded at the start of the buffer, as the buffers
+    // are free again once the previous bucket is averaged.
+    codec_->Encode(count, diff_ + offset, &residuals_[offset],
+        group_->buffer(rank_));
+    reduced = group_->Allreduce(rank_, offset, count, *codec_);
+  } else {
+    caffe_copy(count, diff_ + offset, group_->buffer(rank_) + offset);
+    reduced = group_->Allreduce(rank_, offset, count);
+  }
+  // Replicas of an aborted group stop after this iteration, whose update is
+  // not kept.
+  if (!reduced) {
+    return;
+  }
+  // Loss functions divide gradients by the batch size of each replica, so
+  // the average is the gradient of the whole batch. Only the replicas
+  // applying updates need it.
+  if (!root_solver_ || root_solver_ == solver_.get()) {
+    caffe_copy(count, group_->average() + offset, diff_ + offset);
+  }
+}
+
+template<typename Dtype>
+SolverAction::Enum CPUSync<Dtype>::GetRequestedAction() {
+  return group_->aborted() ? SolverAction::STOP : SolverAction::NONE;
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::RunThreads(shared_ptr<Solver<Dtype> > solver,
+                                int replicas) {
+  CHECK_EQ(Caffe::solver_count(), replicas)
+      << "The solver count must be set to the number of replicas";
+  shared_ptr<CPUSyncGroup<Dtype> > group(new CPUSyncGroup<Dtype>(replicas));
+  CPUSync<Dtype> root(solver, group, 0, solver.get());
+  vector<shared_ptr<CPUSync<Dtype> > > workers;
+  for (int rank = 1; rank < replicas; ++rank) {
+    Caffe::set_root_solver(false);
+    shared_ptr<Solver<Dtype> > worker(
+        new WorkerSolver<Dtype>(solver->param(), solver.get()));
+    Caffe::set_root_solver(true);
+    workers.push_back(shared_ptr<CPUSync<Dtype> >(
+        new CPUSync<Dtype>(worker, group, rank, solver.get())));
+  }
+
+  LOG(INFO) << "Starting Optimization on " << replicas << " CPU replicas";
+
+  for (int i = 0; i < workers.size(); ++i) {
+    workers[i]->StartInternalThread();
+  }
+  // Run root solver on current thread
+  solver->Solve();
+  // Release workers waiting for the next iteration, should the root have
+  // stopped early.
+  group->Abort();
+  for (int i = 0; i < workers.size(); ++i) {
+    workers[i]->StopInternalThread();
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::RunProcess(shared_ptr<Solver<Dtype> > solver,
+                                shared_ptr<CPUSyncGroup<Dtype> > group,
+                                int rank) {
+  CHECK(Caffe::multiprocess());
+  CHECK_EQ(Caffe::solver_count(), group->replicas());
+  CHECK_EQ(Caffe::solver_rank(), rank);
+  CPUSync<Dtype> sync(solver, group, rank, NULL);
+  LOG_IF(INFO, rank == 0) << "Starting Optimization on "
+      << group->replicas() << " CPU replica processes";
+  solver->Solve();
+  if (rank == 0) {
+    group->Abort();
+  }
+}
+
 INSTANTIATE_CLASS(Params);
 INSTANTIATE_CLASS(GPUParams);
 INSTANTIATE_CLASS(P2PSync);
+INSTANTIATE_CLASS(CPUSyncGroup);
+INSTANTIATE_CLASS(CPUSync);
 
 }  // namespace caffe
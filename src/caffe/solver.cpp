@@ -1,3 +1,6 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 #include <cstdio>
 
 #include <string>
@@ -41,6 +44,11 @@ Solver<Dtype>::Solver(const string& param_file, const Solver* root_solver)
   Init(param);
 }
 
+template <typename Dtype>
+Solver<Dtype>::~Solver() {
+  WaitForSnapshot();
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Init(const SolverParameter& param) {
   CHECK(Caffe::root_solver() || root_solver_)
@@ -297,6 +305,7 @@ void Solver<Dtype>::Solve(const char* resume_file) {
       && (!param_.snapshot() || iter_ % param_.snapshot() != 0)) {
     Snapshot();
   }
+  WaitForSnapshot();
   if (requested_early_exit_) {
     LOG(INFO) << "Optimization stopped early.";
     return;
@@ -406,9 +415,25 @@ void Solver<Dtype>::Test(const int test_net_id) {
   }
 }
 
+// Writes the files of a snapshot in order, each to a temporary file renamed
+// once complete, so that no snapshot file is ever seen partially written.
+static void WriteSnapshotFiles(
+    const vector<shared_ptr<google::protobuf::Message> >& protos,
+    const vector<string>& filenames) {
+  for (int i = 0; i < protos.size(); ++i) {
+    const string temp_filename = filenames[i] + ".tmp";
+    WriteProtoToBinaryFile(*protos[i], temp_filename);
+    CHECK_EQ(std::rename(temp_filename.c_str(), filenames[i].c_str()), 0)
+        << "Cannot rename " << temp_filename << " to " << filenames[i];
+  }
+  LOG(INFO) << "Snapshot written to " << filenames[0];
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
   CHECK(Caffe::root_solver());
+  // Only one snapshot is held in memory to be written at a time.
+  WaitForSnapshot();
   string model_filename;
   switch (param_.snapshot_format()) {
   case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
@@ -422,6 +447,32 @@ void Solver<Dtype>::Snapshot() {
   }
 
   SnapshotSolverState(model_filename);
+  if (!staged_protos_.empty()) {
+    snapshot_thread_.reset(new boost::thread(boost::bind(
+        &WriteSnapshotFiles, staged_protos_, staged_filenames_)));
+    staged_protos_.clear();
+    staged_filenames_.clear();
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WaitForSnapshot() {
+  if (snapshot_thread_) {
+    snapshot_thread_->join();
+    snapshot_thread_.reset();
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WriteSnapshotProto(
+    const shared_ptr<google::protobuf::Message>& proto,
+    const string& filename) {
+  if (param_.snapshot_async()) {
+    staged_protos_.push_back(proto);
+    staged_filenames_.push_back(filename);
+  } else {
+    WriteProtoToBinaryFile(*proto, filename);
+  }
 }
 
 template <typename Dtype>
@@ -452,9 +503,9 @@ template <typename Dtype>
 string Solver<Dtype>::SnapshotToBinaryProto() {
   string model_filename = SnapshotFilename(".caffemodel");
   LOG(INFO) << "Snapshotting to binary proto file " << model_filename;
-  NetParameter net_param;
-  net_->ToProto(&net_param, param_.snapshot_diff());
-  WriteProtoToBinaryFile(net_param, model_filename);
+  shared_ptr<NetParameter> net_param(new NetParameter());
+  net_->ToProto(net_param.get(), param_.snapshot_diff());
+  WriteSnapshotProto(net_param, model_filename);
   return model_filename;
 }
 
@@ -1,3 +1,4 @@
+#include <typeinfo>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
@@ -106,6 +107,53 @@ void AdaDeltaSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+struct AdaDeltaUpdate {
+  FusedGradient<Dtype> gradient;
+  Dtype local_rate, delta, momentum;
+  Dtype *data, *diff, *h, *h_update;
+
+  template <typename Pack>
+  inline void Apply(int i) const {
+    const Pack w = Pack::Load(data + i);
+    const Pack g = gradient(Pack::Load(diff + i), w);
+    const Pack one_minus_momentum(Dtype(1) - momentum);
+    const Pack h_next = one_minus_momentum * (g * g) +
+        Pack(momentum) * Pack::Load(h + i);
+    // the RMS of the history of updates over that of gradients
+    const Pack h_update_prev = Pack::Load(h_update + i);
+    const Pack value = g *
+        Sqrt((h_update_prev + Pack(delta)) / (h_next + Pack(delta)));
+    const Pack update = Pack(local_rate) * value;
+    h_next.Store(h + i);
+    (one_minus_momentum * (value * value) + Pack(momentum) * h_update_prev)
+        .Store(h_update + i);
+    update.Store(diff + i);
+    (w - update).Store(data + i);
+  }
+};
+
+template <typename Dtype>
+bool AdaDeltaSolver<Dtype>::ApplyFusedUpdate(int param_id, Dtype rate) {
+  if (typeid(*this) != typeid(AdaDeltaSolver<Dtype>)) {
+    return false;
+  }
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  const size_t update_history_offset = this->net_->learnable_params().size();
+  AdaDeltaUpdate<Dtype> update;
+  update.gradient = this->GetFusedGradient(param_id);
+  update.local_rate = rate * this->net_->params_lr()[param_id];
+  update.delta = this->param_.delta();
+  update.momentum = this->param_.momentum();
+  update.data = param->mutable_cpu_data();
+  update.diff = param->mutable_cpu_diff();
+  update.h = this->history_[param_id]->mutable_cpu_data();
+  update.h_update =
+      this->history_[update_history_offset + param_id]->mutable_cpu_data();
+  ForEachPack<Dtype>(param->count(), update);
+  return true;
+}
+
 INSTANTIATE_CLASS(AdaDeltaSolver);
 REGISTER_SOLVER_CLASS(AdaDelta);
 
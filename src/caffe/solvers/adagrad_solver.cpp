@@ -1,3 +1,4 @@
+#include <typeinfo>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
@@ -64,6 +65,41 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+struct AdaGradUpdate {
+  FusedGradient<Dtype> gradient;
+  Dtype local_rate, delta;
+  Dtype *data, *diff, *h;
+
+  template <typename Pack>
+  inline void Apply(int i) const {
+    const Pack w = Pack::Load(data + i);
+    const Pack g = gradient(Pack::Load(diff + i), w);
+    const Pack h_next = Pack::Load(h + i) + g * g;
+    const Pack update = Pack(local_rate) * (g / (Sqrt(h_next) + Pack(delta)));
+    h_next.Store(h + i);
+    update.Store(diff + i);
+    (w - update).Store(data + i);
+  }
+};
+
+template <typename Dtype>
+bool AdaGradSolver<Dtype>::ApplyFusedUpdate(int param_id, Dtype rate) {
+  if (typeid(*this) != typeid(AdaGradSolver<Dtype>)) {
+    return false;
+  }
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  AdaGradUpdate<Dtype> update;
+  update.gradient = this->GetFusedGradient(param_id);
+  update.local_rate = rate * this->net_->params_lr()[param_id];
+  update.delta = this->param_.delta();
+  update.data = param->mutable_cpu_data();
+  update.diff = param->mutable_cpu_diff();
+  update.h = this->history_[param_id]->mutable_cpu_data();
+  ForEachPack<Dtype>(param->count(), update);
+  return true;
+}
+
 INSTANTIATE_CLASS(AdaGradSolver);
 REGISTER_SOLVER_CLASS(AdaGrad);
 
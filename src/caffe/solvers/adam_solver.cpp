@@ -1,3 +1,4 @@
+#include <typeinfo>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
@@ -88,6 +89,55 @@ void AdamSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+struct AdamUpdate {
+  FusedGradient<Dtype> gradient;
+  Dtype corrected_local_rate, beta1, beta2, eps_hat;
+  Dtype *data, *diff, *m, *v;
+
+  template <typename Pack>
+  inline void Apply(int i) const {
+    const Pack w = Pack::Load(data + i);
+    const Pack g = gradient(Pack::Load(diff + i), w);
+    const Pack m_next = Pack(Dtype(1) - beta1) * g +
+        Pack(beta1) * Pack::Load(m + i);
+    const Pack v_next = Pack(Dtype(1) - beta2) * (g * g) +
+        Pack(beta2) * Pack::Load(v + i);
+    const Pack update = Pack(corrected_local_rate) *
+        (m_next / (Sqrt(v_next) + Pack(eps_hat)));
+    m_next.Store(m + i);
+    v_next.Store(v + i);
+    update.Store(diff + i);
+    (w - update).Store(data + i);
+  }
+};
+
+template <typename Dtype>
+bool AdamSolver<Dtype>::ApplyFusedUpdate(int param_id, Dtype rate) {
+  if (typeid(*this) != typeid(AdamSolver<Dtype>)) {
+    return false;
+  }
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  const size_t update_history_offset = this->net_->learnable_params().size();
+  AdamUpdate<Dtype> update;
+  update.gradient = this->GetFusedGradient(param_id);
+  update.beta1 = this->param_.momentum();
+  update.beta2 = this->param_.momentum2();
+  update.eps_hat = this->param_.delta();
+  const int t = this->iter_ + 1;
+  const Dtype correction = std::sqrt(Dtype(1) - pow(update.beta2, t)) /
+      (Dtype(1.) - pow(update.beta1, t));
+  update.corrected_local_rate =
+      rate * this->net_->params_lr()[param_id] * correction;
+  update.data = param->mutable_cpu_data();
+  update.diff = param->mutable_cpu_diff();
+  update.m = this->history_[param_id]->mutable_cpu_data();
+  update.v =
+      this->history_[update_history_offset + param_id]->mutable_cpu_data();
+  ForEachPack<Dtype>(param->count(), update);
+  return true;
+}
+
 INSTANTIATE_CLASS(AdamSolver);
 REGISTER_SOLVER_CLASS(Adam);
 
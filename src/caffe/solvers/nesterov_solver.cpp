@@ -1,3 +1,4 @@
+#include <typeinfo>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
@@ -56,6 +57,44 @@ void NesterovSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+struct NesterovUpdate {
+  FusedGradient<Dtype> gradient;
+  Dtype local_rate, momentum;
+  Dtype *data, *diff, *h;
+
+  template <typename Pack>
+  inline void Apply(int i) const {
+    const Pack w = Pack::Load(data + i);
+    const Pack h_prev = Pack::Load(h + i);
+    const Pack h_next = Pack(local_rate) *
+        gradient(Pack::Load(diff + i), w) + Pack(momentum) * h_prev;
+    // step back then over step
+    const Pack update = Pack(Dtype(1) + momentum) * h_next -
+        Pack(momentum) * h_prev;
+    h_next.Store(h + i);
+    update.Store(diff + i);
+    (w - update).Store(data + i);
+  }
+};
+
+template <typename Dtype>
+bool NesterovSolver<Dtype>::ApplyFusedUpdate(int param_id, Dtype rate) {
+  if (typeid(*this) != typeid(NesterovSolver<Dtype>)) {
+    return false;
+  }
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  NesterovUpdate<Dtype> update;
+  update.gradient = this->GetFusedGradient(param_id);
+  update.local_rate = rate * this->net_->params_lr()[param_id];
+  update.momentum = this->param_.momentum();
+  update.data = param->mutable_cpu_data();
+  update.diff = param->mutable_cpu_diff();
+  update.h = this->history_[param_id]->mutable_cpu_data();
+  ForEachPack<Dtype>(param->count(), update);
+  return true;
+}
+
 INSTANTIATE_CLASS(NesterovSolver);
 REGISTER_SOLVER_CLASS(Nesterov);
 
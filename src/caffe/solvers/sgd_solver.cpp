@@ -1,4 +1,5 @@
 #include <string>
+#include <typeinfo>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
@@ -82,9 +83,20 @@ void SGDSolver<Dtype>::ClipGradients() {
   const Dtype clip_gradients = this->param_.clip_gradients();
   if (clip_gradients < 0) { return; }
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  // Flat params are clipped in single passes over their slab.
+  Dtype* flat_diff = NULL;
+  const int flat_count = this->net_->flat_param_count();
+  if (this->net_->has_flat_params() && Caffe::mode() == Caffe::CPU) {
+    flat_diff = static_cast<Dtype*>(
+        this->net_->flat_param_diff()->mutable_cpu_data());
+  }
   Dtype sumsq_diff = 0;
-  for (int i = 0; i < net_params.size(); ++i) {
-    sumsq_diff += net_params[i]->sumsq_diff();
+  if (flat_diff) {
+    sumsq_diff = caffe_cpu_dot(flat_count, flat_diff, flat_diff);
+  } else {
+    for (int i = 0; i < net_params.size(); ++i) {
+      sumsq_diff += net_params[i]->sumsq_diff();
+    }
   }
   const Dtype l2norm_diff = std::sqrt(sumsq_diff);
   if (l2norm_diff > clip_gradients) {
@@ -92,8 +104,12 @@ void SGDSolver<Dtype>::ClipGradients() {
     LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
         << l2norm_diff << " > " << clip_gradients << ") "
         << "by scale factor " << scale_factor;
-    for (int i = 0; i < net_params.size(); ++i) {
-      net_params[i]->scale_diff(scale_factor);
+    if (flat_diff) {
+      caffe_scal(flat_count, scale_factor, flat_diff);
+    } else {
+      for (int i = 0; i < net_params.size(); ++i) {
+        net_params[i]->scale_diff(scale_factor);
+      }
     }
   }
 }
@@ -106,13 +122,35 @@ void SGDSolver<Dtype>::ApplyUpdate() {
     LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
   }
   ClipGradients();
-  for (int param_id = 0; param_id < this->net_->learnable_params().size();
-       ++param_id) {
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    if (Caffe::mode() == Caffe::CPU && ApplyFusedUpdate(param_id, rate)) {
+      continue;
+    }
     Normalize(param_id);
     Regularize(param_id);
     ComputeUpdateValue(param_id, rate);
+    net_params[param_id]->Update();
   }
-  this->net_->Update();
+}
+
+template <typename Dtype>
+FusedGradient<Dtype> SGDSolver<Dtype>::GetFusedGradient(int param_id) const {
+  const Dtype local_decay = this->param_.weight_decay() *
+      this->net_->params_weight_decay()[param_id];
+  const string& regularization_type = this->param_.regularization_type();
+  FusedGradient<Dtype> gradient;
+  gradient.scale = Dtype(1) / this->param_.iter_size();
+  gradient.l2_decay = 0;
+  gradient.l1_decay = 0;
+  if (regularization_type == "L2") {
+    gradient.l2_decay = local_decay;
+  } else if (regularization_type == "L1") {
+    gradient.l1_decay = local_decay;
+  } else {
+    LOG(FATAL) << "Unknown regularization type: " << regularization_type;
+  }
+  return gradient;
 }
 
 template <typename Dtype>
@@ -242,6 +280,41 @@ void SGDSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+// Computes the update of a pack of values: history, diff and data.
+template <typename Dtype>
+struct SGDUpdate {
+  FusedGradient<Dtype> gradient;
+  Dtype local_rate, momentum;
+  Dtype *data, *diff, *h;
+
+  template <typename Pack>
+  inline void Apply(int i) const {
+    const Pack w = Pack::Load(data + i);
+    const Pack update = Pack(local_rate) * gradient(Pack::Load(diff + i), w)
+        + Pack(momentum) * Pack::Load(h + i);
+    update.Store(h + i);
+    update.Store(diff + i);
+    (w - update).Store(data + i);
+  }
+};
+
+template <typename Dtype>
+bool SGDSolver<Dtype>::ApplyFusedUpdate(int param_id, Dtype rate) {
+  if (typeid(*this) != typeid(SGDSolver<Dtype>)) {
+    return false;
+  }
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  SGDUpdate<Dtype> update;
+  update.gradient = GetFusedGradient(param_id);
+  update.local_rate = rate * this->net_->params_lr()[param_id];
+  update.momentum = this->param_.momentum();
+  update.data = param->mutable_cpu_data();
+  update.diff = param->mutable_cpu_diff();
+  update.h = history_[param_id]->mutable_cpu_data();
+  ForEachPack<Dtype>(param->count(), update);
+  return true;
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
   switch (this->param_.snapshot_format()) {
@@ -259,20 +332,20 @@ void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverStateToBinaryProto(
     const string& model_filename) {
-  SolverState state;
-  state.set_iter(this->iter_);
-  state.set_learned_net(model_filename);
-  state.set_current_step(this->current_step_);
-  state.clear_history();
+  shared_ptr<SolverState> state(new SolverState());
+  state->set_iter(this->iter_);
+  state->set_learned_net(model_filename);
+  state->set_current_step(this->current_step_);
+  state->clear_history();
   for (int i = 0; i < history_.size(); ++i) {
     // Add history
-    BlobProto* history_blob = state.add_history();
+    BlobProto* history_blob = state->add_history();
     history_[i]->ToProto(history_blob);
   }
   string snapshot_filename = Solver<Dtype>::SnapshotFilename(".solverstate");
   LOG(INFO)
     << "Snapshotting solver state to binary proto file " << snapshot_filename;
-  WriteProtoToBinaryFile(state, snapshot_filename.c_str());
+  this->WriteSnapshotProto(state, snapshot_filename);
 }
 
 template <typename Dtype>
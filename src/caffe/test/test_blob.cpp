@@ -59,6 +59,22 @@ TYPED_TEST(BlobSimpleTest, TestReshapeZero) {
   EXPECT_EQ(this->blob_->count(), 0);
 }
 
+TYPED_TEST(BlobSimpleTest, TestSetDataSize) {
+  // Pointing a blob shrunk from a larger shape at memory of its count gives
+  // it memory of that size, which a later reshape grows again.
+  Blob<TypeParam> batch(1, 3, 4, 5);
+  this->blob_preshaped_->Reshape(1, 3, 4, 5);
+  this->blob_preshaped_->set_cpu_data(batch.mutable_cpu_data());
+  EXPECT_EQ(batch.count() * sizeof(TypeParam),
+      this->blob_preshaped_->data()->size());
+  EXPECT_EQ(batch.cpu_data(), this->blob_preshaped_->cpu_data());
+  this->blob_preshaped_->Reshape(2, 3, 4, 5);
+  EXPECT_EQ(this->blob_preshaped_->count() * sizeof(TypeParam),
+      this->blob_preshaped_->data()->size());
+  EXPECT_EQ(this->blob_preshaped_->count() * sizeof(TypeParam),
+      this->blob_preshaped_->diff()->size());
+}
+
 TYPED_TEST(BlobSimpleTest, TestLegacyBlobProtoShapeEquals) {
   BlobProto blob_proto;
 
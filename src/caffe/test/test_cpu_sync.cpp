@@ -0,0 +1,421 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/solver_factory.hpp"
+#include "caffe/util/db.hpp"
+#include "caffe/util/format.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+using boost::scoped_ptr;
+
+// Requests a stop once solver has reached iteration iter.
+template <typename Dtype>
+class StopAt {
+ public:
+  StopAt(Solver<Dtype>* solver, int iter)
+      : solver_(solver), iter_(iter) {}
+  SolverAction::Enum operator()() const {
+    return solver_->iter() >= iter_ ? SolverAction::STOP : SolverAction::NONE;
+  }
+
+ private:
+  Solver<Dtype>* solver_;
+  int iter_;
+};
+
+template <typename Dtype>
+class CPUSyncTest : public CPUDeviceTest<Dtype> {
+ protected:
+  CPUSyncTest()
+      : seed_(1701), sync_compression_("NONE"), sync_top_k_(0.01),
+        tolerance_(1e-5) {}
+
+  virtual void SetUp() {
+    MakeTempDir(&source_);
+    source_ += "/db";
+    scoped_ptr<db::DB> db(db::GetDB(DataParameter_DB_RECORD_FILE));
+    db->Open(source_, db::NEW);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    for (int i = 0; i < kNumRecords; ++i) {
+      Datum datum;
+      datum.set_label(i);
+      datum.set_channels(1);
+      datum.set_height(2);
+      datum.set_width(3);
+      for (int j = 0; j < 6; ++j) {
+        datum.mutable_data()->push_back(static_cast<char>(i * 7 + j * 13));
+      }
+      string value;
+      CHECK(datum.SerializeToString(&value));
+      txn->Put(format_int(i, 2), value);
+    }
+    txn->Commit();
+  }
+
+  virtual void TearDown() {
+    Caffe::set_solver_count(1);
+    Caffe::set_solver_rank(0);
+    Caffe::set_multiprocess(false);
+  }
+
+  // Creates a least squares solver reading iter_size batches of batch_size
+  // records an iteration, averaging gradients in buckets of bucket_mb if it
+  // is positive. With a conv_engine, a 3x3 convolution of that engine comes
+  // before the inner products.
+  shared_ptr<Solver<Dtype> > CreateSolver(int batch_size, int iter_size = 1,
+      float bucket_mb = 0) {
+    std::ostringstream proto;
+    proto <<
+        "type: 'SGD' "
+        "iter_size: " << iter_size << " "
+        "sync_bucket_mb: " << bucket_mb << " "
+        "sync_compression: " << sync_compression_ << " "
+        "sync_top_k: " << sync_top_k_ << " "
+        "base_lr: 0.1 "
+        "lr_policy: 'fixed' "
+        "momentum: 0.9 "
+        "weight_decay: 0.01 "
+        "max_iter: 4 "
+        "display: 0 "
+        "snapshot_after_train: false "
+        "random_seed: " << seed_ << " "
+        "net_param { "
+        "  name: 'TestNetwork' "
+        "  layer { "
+        "    name: 'data' "
+        "    type: 'Data' "
+        "    top: 'data' "
+        "    top: 'label' "
+        "    transform_param { scale: 0.00390625 } "
+        "    data_param { "
+        "      source: '" << source_ << "' "
+        "      backend: RECORD_FILE "
+        "      batch_size: " << batch_size << " "
+        "    } "
+        "  } ";
+    string bottom = "data";
+    if (!conv_engine_.empty()) {
+      proto <<
+          "  layer { "
+          "    name: 'conv' "
+          "    type: 'Convolution' "
+          "    bottom: 'data' "
+          "    top: 'conv' "
+          "    convolution_param { "
+          "      num_output: 2 "
+          "      kernel_size: 3 "
+          "      pad: 1 "
+          "      engine: " << conv_engine_ << " "
+          "      weight_filler { type: 'gaussian' std: 0.1 } "
+          "      bias_filler { type: 'constant' value: 0.1 } "
+          "    } "
+          "  } ";
+      bottom = "conv";
+    }
+    proto <<
+        "  layer { "
+        "    name: 'innerprod1' "
+        "    type: 'InnerProduct' "
+        "    bottom: '" << bottom << "' "
+        "    top: 'innerprod1' "
+        "    inner_product_param { "
+        "      num_output: 3 "
+        "      weight_filler { type: 'gaussian' std: 0.1 } "
+        "      bias_filler { type: 'constant' value: 0.5 } "
+        "    } "
+        "  } "
+        "  layer { "
+        "    name: 'innerprod2' "
+        "    type: 'InnerProduct' "
+        "    bottom: 'innerprod1' "
+        "    top: 'innerprod2' "
+        "    inner_product_param { "
+        "      num_output: 1 "
+        "      weight_filler { type: 'gaussian' std: 0.1 } "
+        "      bias_filler { type: 'constant' value: 0.5 } "
+        "    } "
+        "  } "
+        "  layer { "
+        "    name: 'loss' "
+        "    type: 'EuclideanLoss' "
+        "    bottom: 'innerprod2' "
+        "    bottom: 'label' "
+        "  } "
+        "} ";
+    SolverParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto.str(), &param));
+    param.set_solver_mode(SolverParameter_SolverMode_CPU);
+    Caffe::set_random_seed(seed_);
+    return shared_ptr<Solver<Dtype> >(
+        SolverRegistry<Dtype>::CreateSolver(param));
+  }
+
+  // Trains a single solver on batches of all the records the replicas read.
+  void TrainSingle(vector<Dtype>* params, int iter_size = 1) {
+    shared_ptr<Solver<Dtype> > solver =
+        CreateSolver(kNumReplicas * kBatch, iter_size);
+    solver->Solve();
+    GetParams(solver.get(), params);
+  }
+
+  // Stops the root solver early, which the workers must follow rather than
+  // wait for it forever.
+  void StopThreads(float bucket_mb) {
+    Caffe::set_solver_count(kNumReplicas);
+    shared_ptr<Solver<Dtype> > solver = CreateSolver(kBatch, 1, bucket_mb);
+    solver->SetActionFunction(StopAt<Dtype>(solver.get(), 2));
+    CPUSync<Dtype>::RunThreads(solver, kNumReplicas);
+    EXPECT_EQ(2, solver->iter());
+  }
+
+  void StopProcesses(float bucket_mb) {
+    shared_ptr<CPUSyncGroup<Dtype> > group(
+        new CPUSyncGroup<Dtype>(kNumReplicas));
+    Caffe::set_solver_count(kNumReplicas);
+    Caffe::set_multiprocess(true);
+    const pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    const int rank = pid == 0 ? 1 : 0;
+    Caffe::set_solver_rank(rank);
+    shared_ptr<Solver<Dtype> > solver = CreateSolver(kBatch, 1, bucket_mb);
+    if (rank == 0) {
+      solver->SetActionFunction(StopAt<Dtype>(solver.get(), 2));
+    }
+    CPUSync<Dtype>::RunProcess(solver, group, rank);
+    if (pid == 0) {
+      // Rank 1 stops when rank 0 does, within an iteration.
+      _exit(solver->iter() <= 3 ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+    EXPECT_EQ(2, solver->iter());
+  }
+
+  void TrainThreads(int iter_size, float bucket_mb) {
+    vector<Dtype> expected;
+    TrainSingle(&expected, iter_size);
+
+    Caffe::set_solver_count(kNumReplicas);
+    shared_ptr<Solver<Dtype> > solver =
+        CreateSolver(kBatch, iter_size, bucket_mb);
+    CPUSync<Dtype>::RunThreads(solver, kNumReplicas);
+    EXPECT_EQ(4, solver->iter());
+    vector<Dtype> params;
+    GetParams(solver.get(), &params);
+    CheckParams(expected, params);
+  }
+
+  void TrainProcesses(int iter_size, float bucket_mb) {
+    vector<Dtype> expected;
+    TrainSingle(&expected, iter_size);
+
+    shared_ptr<CPUSyncGroup<Dtype> > group(
+        new CPUSyncGroup<Dtype>(kNumReplicas));
+    Caffe::set_solver_count(kNumReplicas);
+    Caffe::set_multiprocess(true);
+    const pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    const int rank = pid == 0 ? 1 : 0;
+    Caffe::set_solver_rank(rank);
+    shared_ptr<Solver<Dtype> > solver =
+        CreateSolver(kBatch, iter_size, bucket_mb);
+    CPUSync<Dtype>::RunProcess(solver, group, rank);
+    if (pid == 0) {
+      _exit(0);
+    }
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+    vector<Dtype> params;
+    GetParams(solver.get(), &params);
+    CheckParams(expected, params);
+  }
+
+  static void GetParams(Solver<Dtype>* solver, vector<Dtype>* params) {
+    params->clear();
+    const vector<Blob<Dtype>*>& net_params = solver->net()->learnable_params();
+    for (int i = 0; i < net_params.size(); ++i) {
+      params->insert(params->end(), net_params[i]->cpu_data(),
+          net_params[i]->cpu_data() + net_params[i]->count());
+    }
+  }
+
+  void CheckParams(const vector<Dtype>& expected,
+      const vector<Dtype>& params) {
+    ASSERT_EQ(expected.size(), params.size());
+    for (int i = 0; i < expected.size(); ++i) {
+      EXPECT_NEAR(expected[i], params[i], tolerance_);
+    }
+  }
+
+  static const int kNumRecords = 8;
+  static const int kNumReplicas = 2;
+  static const int kBatch = 2;
+
+  string source_;
+  int seed_;
+  string sync_compression_;
+  float sync_top_k_;
+  string conv_engine_;
+  Dtype tolerance_;
+};
+
+TYPED_TEST_CASE(CPUSyncTest, TestDtypes);
+
+// Fills the buffer of rank with values depending on it and the iteration,
+// averages the buffers, and checks the averages.
+template <typename Dtype>
+static int FillAndAllreduce(CPUSyncGroup<Dtype>* group, int rank,
+    int iterations) {
+  int errors = 0;
+  const int replicas = group->replicas();
+  for (int iter = 0; iter < iterations; ++iter) {
+    for (int i = 0; i < group->size(); ++i) {
+      group->buffer(rank)[i] = i + rank * 10 + iter;
+    }
+    group->Allreduce(rank);
+    for (int i = 0; i < group->size(); ++i) {
+      const Dtype expected = i + 5 * (replicas - 1) + iter;
+      errors += group->average()[i] != expected;
+    }
+  }
+  return errors;
+}
+
+template <typename Dtype>
+static void RunFillAndAllreduce(CPUSyncGroup<Dtype>* group, int rank,
+    int iterations, int* errors) {
+  *errors = FillAndAllreduce(group, rank, iterations);
+}
+
+TYPED_TEST(CPUSyncTest, TestAllreduceThreads) {
+  typedef TypeParam Dtype;
+  const int kReplicas = 4;
+  // Fewer values than replicas leave some of them without a share.
+  const int kSizes[] = { 2, 100 };
+  for (int s = 0; s < 2; ++s) {
+    CPUSyncGroup<Dtype> group(kReplicas);
+    group.Map(kSizes[s]);
+    vector<int> errors(kReplicas);
+    vector<shared_ptr<boost::thread> > threads;
+    for (int rank = 1; rank < kReplicas; ++rank) {
+      threads.push_back(shared_ptr<boost::thread>(new boost::thread(
+          &RunFillAndAllreduce<Dtype>, &group, rank, 3, &errors[rank])));
+    }
+    errors[0] = FillAndAllreduce(&group, 0, 3);
+    for (int i = 0; i < threads.size(); ++i) {
+      threads[i]->join();
+    }
+    for (int rank = 0; rank < kReplicas; ++rank) {
+      EXPECT_EQ(0, errors[rank]);
+    }
+  }
+}
+
+TYPED_TEST(CPUSyncTest, TestAllreduceProcesses) {
+  typedef TypeParam Dtype;
+  CPUSyncGroup<Dtype> group(2);
+  const pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    group.Map(100);
+    _exit(FillAndAllreduce(&group, 1, 3) == 0 ? 0 : 1);
+  }
+  group.Map(100);
+  EXPECT_EQ(0, FillAndAllreduce(&group, 0, 3));
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+}
+
+TYPED_TEST(CPUSyncTest, TestTrainThreads) {
+  this->TrainThreads(1, 0);
+}
+
+TYPED_TEST(CPUSyncTest, TestTrainProcesses) {
+  this->TrainProcesses(1, 0);
+}
+
+TYPED_TEST(CPUSyncTest, TestTrainThreadsWinograd) {
+  // The workers take the updated weights of the root every iteration, which
+  // their Winograd convolutions must transform again.
+  this->conv_engine_ = "WINOGRAD";
+  this->TrainThreads(1, 0);
+}
+
+TYPED_TEST(CPUSyncTest, TestStopThreads) {
+  this->StopThreads(0);
+}
+
+TYPED_TEST(CPUSyncTest, TestStopThreadsBuckets) {
+  this->StopThreads(1e-6);
+}
+
+TYPED_TEST(CPUSyncTest, TestStopProcesses) {
+  this->StopProcesses(0);
+}
+
+// Buckets of a few bytes hold one param each.
+TYPED_TEST(CPUSyncTest, TestTrainThreadsBuckets) {
+  this->TrainThreads(1, 1e-6);
+}
+
+TYPED_TEST(CPUSyncTest, TestTrainThreadsBucketsIterSize) {
+  this->TrainThreads(2, 1e-6);
+}
+
+TYPED_TEST(CPUSyncTest, TestTrainThreadsOneBucket) {
+  this->TrainThreads(1, 1);
+}
+
+TYPED_TEST(CPUSyncTest, TestTrainProcessesBuckets) {
+  this->TrainProcesses(2, 1e-6);
+}
+
+// Keeping all the values exchanges the exact gradients.
+TYPED_TEST(CPUSyncTest, TestTrainThreadsTopKAll) {
+  this->sync_compression_ = "TOP_K";
+  this->sync_top_k_ = 1;
+  this->TrainThreads(1, 1e-6);
+}
+
+TYPED_TEST(CPUSyncTest, TestTrainThreadsFP16) {
+  this->sync_compression_ = "FP16";
+  this->tolerance_ = 1e-4;
+  this->TrainThreads(1, 0);
+}
+
+TYPED_TEST(CPUSyncTest, TestTrainProcessesInt8) {
+  this->sync_compression_ = "INT8";
+  this->tolerance_ = 2e-3;
+  this->TrainProcesses(1, 1e-6);
+}
+
+TYPED_TEST(CPUSyncTest, TestTrainThreadsTopK) {
+  this->sync_compression_ = "TOP_K";
+  this->sync_top_k_ = 0.5;
+  this->tolerance_ = 1e-1;
+  this->TrainThreads(2, 0);
+}
+
+}  // namespace caffe
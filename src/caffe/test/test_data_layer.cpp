@@ -1,4 +1,5 @@
 #ifdef USE_OPENCV
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -67,7 +68,8 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  void TestRead(int num_threads = 1, int prefetch = 4,
+      bool share_prefetched_batches = true) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -75,6 +77,9 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_num_threads(num_threads);
+    data_param->set_prefetch(prefetch);
+    data_param->set_share_prefetched_batches(share_prefetched_batches);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -105,7 +110,8 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
-  void TestReshape(DataParameter_DB backend) {
+  void TestReshape(DataParameter_DB backend,
+      bool share_prefetched_batches = false) {
     const int num_inputs = 5;
     // Save data of varying shapes.
     LOG(INFO) << "Using temporary dataset " << *filename_;
@@ -139,6 +145,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(1);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend);
+    data_param->set_share_prefetched_batches(share_prefetched_batches);
 
     DataLayer<Dtype> layer(param);
     layer.SetUp(blob_bottom_vec_, blob_top_vec_);
@@ -154,6 +161,12 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
       EXPECT_EQ(blob_top_data_->height(), iter % 2 + 1);
       EXPECT_EQ(blob_top_data_->width(), iter % 4 + 1);
       EXPECT_EQ(iter, blob_top_label_->cpu_data()[0]);
+      if (share_prefetched_batches) {
+        // The memory of the top is no larger than the batch it points to,
+        // which may be smaller than earlier batches.
+        EXPECT_EQ(blob_top_data_->count() * sizeof(Dtype),
+            blob_top_data_->data()->size());
+      }
       const int channels = blob_top_data_->channels();
       const int height = blob_top_data_->height();
       const int width = blob_top_data_->width();
@@ -224,13 +237,14 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
-  void TestReadCropTrainSequenceSeeded() {
+  void TestReadCropTrainSequenceSeeded(int num_threads = 1) {
     LayerParameter param;
     param.set_phase(TRAIN);
     DataParameter* data_param = param.mutable_data_param();
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_num_threads(num_threads);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -279,6 +293,159 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  void TestReadShuffled(bool reseed_per_epoch) {
+    const Dtype scale = 3;
+    const int shuffle_buffer_size = 3;
+    const int num_iters = 20;
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle_buffer_size(shuffle_buffer_size);
+    data_param->set_shuffle_reseed_per_epoch(reseed_per_epoch);
+
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_scale(scale);
+
+    // Get the label sequence with Caffe seed 1701.
+    Caffe::set_random_seed(seed_);
+    vector<Dtype> label_sequence;
+    {
+      DataLayer<Dtype> layer1(param);
+      layer1.SetUp(blob_bottom_vec_, blob_top_vec_);
+      for (int iter = 0; iter < num_iters; ++iter) {
+        layer1.Forward(blob_bottom_vec_, blob_top_vec_);
+        for (int i = 0; i < 5; ++i) {
+          const Dtype label = blob_top_label_->cpu_data()[i];
+          label_sequence.push_back(label);
+          // The images stay with their labels.
+          for (int j = 0; j < 24; ++j) {
+            EXPECT_EQ(scale * label, blob_top_data_->cpu_data()[i * 24 + j])
+                << "debug: iter " << iter << " i " << i << " j " << j;
+          }
+        }
+      }
+    }  // destroy 1st data layer and unlock the db
+
+    // Every record is emitted as often as the others, up to the records
+    // held in the buffer, but not in database order.
+    int num_in_order = 0;
+    for (int label = 0; label < 5; ++label) {
+      const int count = std::count(label_sequence.begin(),
+          label_sequence.end(), static_cast<Dtype>(label));
+      EXPECT_NEAR(num_iters, count, shuffle_buffer_size);
+    }
+    for (int i = 0; i < label_sequence.size(); ++i) {
+      num_in_order += (label_sequence[i] == i % 5);
+    }
+    EXPECT_LT(num_in_order, label_sequence.size());
+
+    // Get the label sequence after reseeding Caffe with 1701.
+    // Check that the sequence is the same as the original.
+    Caffe::set_random_seed(seed_);
+    {
+      DataLayer<Dtype> layer2(param);
+      layer2.SetUp(blob_bottom_vec_, blob_top_vec_);
+      for (int iter = 0; iter < num_iters; ++iter) {
+        layer2.Forward(blob_bottom_vec_, blob_top_vec_);
+        for (int i = 0; i < 5; ++i) {
+          EXPECT_EQ(label_sequence[iter * 5 + i],
+                    blob_top_label_->cpu_data()[i])
+              << "debug: iter " << iter << " i " << i;
+        }
+      }
+    }
+    if (!reseed_per_epoch) {
+      return;
+    }
+
+    // Get the label sequence without reseeding per epoch, with the same
+    // seed. The records emitted until the first epoch is read through are
+    // drawn the same, and the epochs after are drawn from other seeds.
+    Caffe::set_random_seed(seed_);
+    data_param->set_shuffle_reseed_per_epoch(false);
+    vector<Dtype> unseeded_sequence;
+    {
+      DataLayer<Dtype> layer3(param);
+      layer3.SetUp(blob_bottom_vec_, blob_top_vec_);
+      for (int iter = 0; iter < num_iters; ++iter) {
+        layer3.Forward(blob_bottom_vec_, blob_top_vec_);
+        unseeded_sequence.insert(unseeded_sequence.end(),
+            blob_top_label_->cpu_data(), blob_top_label_->cpu_data() + 5);
+      }
+    }
+    const int num_first_epoch = 5 - shuffle_buffer_size + 1;
+    for (int i = 0; i < num_first_epoch; ++i) {
+      EXPECT_EQ(unseeded_sequence[i], label_sequence[i]) << "debug: i " << i;
+    }
+    EXPECT_FALSE(std::equal(label_sequence.begin() + num_first_epoch,
+        label_sequence.end(), unseeded_sequence.begin() + num_first_epoch));
+  }
+
+  // Checks that the decoded cache gives the same batches as decoding every
+  // epoch, with the same random crops and mirrors.
+  void TestReadEncodedCached(DataParameter_DB backend) {
+    backend_ = backend;
+    {
+      scoped_ptr<db::DB> db(db::GetDB(backend));
+      db->Open(*filename_, db::NEW);
+      scoped_ptr<db::Transaction> txn(db->NewTransaction());
+      for (int i = 0; i < 5; ++i) {
+        Datum datum;
+        CHECK(ReadImageToDatum(EXAMPLES_SOURCE_DIR "images/cat.jpg", i,
+            12 + i, 12 + i, true, "jpg", &datum));
+        stringstream ss;
+        ss << i;
+        string out;
+        CHECK(datum.SerializeToString(&out));
+        txn->Put(ss.str(), out);
+      }
+      txn->Commit();
+      db->Close();
+    }
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(1);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_crop_size(10);
+    transform_param->set_mirror(true);
+
+    const int num_iters = 15;  // three epochs
+    Caffe::set_random_seed(seed_);
+    vector<vector<Dtype> > data_sequence;
+    {
+      DataLayer<Dtype> layer1(param);
+      layer1.SetUp(blob_bottom_vec_, blob_top_vec_);
+      for (int iter = 0; iter < num_iters; ++iter) {
+        layer1.Forward(blob_bottom_vec_, blob_top_vec_);
+        EXPECT_EQ(iter % 5, blob_top_label_->cpu_data()[0]);
+        data_sequence.push_back(vector<Dtype>(blob_top_data_->cpu_data(),
+            blob_top_data_->cpu_data() + blob_top_data_->count()));
+      }
+    }  // destroy 1st data layer and unlock the db
+
+    data_param->set_decoded_cache_size_mb(1);
+    Caffe::set_random_seed(seed_);
+    DataLayer<Dtype> layer2(param);
+    layer2.SetUp(blob_bottom_vec_, blob_top_vec_);
+    for (int iter = 0; iter < num_iters; ++iter) {
+      layer2.Forward(blob_bottom_vec_, blob_top_vec_);
+      EXPECT_EQ(iter % 5, blob_top_label_->cpu_data()[0]);
+      ASSERT_EQ(data_sequence[iter].size(), blob_top_data_->count());
+      for (int j = 0; j < blob_top_data_->count(); ++j) {
+        EXPECT_EQ(data_sequence[iter][j], blob_top_data_->cpu_data()[j])
+            << "debug: iter " << iter << " j " << j;
+      }
+    }
+  }
+
   void TestReadCropTrainSequenceUnseeded() {
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -356,6 +523,12 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadParallelLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestRead(3);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLevelDB) {
   this->TestReshape(DataParameter_DB_LEVELDB);
 }
@@ -374,6 +547,12 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLevelDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededParallelLevelDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadCropTrainSequenceSeeded(3);
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDB) {
@@ -396,6 +575,12 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadParallelLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(3);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
@@ -414,6 +599,12 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLMDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededParallelLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadCropTrainSequenceSeeded(3);
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDB) {
@@ -429,5 +620,53 @@ TYPED_TEST(DataLayerTest, TestReadCropTestLMDB) {
 }
 
 #endif  // USE_LMDB
+
+TYPED_TEST(DataLayerTest, TestReadRecordFile) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_RECORD_FILE);
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadCopiedBatchesRecordFile) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_RECORD_FILE);
+  this->TestRead(1, 2, false);
+}
+
+TYPED_TEST(DataLayerTest, TestReadSingleSharedBatchRecordFile) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_RECORD_FILE);
+  this->TestRead(1, 1, true);
+}
+
+TYPED_TEST(DataLayerTest, TestReshapeRecordFile) {
+  this->TestReshape(DataParameter_DB_RECORD_FILE);
+}
+
+TYPED_TEST(DataLayerTest, TestReshapeSharedBatchesRecordFile) {
+  this->TestReshape(DataParameter_DB_RECORD_FILE, true);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededRecordFile) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_RECORD_FILE);
+  this->TestReadCropTrainSequenceSeeded();
+}
+
+TYPED_TEST(DataLayerTest, TestReadEncodedCachedRecordFile) {
+  this->TestReadEncodedCached(DataParameter_DB_RECORD_FILE);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffledRecordFile) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_RECORD_FILE);
+  this->TestReadShuffled(false);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffledReseedPerEpochRecordFile) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_RECORD_FILE);
+  this->TestReadShuffled(true);
+}
 }  // namespace caffe
 #endif  // USE_OPENCV
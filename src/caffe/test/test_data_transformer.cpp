@@ -36,6 +36,64 @@ class DataTransformTest : public ::testing::Test {
       : seed_(1701),
       num_iter_(10) {}
 
+  // Checks that transforming uint8 data by rows, cropped and mirrored,
+  // gives the same as transforming the same pixels as float data one by
+  // one, with mean values or a mean file.
+  void CheckVectorizedRows(bool use_mean_file) {
+    TransformationParameter transform_param;
+    const int channels = 3;
+    const int height = 45;
+    const int width = 45;
+    const int crop_size = 41;  // rows of vectors and leftover pixels
+
+    transform_param.set_crop_size(crop_size);
+    transform_param.set_mirror(true);
+    transform_param.set_scale(0.25);
+    if (use_mean_file) {
+      string mean_file;
+      MakeTempFilename(&mean_file);
+      BlobProto blob_mean;
+      blob_mean.set_num(1);
+      blob_mean.set_channels(channels);
+      blob_mean.set_height(height);
+      blob_mean.set_width(width);
+      for (int j = 0; j < channels * height * width; ++j) {
+        blob_mean.add_data((j * 37) % 256 + 0.5);
+      }
+      WriteProtoToBinaryFile(blob_mean, mean_file);
+      transform_param.set_mean_file(mean_file);
+    } else {
+      transform_param.add_mean_value(100);
+      transform_param.add_mean_value(120.5);
+      transform_param.add_mean_value(7);
+    }
+    Datum datum;
+    Datum float_datum;
+    FillDatum(0, channels, height, width, true, &datum);
+    float_datum.set_channels(channels);
+    float_datum.set_height(height);
+    float_datum.set_width(width);
+    for (int j = 0; j < datum.data().size(); ++j) {
+      float_datum.add_float_data(static_cast<uint8_t>(datum.data()[j]));
+    }
+    Blob<Dtype> blob(1, channels, crop_size, crop_size);
+    Blob<Dtype> float_blob(1, channels, crop_size, crop_size);
+    DataTransformer<Dtype> transformer(transform_param, TRAIN);
+    DataTransformer<Dtype> float_transformer(transform_param, TRAIN);
+    Caffe::set_random_seed(seed_);
+    transformer.InitRand();
+    Caffe::set_random_seed(seed_);
+    float_transformer.InitRand();
+    for (int iter = 0; iter < num_iter_; ++iter) {
+      transformer.Transform(datum, &blob);
+      float_transformer.Transform(float_datum, &float_blob);
+      for (int j = 0; j < blob.count(); ++j) {
+        EXPECT_EQ(float_blob.cpu_data()[j], blob.cpu_data()[j])
+            << "debug: iter " << iter << " j " << j;
+      }
+    }
+  }
+
   int NumSequenceMatches(const TransformationParameter transform_param,
       const Datum& datum, Phase phase) {
     // Get crop sequence with Caffe seed 1701.
@@ -121,6 +179,28 @@ TYPED_TEST(DataTransformTest, TestEmptyTransformUniquePixels) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestTransformDataInPlace) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int label = 0;
+  const int channels = 3;
+  const int height = 4;
+  const int width = 5;
+
+  Datum datum;
+  FillDatum(label, channels, height, width, unique_pixels, &datum);
+  // Transform from pixels held outside the datum.
+  const string data = datum.data();
+  datum.clear_data();
+  Blob<TypeParam> blob(1, channels, height, width);
+  DataTransformer<TypeParam> transformer(transform_param, TEST);
+  transformer.InitRand();
+  transformer.Transform(datum, data.data(), data.size(), &blob);
+  for (int j = 0; j < blob.count(); ++j) {
+    EXPECT_EQ(blob.cpu_data()[j], j);
+  }
+}
+
 TYPED_TEST(DataTransformTest, TestCropSize) {
   TransformationParameter transform_param;
   const bool unique_pixels = false;  // all pixels the same equal to label
@@ -340,5 +420,13 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestVectorizedRows) {
+  this->CheckVectorizedRows(false);
+}
+
+TYPED_TEST(DataTransformTest, TestVectorizedRowsMeanFile) {
+  this->CheckVectorizedRows(true);
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
@@ -0,0 +1,105 @@
+#include <cstdio>
+#include <string>
+
+#include "boost/scoped_ptr.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/db.hpp"
+#include "caffe/util/db_record_file.hpp"
+#include "caffe/util/format.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+using boost::scoped_ptr;
+
+class RecordFileTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempDir(&source_);
+    source_ += "/db";
+  }
+
+  // Writes records [begin, end) in commits of 7, in chunks of about 100
+  // bytes and shards of about 300 bytes.
+  void Write(int begin, int end, db::Mode mode) {
+    db::RecordFile db(100, 300);
+    db.Open(source_, mode);
+    scoped_ptr<db::Transaction> txn(db.NewTransaction());
+    for (int i = begin; i < end; ++i) {
+      txn->Put(key(i), value(i));
+      if (i % 7 == 6) {
+        txn->Commit();
+      }
+    }
+    txn->Commit();
+  }
+
+  // Checks that the records are [0, num) in order, twice.
+  void Read(int num) {
+    scoped_ptr<db::DB> db(db::GetDB(DataParameter_DB_RECORD_FILE));
+    db->Open(source_, db::READ);
+    scoped_ptr<db::Cursor> cursor(db->NewCursor());
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int i = 0; i < num; ++i) {
+        ASSERT_TRUE(cursor->valid());
+        EXPECT_EQ(key(i), cursor->key());
+        EXPECT_EQ(value(i), cursor->value());
+        const char* data;
+        size_t size;
+        cursor->value_data(&data, &size);
+        EXPECT_EQ(value(i), string(data, size));
+        cursor->Next();
+      }
+      EXPECT_FALSE(cursor->valid());
+      cursor->SeekToFirst();
+    }
+  }
+
+  string key(int i) { return format_int(i, 5); }
+  string value(int i) { return string(i % 13, 'a' + i % 26); }
+
+  string source_;
+};
+
+TEST_F(RecordFileTest, TestGetDB) {
+  scoped_ptr<db::DB> db(db::GetDB("recordfile"));
+  EXPECT_TRUE(dynamic_cast<db::RecordFile*>(db.get()));
+}
+
+TEST_F(RecordFileTest, TestEmpty) {
+  Write(0, 0, db::NEW);
+  Read(0);
+}
+
+TEST_F(RecordFileTest, TestWriteRead) {
+  Write(0, 50, db::NEW);
+  // The records span several chunks in several shards.
+  FILE* second_shard = fopen((source_ + "/00000001.rec").c_str(), "r");
+  EXPECT_TRUE(second_shard);
+  if (second_shard) {
+    fclose(second_shard);
+  }
+  Read(50);
+}
+
+TEST_F(RecordFileTest, TestAppend) {
+  Write(0, 20, db::NEW);
+  Write(20, 45, db::WRITE);
+  Read(45);
+}
+
+TEST_F(RecordFileTest, TestIncompleteChunk) {
+  Write(0, 20, db::NEW);
+  // A chunk written without its index entry, as by an interrupted writer.
+  FILE* shard = fopen((source_ + "/00000000.rec").c_str(), "a");
+  ASSERT_TRUE(shard);
+  fputs("not indexed", shard);
+  fclose(shard);
+  Read(20);
+}
+
+}  // namespace caffe
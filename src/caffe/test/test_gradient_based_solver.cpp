@@ -19,6 +19,18 @@ using std::ostringstream;
 
 namespace caffe {
 
+// Updates the params through Normalize, Regularize and ComputeUpdateValue
+// rather than the fused CPU update, for reference.
+template <template <typename> class SolverType, typename Dtype>
+class UnfusedSolver : public SolverType<Dtype> {
+ public:
+  explicit UnfusedSolver(const SolverParameter& param)
+      : SolverType<Dtype>(param) {}
+
+ protected:
+  virtual bool ApplyFusedUpdate(int param_id, Dtype rate) { return false; }
+};
+
 template <typename TypeParam>
 class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -26,7 +38,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      share_(false) {
+      share_(false), snapshot_async_(false), fused_(true), flat_params_(false),
+      clip_gradients_(-1), regularization_type_("L2") {
         input_file_ = new string(
         CMAKE_SOURCE_DIR "caffe/test/test_data/solver_data_list.txt" CMAKE_EXT);
       }
@@ -42,6 +55,11 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  bool snapshot_async_;
+  bool fused_;
+  bool flat_params_;
+  Dtype clip_gradients_;
+  string regularization_type_;
   Dtype delta_;  // Stability constant for RMSProp, AdaGrad, AdaDelta and Adam
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -49,6 +67,15 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
 
   virtual void InitSolver(const SolverParameter& param) = 0;
 
+  template <template <typename> class SolverType>
+  void ResetSolver(const SolverParameter& param) {
+    if (fused_) {
+      solver_.reset(new SolverType<Dtype>(param));
+    } else {
+      solver_.reset(new UnfusedSolver<SolverType, Dtype>(param));
+    }
+  }
+
   virtual void InitSolverFromProtoString(const string& proto) {
     SolverParameter param;
     CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
@@ -169,6 +196,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
        "    bottom: 'innerprod' "
        "    bottom: 'targets' "
        "  } "
+       "  flat_params: " << flat_params_ << " "
        "} ";
     if (weight_decay != 0) {
       proto << "weight_decay: " << weight_decay << " ";
@@ -181,6 +209,11 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     if (snapshot) {
       proto << "snapshot: " << num_iters << " ";
     }
+    if (snapshot_async_) {
+      proto << "snapshot_async: true ";
+    }
+    proto << "regularization_type: '" << regularization_type_ << "' ";
+    proto << "clip_gradients: " << clip_gradients_ << " ";
     Caffe::set_random_seed(this->seed_);
     this->InitSolverFromProtoString(proto.str());
     if (from_snapshot != NULL) {
@@ -435,6 +468,47 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     EXPECT_NEAR(expected_bias, accum_bias, error_margin);
   }
 
+  // Test that the fused CPU update matches the separate Normalize, Regularize
+  // and ComputeUpdateValue calls, with either regularization and gradients
+  // accumulated over iterations.
+  void CheckFusedUpdate(const Dtype kLearningRate, const Dtype kWeightDecay,
+      const Dtype kMomentum, const int kNumIters) {
+    const int kIterSize = 2;
+    const double kPrecision = 1e-4;
+    const char* regularization_types[] = { "L2", "L1" };
+    for (int r = 0; r < 2; ++r) {
+      regularization_type_ = regularization_types[r];
+      vector<vector<shared_ptr<Blob<Dtype> > > > blobs(2);
+      for (int f = 0; f < 2; ++f) {
+        fused_ = f == 0;
+        RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+            kNumIters, kIterSize);
+        vector<Blob<Dtype>*> solver_blobs =
+            solver_->net()->learnable_params();
+        for (int i = 0; i < solver_->history().size(); ++i) {
+          solver_blobs.push_back(solver_->history()[i].get());
+        }
+        for (int i = 0; i < solver_blobs.size(); ++i) {
+          blobs[f].push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+          blobs[f].back()->CopyFrom(*solver_blobs[i], false, true);
+        }
+      }
+      fused_ = true;
+      ASSERT_EQ(blobs[0].size(), blobs[1].size());
+      for (int i = 0; i < blobs[0].size(); ++i) {
+        ASSERT_EQ(blobs[0][i]->count(), blobs[1][i]->count());
+        for (int j = 0; j < blobs[0][i]->count(); ++j) {
+          const Dtype expected = blobs[1][i]->cpu_data()[j];
+          const Dtype fused = blobs[0][i]->cpu_data()[j];
+          EXPECT_NEAR(expected, fused,
+              std::max(1e-7, kPrecision * fabs(expected)))
+              << regularization_type_ << " blob " << i << " value " << j;
+        }
+      }
+    }
+    regularization_type_ = "L2";
+  }
+
   // Test that the correct update is computed for a regularized least squares
   // problem:
   //
@@ -565,7 +639,7 @@ class SGDSolverTest : public GradientBasedSolverTest<TypeParam> {
 
  protected:
   virtual void InitSolver(const SolverParameter& param) {
-    this->solver_.reset(new SGDSolver<Dtype>(param));
+    this->template ResetSolver<SGDSolver>(param);
   }
 };
 
@@ -648,6 +722,15 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingShare) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+}
+
 TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -694,6 +777,60 @@ TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestSnapshotAsync) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->snapshot_async_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->flat_params_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestClipGradientsFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->clip_gradients_ = 0.1;
+  vector<shared_ptr<Blob<Dtype> > > params[2];
+  for (int flat = 0; flat < 2; ++flat) {
+    this->flat_params_ = flat;
+    this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+        kNumIters);
+    EXPECT_EQ(flat, this->solver_->net()->has_flat_params());
+    const vector<Blob<Dtype>*>& net_params =
+        this->solver_->net()->learnable_params();
+    for (int i = 0; i < net_params.size(); ++i) {
+      params[flat].push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      params[flat].back()->CopyFrom(*net_params[i], false, true);
+    }
+  }
+  ASSERT_EQ(params[0].size(), params[1].size());
+  for (int i = 0; i < params[0].size(); ++i) {
+    for (int j = 0; j < params[0][i]->count(); ++j) {
+      const Dtype expected = params[0][i]->cpu_data()[j];
+      EXPECT_NEAR(expected, params[1][i]->cpu_data()[j],
+          std::max(1e-7, 1e-4 * fabs(expected)));
+    }
+  }
+}
+
 
 template <typename TypeParam>
 class AdaGradSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -701,7 +838,7 @@ class AdaGradSolverTest : public GradientBasedSolverTest<TypeParam> {
 
  protected:
   virtual void InitSolver(const SolverParameter& param) {
-    this->solver_.reset(new AdaGradSolver<Dtype>(param));
+    this->template ResetSolver<AdaGradSolver>(param);
   }
 };
 
@@ -748,6 +885,15 @@ TYPED_TEST(AdaGradSolverTest,
   }
 }
 
+TYPED_TEST(AdaGradSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+}
+
 TYPED_TEST(AdaGradSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -801,7 +947,7 @@ class NesterovSolverTest : public GradientBasedSolverTest<TypeParam> {
 
  protected:
   virtual void InitSolver(const SolverParameter& param) {
-    this->solver_.reset(new NesterovSolver<Dtype>(param));
+    this->template ResetSolver<NesterovSolver>(param);
   }
 };
 
@@ -882,6 +1028,15 @@ TYPED_TEST(NesterovSolverTest,
   }
 }
 
+TYPED_TEST(NesterovSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+}
+
 TYPED_TEST(NesterovSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -934,7 +1089,7 @@ class AdaDeltaSolverTest : public GradientBasedSolverTest<TypeParam> {
 
  protected:
   virtual void InitSolver(const SolverParameter& param) {
-    this->solver_.reset(new AdaDeltaSolver<Dtype>(param));
+    this->template ResetSolver<AdaDeltaSolver>(param);
   }
 };
 
@@ -1011,6 +1166,15 @@ TYPED_TEST(AdaDeltaSolverTest,
   }
 }
 
+TYPED_TEST(AdaDeltaSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.1;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.95;
+  const int kNumIters = 4;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+}
+
 TYPED_TEST(AdaDeltaSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.1;
@@ -1068,7 +1232,7 @@ class AdamSolverTest : public GradientBasedSolverTest<TypeParam> {
     new_param.set_momentum(momentum);
     const Dtype momentum2 = 0.999;
     new_param.set_momentum2(momentum2);
-    this->solver_.reset(new AdamSolver<Dtype>(new_param));
+    this->template ResetSolver<AdamSolver>(new_param);
   }
 };
 
@@ -1113,6 +1277,15 @@ TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverythingShare) {
   }
 }
 
+TYPED_TEST(AdamSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+}
+
 TYPED_TEST(AdamSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -1159,6 +1332,30 @@ TYPED_TEST(AdamSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(AdamSolverTest, TestSnapshotAsync) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->snapshot_async_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(AdamSolverTest, TestLeastSquaresUpdateWithEverythingFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->flat_params_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 template <typename TypeParam>
 class RMSPropSolverTest : public GradientBasedSolverTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -1168,7 +1365,7 @@ class RMSPropSolverTest : public GradientBasedSolverTest<TypeParam> {
     const Dtype rms_decay = 0.95;
     SolverParameter new_param = param;
     new_param.set_rms_decay(rms_decay);
-    this->solver_.reset(new RMSPropSolver<Dtype>(new_param));
+    this->template ResetSolver<RMSPropSolver>(new_param);
   }
 };
 
@@ -1216,6 +1413,15 @@ TYPED_TEST(RMSPropSolverTest,
   }
 }
 
+TYPED_TEST(RMSPropSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.0;
+  const int kNumIters = 4;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+}
+
 TYPED_TEST(RMSPropSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
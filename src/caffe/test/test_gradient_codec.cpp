@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/gradient_codec.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class GradientCodecTest : public ::testing::Test {
+ protected:
+  GradientCodecTest() : values_(kCount) {
+    Caffe::set_random_seed(1701);
+    caffe_rng_gaussian<Dtype>(kCount, 0, 0.01, &values_[0]);
+  }
+
+  // Encodes values with codec into a buffer of the size it requires, with
+  // residual starting at zero, and decodes them.
+  void EncodeDecode(GradientCodec<Dtype>* codec, const vector<Dtype>& values,
+      vector<Dtype>* decoded, vector<Dtype>* residual) {
+    residual->assign(values.size(), 0);
+    Encode(codec, values, residual);
+    decoded->assign(values.size(), 0);
+    codec->DecodeAdd(values.size(), &encoded_[0], 0, values.size(),
+        &(*decoded)[0]);
+  }
+
+  void Encode(GradientCodec<Dtype>* codec, const vector<Dtype>& values,
+      vector<Dtype>* residual) {
+    encoded_.assign(codec->EncodedBytes(values.size()) / sizeof(Dtype) + 1,
+        0);
+    codec->Encode(values.size(), &values[0], &(*residual)[0], &encoded_[0]);
+  }
+
+  // Checks that the decoded values and the residual add up to the values.
+  void CheckResidual(const vector<Dtype>& values,
+      const vector<Dtype>& decoded, const vector<Dtype>& residual) {
+    for (int i = 0; i < values.size(); ++i) {
+      EXPECT_NEAR(values[i], decoded[i] + residual[i],
+          1e-6 * std::max<Dtype>(1, std::fabs(values[i])));
+    }
+  }
+
+  static const int kCount = 1000;
+
+  vector<Dtype> values_;
+  vector<Dtype> encoded_;
+};
+
+template <typename Dtype>
+const int GradientCodecTest<Dtype>::kCount;
+
+TYPED_TEST_CASE(GradientCodecTest, TestDtypes);
+
+TYPED_TEST(GradientCodecTest, TestNone) {
+  GradientCodec<TypeParam> codec(SolverParameter_SyncCompression_NONE, 0);
+  EXPECT_EQ(this->kCount * sizeof(TypeParam),
+      codec.EncodedBytes(this->kCount));
+  vector<TypeParam> decoded, residual;
+  this->EncodeDecode(&codec, this->values_, &decoded, &residual);
+  for (int i = 0; i < this->kCount; ++i) {
+    EXPECT_EQ(this->values_[i], decoded[i]);
+    EXPECT_EQ(0, residual[i]);
+  }
+}
+
+TYPED_TEST(GradientCodecTest, TestFP16) {
+  GradientCodec<TypeParam> codec(SolverParameter_SyncCompression_FP16, 0);
+  EXPECT_EQ(this->kCount * 2, codec.EncodedBytes(this->kCount));
+  vector<TypeParam> decoded, residual;
+  this->EncodeDecode(&codec, this->values_, &decoded, &residual);
+  for (int i = 0; i < this->kCount; ++i) {
+    // Half precision keeps 11 significant bits, and fewer below 2^-14.
+    EXPECT_LE(std::fabs(residual[i]), std::max<TypeParam>(
+        std::fabs(this->values_[i]) / 2048, std::ldexp(1.0, -25)));
+  }
+  this->CheckResidual(this->values_, decoded, residual);
+
+  // Halves represent these exactly, down to subnormals, and saturate above
+  // the largest.
+  const TypeParam kValues[] = { 0, 1, -2.5, 65504, 1e6, -1e6,
+      std::ldexp(1.0, -14), std::ldexp(3.0, -24), 1e-9 };
+  const TypeParam kExpected[] = { 0, 1, -2.5, 65504, 65504, -65504,
+      std::ldexp(1.0, -14), std::ldexp(3.0, -24), 0 };
+  const vector<TypeParam> values(kValues, kValues + 9);
+  this->EncodeDecode(&codec, values, &decoded, &residual);
+  for (int i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(kExpected[i], decoded[i]);
+  }
+  this->CheckResidual(values, decoded, residual);
+  // Ties round to even.
+  const TypeParam kTies[] = { 1 + std::ldexp(1.0, -11),
+      1 + 3 * std::ldexp(1.0, -11) };
+  const TypeParam kRounded[] = { 1, 1 + std::ldexp(1.0, -9) };
+  this->EncodeDecode(&codec, vector<TypeParam>(kTies, kTies + 2), &decoded,
+      &residual);
+  EXPECT_EQ(kRounded[0], decoded[0]);
+  EXPECT_EQ(kRounded[1], decoded[1]);
+}
+
+TYPED_TEST(GradientCodecTest, TestInt8) {
+  GradientCodec<TypeParam> codec(SolverParameter_SyncCompression_INT8, 0);
+  const int kBlockSize = GradientCodec<TypeParam>::kBlockSize;
+  const int blocks = (this->kCount + kBlockSize - 1) / kBlockSize;
+  EXPECT_EQ(blocks * sizeof(float) + this->kCount,
+      codec.EncodedBytes(this->kCount));
+  vector<TypeParam> decoded, residual;
+  this->EncodeDecode(&codec, this->values_, &decoded, &residual);
+  for (int b = 0; b < blocks; ++b) {
+    const int begin = b * kBlockSize;
+    const int end = std::min(this->kCount, begin + kBlockSize);
+    TypeParam max_abs = 0;
+    for (int i = begin; i < end; ++i) {
+      max_abs = std::max(max_abs, std::fabs(this->values_[i]));
+    }
+    // Values round to the nearest of 127 steps up to the largest.
+    for (int i = begin; i < end; ++i) {
+      EXPECT_LE(std::fabs(residual[i]), max_abs / 254 * (1 + 1e-5));
+    }
+  }
+  this->CheckResidual(this->values_, decoded, residual);
+  // Blocks of zeros stay zeros.
+  this->EncodeDecode(&codec, vector<TypeParam>(10, 0), &decoded, &residual);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(0, decoded[i]);
+  }
+}
+
+TYPED_TEST(GradientCodecTest, TestTopK) {
+  GradientCodec<TypeParam> codec(SolverParameter_SyncCompression_TOP_K, 0.1);
+  const int k = this->kCount / 10;
+  EXPECT_EQ(k * (sizeof(TypeParam) + 4), codec.EncodedBytes(this->kCount));
+  // At least one value is kept.
+  EXPECT_EQ(sizeof(TypeParam) + 4, codec.EncodedBytes(3));
+  vector<TypeParam> decoded, residual;
+  this->EncodeDecode(&codec, this->values_, &decoded, &residual);
+  // The values kept are exact, and no smaller than the ones dropped.
+  int kept = 0;
+  TypeParam min_kept = 1e9, max_dropped = 0;
+  for (int i = 0; i < this->kCount; ++i) {
+    if (decoded[i] != 0) {
+      ++kept;
+      EXPECT_EQ(this->values_[i], decoded[i]);
+      EXPECT_EQ(0, residual[i]);
+      min_kept = std::min(min_kept, std::fabs(decoded[i]));
+    } else {
+      EXPECT_EQ(this->values_[i], residual[i]);
+      max_dropped = std::max(max_dropped, std::fabs(residual[i]));
+    }
+  }
+  EXPECT_EQ(k, kept);
+  EXPECT_GE(min_kept, max_dropped);
+}
+
+TYPED_TEST(GradientCodecTest, TestDecodeRange) {
+  const SolverParameter_SyncCompression kCompressions[] = {
+      SolverParameter_SyncCompression_NONE,
+      SolverParameter_SyncCompression_FP16,
+      SolverParameter_SyncCompression_INT8,
+      SolverParameter_SyncCompression_TOP_K };
+  for (int c = 0; c < 4; ++c) {
+    GradientCodec<TypeParam> codec(kCompressions[c], 0.3);
+    vector<TypeParam> decoded, residual;
+    this->EncodeDecode(&codec, this->values_, &decoded, &residual);
+    // Ranges across blocks decode the same as the whole values.
+    const int kBounds[] = { 0, 1, 255, 256, 300, 777, this->kCount };
+    for (int r = 0; r + 1 < 7; ++r) {
+      const int begin = kBounds[r];
+      const int end = kBounds[r + 1];
+      vector<TypeParam> range(end - begin, 1);
+      codec.DecodeAdd(this->kCount, &this->encoded_[0], begin, end,
+          &range[0]);
+      for (int i = begin; i < end; ++i) {
+        EXPECT_EQ(decoded[i] + 1, range[i - begin]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(GradientCodecTest, TestErrorFeedback) {
+  // The values dropped accumulate until they are large enough to be kept,
+  // so that what is encoded over many iterations adds up to the values.
+  GradientCodec<TypeParam> codec(SolverParameter_SyncCompression_TOP_K, 0.1);
+  const int kIterations = 200;
+  vector<TypeParam> residual(this->kCount, 0);
+  vector<TypeParam> total(this->kCount, 0);
+  for (int iter = 0; iter < kIterations; ++iter) {
+    this->Encode(&codec, this->values_, &residual);
+    codec.DecodeAdd(this->kCount, &this->encoded_[0], 0, this->kCount,
+        &total[0]);
+  }
+  int never_kept = 0;
+  for (int i = 0; i < this->kCount; ++i) {
+    EXPECT_NEAR(kIterations * this->values_[i], total[i] + residual[i], 1e-3);
+    never_kept += total[i] == 0;
+  }
+  EXPECT_LT(never_kept, this->kCount / 10);
+}
+
+}  // namespace caffe
@@ -0,0 +1,111 @@
+#include <stdint.h>
+#include <algorithm>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/host_allocator.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class PoolHostAllocatorTest : public ::testing::Test {};
+
+TEST_F(PoolHostAllocatorTest, TestSizeClass) {
+  EXPECT_EQ(PoolHostAllocator::SizeClass(1), 64);
+  EXPECT_EQ(PoolHostAllocator::SizeClass(64), 64);
+  EXPECT_EQ(PoolHostAllocator::SizeClass(65), 128);
+  EXPECT_EQ(PoolHostAllocator::SizeClass(1000), 1024);
+  EXPECT_EQ(PoolHostAllocator::SizeClass(1024), 1024);
+  EXPECT_EQ(PoolHostAllocator::SizeClass(1025), 1280);
+  for (size_t size = 1; size < 100000; size += 37) {
+    const size_t block_size = PoolHostAllocator::SizeClass(size);
+    EXPECT_GE(block_size, size);
+    EXPECT_EQ(block_size % PoolHostAllocator::kAlignment, 0);
+    // Waste is bounded by a quarter of the request or a single alignment.
+    EXPECT_LT(block_size, size + std::max(size / 4 + 1,
+        PoolHostAllocator::kAlignment));
+  }
+}
+
+TEST_F(PoolHostAllocatorTest, TestReuse) {
+  PoolHostAllocator allocator;
+  void* ptr = allocator.Allocate(1000);
+  ASSERT_TRUE(ptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) %
+      PoolHostAllocator::kAlignment, 0);
+  EXPECT_EQ(allocator.stats().bytes_in_use, 1024);
+  allocator.Free(ptr, 1000);
+  EXPECT_EQ(allocator.stats().bytes_in_use, 0);
+  EXPECT_EQ(allocator.stats().bytes_cached, 1024);
+  // A request of the same size class gets the cached block.
+  void* ptr2 = allocator.Allocate(990);
+  EXPECT_EQ(ptr, ptr2);
+  HostAllocatorStats stats = allocator.stats();
+  EXPECT_EQ(stats.num_allocations, 2);
+  EXPECT_EQ(stats.num_cache_hits, 1);
+  EXPECT_EQ(stats.hit_rate(), 0.5);
+  EXPECT_EQ(stats.bytes_cached, 0);
+  // Another size class does not.
+  void* ptr3 = allocator.Allocate(2000);
+  EXPECT_NE(ptr2, ptr3);
+  EXPECT_EQ(allocator.stats().peak_bytes_in_use, 1024 + 2048);
+  allocator.Free(ptr2, 990);
+  allocator.Free(ptr3, 2000);
+  EXPECT_EQ(allocator.stats().bytes_cached, 1024 + 2048);
+  allocator.ReleaseCache();
+  EXPECT_EQ(allocator.stats().bytes_cached, 0);
+  EXPECT_EQ(allocator.stats().bytes_in_use, 0);
+}
+
+TEST_F(PoolHostAllocatorTest, TestMaxBytesCached) {
+  PoolHostAllocator allocator(1024);
+  void* ptr = allocator.Allocate(1000);
+  void* ptr2 = allocator.Allocate(1000);
+  allocator.Free(ptr, 1000);
+  allocator.Free(ptr2, 1000);
+  EXPECT_EQ(allocator.stats().bytes_cached, 1024);
+}
+
+TEST_F(PoolHostAllocatorTest, TestSyncedMemory) {
+  Caffe::set_mode(Caffe::CPU);
+  shared_ptr<HostAllocator> default_allocator = Caffe::host_allocator();
+  shared_ptr<PoolHostAllocator> allocator(new PoolHostAllocator());
+  Caffe::set_host_allocator(allocator);
+  {
+    SyncedMemory mem(1000);
+    EXPECT_EQ(allocator->stats().bytes_in_use, 0);
+    mem.mutable_cpu_data();
+    EXPECT_EQ(allocator->stats().bytes_in_use, 1024);
+    // Memory is returned to its allocator even after another one was set.
+    Caffe::set_host_allocator(default_allocator);
+  }
+  EXPECT_EQ(allocator->stats().bytes_in_use, 0);
+  EXPECT_EQ(allocator->stats().bytes_cached, 1024);
+}
+
+class AllocatingThread : public InternalThread {
+  void InternalThreadEntry() {
+    SyncedMemory mem(1000);
+    mem.mutable_cpu_data();
+  }
+};
+
+TEST_F(PoolHostAllocatorTest, TestInternalThread) {
+  Caffe::set_mode(Caffe::CPU);
+  shared_ptr<HostAllocator> default_allocator = Caffe::host_allocator();
+  shared_ptr<PoolHostAllocator> allocator(new PoolHostAllocator());
+  // Threads allocate from the allocator of the thread starting them.
+  Caffe::set_host_allocator(allocator);
+  AllocatingThread thread;
+  thread.StartInternalThread();
+  thread.StopInternalThread();
+  Caffe::set_host_allocator(default_allocator);
+  EXPECT_EQ(allocator->stats().num_allocations, 1);
+  EXPECT_EQ(allocator->stats().bytes_cached, 1024);
+}
+
+}  // namespace caffe
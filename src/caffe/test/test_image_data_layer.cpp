@@ -97,6 +97,42 @@ TYPED_TEST(ImageDataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(ImageDataLayerTest, TestReadParallelCached) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(2);
+  image_data_param->set_source(this->filename_reshape_.c_str());
+  image_data_param->set_new_height(32);
+  image_data_param->set_new_width(32);
+  image_data_param->set_shuffle(false);
+  ImageDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The same images loaded by two threads, and from the cache after the
+  // first epoch.
+  image_data_param->set_num_threads(2);
+  image_data_param->set_cache_size_mb(1);
+  Blob<Dtype> parallel_data, parallel_label;
+  vector<Blob<Dtype>*> parallel_top_vec;
+  parallel_top_vec.push_back(&parallel_data);
+  parallel_top_vec.push_back(&parallel_label);
+  ImageDataLayer<Dtype> parallel_layer(param);
+  parallel_layer.SetUp(this->blob_bottom_vec_, parallel_top_vec);
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    parallel_layer.Forward(this->blob_bottom_vec_, parallel_top_vec);
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_EQ(i, parallel_label.cpu_data()[i]);
+    }
+    ASSERT_EQ(this->blob_top_data_->count(), parallel_data.count());
+    for (int j = 0; j < parallel_data.count(); ++j) {
+      EXPECT_EQ(this->blob_top_data_->cpu_data()[j],
+                parallel_data.cpu_data()[j])
+          << "debug: iter " << iter << " j " << j;
+    }
+  }
+}
+
 TYPED_TEST(ImageDataLayerTest, TestResize) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
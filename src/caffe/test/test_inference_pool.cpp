@@ -0,0 +1,192 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/inference_pool.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class InferencePoolTest : public ::testing::Test {
+ public:
+  // Runs the given inputs through sessions of the pool, one at a time.
+  void RunInputs(int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      typename InferencePool<Dtype>::Session session(pool_.get());
+      Net<Dtype>* net = session.net();
+      net->input_blobs()[0]->CopyFrom(*inputs_[i]);
+      outputs_[i]->CopyFrom(*net->Forward()[0], false, true);
+    }
+  }
+
+ protected:
+  InferencePoolTest() {
+    const string proto =
+        "name: 'InferenceNetwork' "
+        "state { phase: TEST } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "    shape: { dim: 2 dim: 3 dim: 6 dim: 6 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv' "
+        "  top: 'conv' "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'conv' "
+        "  top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'prob' "
+        "  type: 'Softmax' "
+        "  bottom: 'ip' "
+        "  top: 'prob' "
+        "} ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+  }
+
+  // Makes inputs and the outputs of the pool's net for them, run serially.
+  void MakeInputs(int num_inputs) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    const Net<Dtype>& net = *pool_->net();
+    for (int i = 0; i < num_inputs; ++i) {
+      inputs_.push_back(shared_ptr<Blob<Dtype> >(
+          new Blob<Dtype>(net.input_blobs()[0]->shape())));
+      filler.Fill(inputs_[i].get());
+      net.input_blobs()[0]->CopyFrom(*inputs_[i]);
+      expected_outputs_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      expected_outputs_[i]->CopyFrom(*pool_->net()->Forward()[0], false, true);
+      outputs_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    }
+  }
+
+  NetParameter param_;
+  shared_ptr<InferencePool<Dtype> > pool_;
+  vector<shared_ptr<Blob<Dtype> > > inputs_;
+  vector<shared_ptr<Blob<Dtype> > > outputs_;
+  vector<shared_ptr<Blob<Dtype> > > expected_outputs_;
+};
+
+TYPED_TEST_CASE(InferencePoolTest, TestDtypes);
+
+TYPED_TEST(InferencePoolTest, TestSharesParams) {
+  Caffe::set_mode(Caffe::CPU);
+  this->pool_.reset(new InferencePool<TypeParam>(this->param_, "", 3));
+  EXPECT_EQ(this->pool_->num_sessions(), 3);
+  vector<Net<TypeParam>*> sessions;
+  for (int i = 0; i < 3; ++i) {
+    sessions.push_back(this->pool_->Acquire());
+  }
+  const Net<TypeParam>& net = *this->pool_->net();
+  for (int i = 0; i < 3; ++i) {
+    const Net<TypeParam>& session = *sessions[i];
+    ASSERT_EQ(session.params().size(), net.params().size());
+    for (int j = 0; j < net.params().size(); ++j) {
+      EXPECT_EQ(session.params()[j]->cpu_data(), net.params()[j]->cpu_data());
+    }
+    for (int j = 0; j < i; ++j) {
+      EXPECT_NE(session.input_blobs()[0]->cpu_data(),
+          sessions[j]->input_blobs()[0]->cpu_data());
+      EXPECT_NE(session.output_blobs()[0]->cpu_data(),
+          sessions[j]->output_blobs()[0]->cpu_data());
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    this->pool_->Release(sessions[i]);
+  }
+}
+
+TYPED_TEST(InferencePoolTest, TestConcurrentForward) {
+  Caffe::set_mode(Caffe::CPU);
+  this->pool_.reset(new InferencePool<TypeParam>(this->param_, "", 2));
+  const int kNumThreads = 3;
+  const int kInputsPerThread = 4;
+  this->MakeInputs(kNumThreads * kInputsPerThread);
+  vector<shared_ptr<boost::thread> > threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.push_back(shared_ptr<boost::thread>(new boost::thread(
+        &InferencePoolTest<TypeParam>::RunInputs, this,
+        i * kInputsPerThread, (i + 1) * kInputsPerThread)));
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads[i]->join();
+  }
+  for (int i = 0; i < this->outputs_.size(); ++i) {
+    const Blob<TypeParam>& output = *this->outputs_[i];
+    const Blob<TypeParam>& expected_output = *this->expected_outputs_[i];
+    ASSERT_EQ(output.count(), expected_output.count());
+    for (int j = 0; j < output.count(); ++j) {
+      EXPECT_EQ(output.cpu_data()[j], expected_output.cpu_data()[j]);
+    }
+  }
+}
+
+TYPED_TEST(InferencePoolTest, TestLoadWeights) {
+  Caffe::set_mode(Caffe::CPU);
+  Net<TypeParam> trained_net(this->param_);
+  NetParameter trained_param;
+  trained_net.ToProto(&trained_param);
+  string trained_filename;
+  MakeTempFilename(&trained_filename);
+  WriteProtoToBinaryFile(trained_param, trained_filename);
+  this->pool_.reset(
+      new InferencePool<TypeParam>(this->param_, trained_filename, 2));
+  typename InferencePool<TypeParam>::Session session(this->pool_.get());
+  const vector<shared_ptr<Blob<TypeParam> > >& params =
+      session.net()->params();
+  ASSERT_EQ(params.size(), trained_net.params().size());
+  for (int i = 0; i < params.size(); ++i) {
+    const Blob<TypeParam>& expected_param = *trained_net.params()[i];
+    ASSERT_EQ(params[i]->count(), expected_param.count());
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(params[i]->cpu_data()[j], expected_param.cpu_data()[j]);
+    }
+  }
+}
+
+}  // namespace caffe
@@ -3,6 +3,7 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/highgui/highgui_c.h>
 #include <opencv2/imgproc/imgproc.hpp>
+#endif  // USE_OPENCV
 
 #include <string>
 
@@ -17,6 +18,7 @@ namespace caffe {
 
 class IOTest : public ::testing::Test {};
 
+#ifdef USE_OPENCV
 bool ReadImageToDatumReference(const string& filename, const int label,
     const int height, const int width, const bool is_color, Datum* datum) {
   cv::Mat cv_img;
@@ -420,5 +422,47 @@ TEST_F(IOTest, TestDecodeDatumToCVMatContentNative) {
   }
 }
 
-}  // namespace caffe
 #endif  // USE_OPENCV
+
+TEST_F(IOTest, TestParseDatumInPlace) {
+  Datum datum;
+  datum.set_channels(2);
+  datum.set_height(3);
+  datum.set_width(4);
+  datum.set_label(5);
+  for (int i = 0; i < 24; ++i) {
+    datum.mutable_data()->push_back(static_cast<char>(i));
+  }
+  string serialized;
+  CHECK(datum.SerializeToString(&serialized));
+  Datum parsed;
+  const char* data;
+  size_t data_size;
+  EXPECT_TRUE(ParseDatumInPlace(serialized.data(), serialized.size(), &parsed,
+      &data, &data_size));
+  EXPECT_EQ(parsed.channels(), 2);
+  EXPECT_EQ(parsed.height(), 3);
+  EXPECT_EQ(parsed.width(), 4);
+  EXPECT_EQ(parsed.label(), 5);
+  EXPECT_FALSE(parsed.encoded());
+  EXPECT_TRUE(parsed.data().empty());
+  // The pixels are left where they are in the serialized datum.
+  EXPECT_GE(data, serialized.data());
+  EXPECT_LE(data + data_size, serialized.data() + serialized.size());
+  EXPECT_EQ(string(data, data_size), datum.data());
+
+  datum.clear_data();
+  datum.add_float_data(0.5);
+  CHECK(datum.SerializeToString(&serialized));
+  EXPECT_TRUE(ParseDatumInPlace(serialized.data(), serialized.size(), &parsed,
+      &data, &data_size));
+  EXPECT_TRUE(data == NULL);
+  EXPECT_EQ(parsed.label(), 5);
+  EXPECT_EQ(parsed.float_data_size(), 1);
+  EXPECT_EQ(parsed.float_data(0), 0.5);
+
+  EXPECT_FALSE(ParseDatumInPlace(serialized.data(), serialized.size() - 1,
+      &parsed, &data, &data_size));
+}
+
+}  // namespace caffe
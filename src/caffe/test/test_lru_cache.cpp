@@ -0,0 +1,63 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/lru_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class LRUCacheTest : public ::testing::Test {};
+
+TEST_F(LRUCacheTest, TestGetPut) {
+  LRUCache<string, int> cache(10);
+  int value = 0;
+  EXPECT_FALSE(cache.Get("a", &value));
+  cache.Put("a", 1, 4);
+  cache.Put("b", 2, 4);
+  EXPECT_TRUE(cache.Get("a", &value));
+  EXPECT_EQ(value, 1);
+  EXPECT_TRUE(cache.Get("b", &value));
+  EXPECT_EQ(value, 2);
+  EXPECT_EQ(cache.count(), 2);
+  EXPECT_EQ(cache.size(), 8);
+  // Replacing a value updates its size.
+  cache.Put("a", 3, 2);
+  EXPECT_TRUE(cache.Get("a", &value));
+  EXPECT_EQ(value, 3);
+  EXPECT_EQ(cache.count(), 2);
+  EXPECT_EQ(cache.size(), 6);
+}
+
+TEST_F(LRUCacheTest, TestEvictLeastRecentlyUsed) {
+  LRUCache<string, int> cache(10);
+  int value = 0;
+  cache.Put("a", 1, 4);
+  cache.Put("b", 2, 4);
+  // Using a makes b the least recently used, evicted to make room for c.
+  EXPECT_TRUE(cache.Get("a", &value));
+  cache.Put("c", 3, 4);
+  EXPECT_TRUE(cache.Get("a", &value));
+  EXPECT_FALSE(cache.Get("b", &value));
+  EXPECT_TRUE(cache.Get("c", &value));
+  EXPECT_EQ(cache.size(), 8);
+  // A value as large as the cache evicts all others.
+  cache.Put("d", 4, 10);
+  EXPECT_EQ(cache.count(), 1);
+  EXPECT_TRUE(cache.Get("d", &value));
+  EXPECT_EQ(value, 4);
+}
+
+TEST_F(LRUCacheTest, TestTooLarge) {
+  LRUCache<string, int> cache(10);
+  int value = 0;
+  cache.Put("a", 1, 4);
+  cache.Put("b", 2, 11);
+  EXPECT_FALSE(cache.Get("b", &value));
+  EXPECT_TRUE(cache.Get("a", &value));
+  EXPECT_EQ(cache.size(), 4);
+}
+
+}  // namespace caffe
@@ -0,0 +1,74 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/mapped_weights.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class MappedWeightsTest : public ::testing::Test {};
+
+TEST_F(MappedWeightsTest, TestWriteRead) {
+  NetParameter net_param;
+  LayerParameter* conv = net_param.add_layer();
+  conv->set_name("conv");
+  BlobProto* weights = conv->add_blobs();
+  weights->mutable_shape()->add_dim(2);
+  weights->mutable_shape()->add_dim(3);
+  for (int i = 0; i < 6; ++i) {
+    weights->add_data(i * 0.5);
+  }
+  BlobProto* bias = conv->add_blobs();
+  bias->mutable_shape()->add_dim(2);
+  bias->add_double_data(-1);
+  bias->add_double_data(1e-300);
+  net_param.add_layer()->set_name("relu");
+  LayerParameter* legacy = net_param.add_layer();
+  legacy->set_name("legacy");
+  BlobProto* legacy_weights = legacy->add_blobs();
+  legacy_weights->set_num(1);
+  legacy_weights->set_channels(1);
+  legacy_weights->set_height(1);
+  legacy_weights->set_width(1);
+  legacy_weights->add_data(7);
+  string filename;
+  MakeTempFilename(&filename);
+  MappedWeights::Write(net_param, filename);
+
+  MappedWeights mapped(filename);
+  const vector<MappedWeights::Param>& params = mapped.params();
+  ASSERT_EQ(params.size(), 3);
+  EXPECT_EQ(params[0].layer_name, "conv");
+  EXPECT_EQ(params[0].index, 0);
+  EXPECT_EQ(params[0].type, MappedWeights::FLOAT);
+  EXPECT_EQ(params[0].shape.shape().dim_size(), 2);
+  EXPECT_EQ(params[0].shape.shape().dim(1), 3);
+  ASSERT_EQ(params[0].count, 6);
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(static_cast<const float*>(params[0].data)[i], i * 0.5);
+  }
+  EXPECT_EQ(params[1].layer_name, "conv");
+  EXPECT_EQ(params[1].index, 1);
+  EXPECT_EQ(params[1].type, MappedWeights::DOUBLE);
+  ASSERT_EQ(params[1].count, 2);
+  EXPECT_EQ(static_cast<const double*>(params[1].data)[0], -1);
+  EXPECT_EQ(static_cast<const double*>(params[1].data)[1], 1e-300);
+  EXPECT_EQ(params[2].layer_name, "legacy");
+  EXPECT_FALSE(params[2].shape.has_shape());
+  EXPECT_EQ(params[2].shape.num(), 1);
+  EXPECT_EQ(params[2].shape.width(), 1);
+  ASSERT_EQ(params[2].count, 1);
+  EXPECT_EQ(static_cast<const float*>(params[2].data)[0], 7);
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_EQ(reinterpret_cast<size_t>(params[i].data) %
+        MappedWeights::kAlignment, 0);
+  }
+}
+
+}  // namespace caffe
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <set>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -22,11 +25,14 @@ class NetTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
 
  protected:
-  NetTest() : seed_(1701) {}
+  NetTest() : seed_(1701), flat_params_(false) {}
 
   virtual void InitNetFromProtoString(const string& proto) {
     NetParameter param;
     CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    if (flat_params_) {
+      param.set_flat_params(true);
+    }
     net_.reset(new Net<Dtype>(param));
   }
 
@@ -839,7 +845,280 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoFileWithState(proto, phase, level, stages);
   }
 
+  virtual void InitBranchedDeployNet(const bool optimize_memory) {
+    string proto =
+        "name: 'BranchedDeployNetwork' "
+        "state { phase: TEST } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "    shape: { dim: 2 dim: 3 dim: 10 dim: 10 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'constant' "
+        "      value: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'pool1' "
+        "  type: 'Pooling' "
+        "  bottom: 'conv1' "
+        "  top: 'pool1' "
+        "  pooling_param { "
+        "    pool: MAX "
+        "    kernel_size: 2 "
+        "    stride: 2 "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    stride: 2 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'pool1' "
+        "  bottom: 'conv2' "
+        "  top: 'sum' "
+        "} "
+        "layer { "
+        "  name: 'ip1' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'sum' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'sigmoid' "
+        "  type: 'Sigmoid' "
+        "  bottom: 'ip1' "
+        "  top: 'sigmoid' "
+        "} "
+        "layer { "
+        "  name: 'ip2' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'sigmoid' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'prob' "
+        "  type: 'Softmax' "
+        "  bottom: 'ip2' "
+        "  top: 'prob' "
+        "} ";
+    if (optimize_memory) {
+      proto += "optimize_memory: true ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitConvBatchNormNet(const bool fuse_layers) {
+    string proto =
+        "name: 'ConvBatchNormNetwork' "
+        "state { phase: TEST } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "    shape: { dim: 2 dim: 3 dim: 8 dim: 8 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    bias_term: false "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'bn1' "
+        "  type: 'BatchNorm' "
+        "  bottom: 'conv1' "
+        "  top: 'bn1' "
+        "} "
+        "layer { "
+        "  name: 'scale1' "
+        "  type: 'Scale' "
+        "  bottom: 'bn1' "
+        "  top: 'scale1' "
+        "  scale_param { "
+        "    bias_term: true "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'scale1' "
+        "  top: 'scale1' "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  bottom: 'scale1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 3 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'bn2' "
+        "  type: 'BatchNorm' "
+        "  bottom: 'conv2' "
+        "  top: 'conv2' "
+        "} "
+        "layer { "
+        "  name: 'pool' "
+        "  type: 'Pooling' "
+        "  bottom: 'conv2' "
+        "  top: 'pool' "
+        "  pooling_param { "
+        "    pool: AVE "
+        "    kernel_size: 2 "
+        "    stride: 2 "
+        "  } "
+        "} ";
+    if (fuse_layers) {
+      proto += "fuse_layers: true ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitElementwiseNet(const bool auto_in_place) {
+    string proto =
+        "name: 'ElementwiseNetwork' "
+        "state { phase: TEST } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "    shape: { dim: 2 dim: 3 dim: 5 dim: 5 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'tanh' "
+        "  type: 'TanH' "
+        "  bottom: 'data' "
+        "  top: 'tanh' "
+        "} "
+        "layer { "
+        "  name: 'conv' "
+        "  type: 'Convolution' "
+        "  bottom: 'tanh' "
+        "  top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'sigmoid' "
+        "  type: 'Sigmoid' "
+        "  bottom: 'conv' "
+        "  top: 'sigmoid' "
+        "} "
+        "layer { "
+        "  name: 'power' "
+        "  type: 'Power' "
+        "  bottom: 'sigmoid' "
+        "  top: 'power' "
+        "  power_param { "
+        "    power: 2 "
+        "    scale: 3 "
+        "    shift: -1 "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'conv' "
+        "  bottom: 'power' "
+        "  top: 'sum' "
+        "} "
+        "layer { "
+        "  name: 'relu' "
+        "  type: 'ReLU' "
+        "  bottom: 'sum' "
+        "  top: 'relu' "
+        "} ";
+    if (auto_in_place) {
+      proto += "auto_in_place: true ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
   int seed_;
+  bool flat_params_;
   shared_ptr<Net<Dtype> > net_;
 };
 
@@ -1197,6 +1476,77 @@ TYPED_TEST(NetTest, TestUnsharedWeightsDiffNet) {
   }
 }
 
+TYPED_TEST(NetTest, TestFlatParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  const bool kForceBackward = false;
+  const bool kBiasTerm = true;
+  Caffe::set_random_seed(this->seed_);
+  this->InitUnsharedWeightsNet(NULL, NULL, kForceBackward, kBiasTerm);
+  EXPECT_FALSE(this->net_->has_flat_params());
+  this->net_->ForwardBackward();
+  vector<shared_ptr<Blob<Dtype> > > expected_params;
+  this->CopyNetParams(false, &expected_params);
+  vector<shared_ptr<Blob<Dtype> > > expected_diffs;
+  this->CopyNetParams(true, &expected_diffs);
+
+  Caffe::set_random_seed(this->seed_);
+  this->flat_params_ = true;
+  this->InitUnsharedWeightsNet(NULL, NULL, kForceBackward, kBiasTerm);
+  Net<Dtype>* net = this->net_.get();
+  ASSERT_TRUE(net->has_flat_params());
+  const vector<Blob<Dtype>*>& params = net->learnable_params();
+  ASSERT_EQ(params.size(), 4);
+  // The params lie one after the other in the slabs.
+  size_t offset = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_EQ(params[i]->cpu_data(),
+        static_cast<const Dtype*>(net->flat_param_data()->cpu_data()) +
+        offset);
+    EXPECT_EQ(params[i]->cpu_diff(),
+        static_cast<const Dtype*>(net->flat_param_diff()->cpu_data()) +
+        offset);
+    offset += params[i]->count();
+  }
+  EXPECT_EQ(net->flat_param_count(), offset);
+  net->ForwardBackward();
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(expected_params[i]->cpu_data()[j], params[i]->cpu_data()[j]);
+      EXPECT_EQ(expected_diffs[i]->cpu_diff()[j], params[i]->cpu_diff()[j]);
+    }
+  }
+  net->Update();
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_FLOAT_EQ(expected_params[i]->cpu_data()[j] -
+          expected_diffs[i]->cpu_diff()[j], params[i]->cpu_data()[j]);
+    }
+  }
+  net->ClearParamDiffs();
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(0, params[i]->cpu_diff()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestFlatParamsSharedWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->flat_params_ = true;
+  this->InitDiffDataSharedWeightsNet();
+  Net<Dtype>* net = this->net_.get();
+  ASSERT_TRUE(net->has_flat_params());
+  ASSERT_EQ(net->learnable_params().size(), 1);
+  Blob<Dtype>* ip1_weights = net->layers()[1]->blobs()[0].get();
+  Blob<Dtype>* ip2_weights = net->layers()[2]->blobs()[0].get();
+  EXPECT_EQ(net->flat_param_count(), ip1_weights->count());
+  EXPECT_EQ(ip1_weights->cpu_data(), ip2_weights->cpu_data());
+  EXPECT_EQ(ip1_weights->cpu_data(),
+      static_cast<const Dtype*>(net->flat_param_data()->cpu_data()));
+  EXPECT_EQ(ip2_weights->cpu_diff(),
+      static_cast<const Dtype*>(net->flat_param_diff()->cpu_data()));
+}
+
 TYPED_TEST(NetTest, TestSharedWeightsDiffNet) {
   typedef typename TypeParam::Dtype Dtype;
   this->InitSharedWeightsNet();
@@ -1342,6 +1692,50 @@ TYPED_TEST(NetTest, TestSharedWeightsResume) {
   }
 }
 
+TYPED_TEST(NetTest, TestSharedWeightsResumeMapped) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet();
+  this->net_->ForwardBackward();
+  this->net_->Update();
+  Blob<Dtype> shared_params;
+  const bool kReshape = true;
+  const bool kCopyDiff = false;
+  shared_params.CopyFrom(*this->net_->layers()[1]->blobs()[0], kCopyDiff,
+      kReshape);
+
+  // Write the net to a weights file, as convert_caffemodel does.
+  NetParameter net_param;
+  this->net_->ToProto(&net_param);
+  string filename;
+  MakeTempFilename(&filename);
+  filename += ".caffeweights";
+  MappedWeights::Write(net_param, filename);
+
+  // The params of the reinitialized net point into the mapped file, and
+  // are still shared.
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet();
+  this->net_->CopyTrainedLayersFrom(filename);
+  Blob<Dtype>* ip1_weights = this->net_->layers()[1]->blobs()[0].get();
+  Blob<Dtype>* ip2_weights = this->net_->layers()[2]->blobs()[0].get();
+  EXPECT_EQ(ip1_weights->cpu_data(), ip2_weights->cpu_data());
+  EXPECT_EQ(0, reinterpret_cast<size_t>(ip1_weights->cpu_data()) %
+      MappedWeights::kAlignment);
+  for (int i = 0; i < ip1_weights->count(); ++i) {
+    EXPECT_EQ(shared_params.cpu_data()[i], ip1_weights->cpu_data()[i]);
+  }
+  // Updating the mapped params leaves the file unchanged.
+  this->net_->ForwardBackward();
+  this->net_->Update();
+  MappedWeights weights(filename);
+  ASSERT_EQ(weights.params()[0].layer_name, "innerproduct1");
+  const Dtype* file_data = static_cast<const Dtype*>(weights.params()[0].data);
+  for (int i = 0; i < ip1_weights->count(); ++i) {
+    EXPECT_EQ(shared_params.cpu_data()[i], file_data[i]);
+  }
+}
+
 TYPED_TEST(NetTest, TestParamPropagateDown) {
   typedef typename TypeParam::Dtype Dtype;
   const bool kBiasTerm = true, kForceBackward = false;
@@ -1457,6 +1851,36 @@ TYPED_TEST(NetTest, TestFromTo) {
   }
 }
 
+// Records the layers a Net runs its callbacks for.
+template <typename Dtype>
+class RecordingCallback : public Net<Dtype>::Callback {
+ public:
+  vector<int> layers_;
+
+ protected:
+  virtual void run(int layer) { layers_.push_back(layer); }
+};
+
+TYPED_TEST(NetTest, TestAfterBackward) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitTinyNet();
+  RecordingCallback<Dtype> callback;
+  this->net_->add_after_backward(&callback);
+  this->net_->Forward();
+  EXPECT_EQ(0, callback.layers_.size());
+  // The data layer, which does not need backward, is reported as well.
+  this->net_->Backward();
+  const int num_layers = this->net_->layers().size();
+  ASSERT_EQ(num_layers, callback.layers_.size());
+  for (int i = 0; i < num_layers; ++i) {
+    EXPECT_EQ(num_layers - 1 - i, callback.layers_[i]);
+  }
+  callback.layers_.clear();
+  this->net_->BackwardTo(1);
+  ASSERT_EQ(num_layers - 1, callback.layers_.size());
+  EXPECT_EQ(1, callback.layers_.back());
+}
+
 class FilterNetTest : public ::testing::Test {
  protected:
   void RunFilterNetTest(
@@ -2446,6 +2870,53 @@ TYPED_TEST(NetTest, TestReshape) {
   EXPECT_FALSE(same_spatial_shape);
 }
 
+TYPED_TEST(NetTest, TestOptimizeMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_random_seed(this->seed_);
+  this->InitBranchedDeployNet(false);
+  shared_ptr<Net<Dtype> > reference_net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitBranchedDeployNet(true);
+  // The planned net must use fewer distinct buffers for its activations.
+  set<const Dtype*> reference_buffers, planned_buffers;
+  for (int i = 0; i < this->net_->blobs().size(); ++i) {
+    reference_buffers.insert(reference_net->blobs()[i]->cpu_data());
+    planned_buffers.insert(this->net_->blobs()[i]->cpu_data());
+  }
+  EXPECT_LT(planned_buffers.size(), reference_buffers.size());
+  // Pin an intermediate blob; its contents must survive the forward pass.
+  const Blob<Dtype>& ip1 = *this->net_->blob_by_name("ip1");
+  const Blob<Dtype>& reference_ip1 = *reference_net->blob_by_name("ip1");
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int pass = 0; pass < 2; ++pass) {
+    if (pass == 1) {
+      // Grow the input to check that the plan follows Net::Reshape.
+      vector<int> shape = this->net_->input_blobs()[0]->shape();
+      shape[0] = 3;
+      this->net_->input_blobs()[0]->Reshape(shape);
+      reference_net->input_blobs()[0]->Reshape(shape);
+      this->net_->Reshape();
+      reference_net->Reshape();
+    }
+    Blob<Dtype>* input = this->net_->input_blobs()[0];
+    filler.Fill(input);
+    reference_net->input_blobs()[0]->CopyFrom(*input);
+    const Blob<Dtype>& output = *this->net_->Forward()[0];
+    const Blob<Dtype>& reference_output = *reference_net->Forward()[0];
+    ASSERT_EQ(output.count(), reference_output.count());
+    for (int i = 0; i < output.count(); ++i) {
+      EXPECT_FLOAT_EQ(reference_output.cpu_data()[i], output.cpu_data()[i]);
+    }
+    ASSERT_EQ(ip1.count(), reference_ip1.count());
+    for (int i = 0; i < ip1.count(); ++i) {
+      EXPECT_FLOAT_EQ(reference_ip1.cpu_data()[i], ip1.cpu_data()[i]);
+    }
+  }
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
@@ -2601,4 +3072,149 @@ TYPED_TEST(NetTest, TestAllInOneNetDeploy) {
   ASSERT_TRUE(found_data);
 }
 
+TYPED_TEST(NetTest, TestProfiling) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitTinyNet();
+  EXPECT_FALSE(this->net_->profiler());
+  this->net_->set_profiling(true);
+  this->net_->Forward();
+  this->net_->Backward();
+  this->net_->Forward();
+  this->net_->set_profiling(false);
+  this->net_->Forward();
+  const NetProfiler<Dtype>& profiler = *this->net_->profiler();
+  const int data = 0;
+  const int innerproduct = 1;
+  EXPECT_EQ(profiler.stats(data, NetProfiler<Dtype>::FORWARD).count, 2);
+  EXPECT_EQ(profiler.stats(data, NetProfiler<Dtype>::BACKWARD).count, 0);
+  const typename NetProfiler<Dtype>::Stats& forward =
+      profiler.stats(innerproduct, NetProfiler<Dtype>::FORWARD);
+  EXPECT_EQ(forward.count, 2);
+  EXPECT_LE(forward.min_us, forward.max_us);
+  EXPECT_LE(forward.max_us, forward.total_us);
+  int64_t histogram_count = 0;
+  for (int b = 0; b < forward.histogram.size(); ++b) {
+    histogram_count += forward.histogram[b];
+  }
+  EXPECT_EQ(histogram_count, 2);
+  // 5 inner products of 24 inputs and 1000 outputs.
+  EXPECT_EQ(forward.flops, 2 * 2 * 5 * 24 * 1000);
+  EXPECT_EQ(forward.bytes_read,
+      2 * (5 * 24 + 24 * 1000 + 1000) * sizeof(Dtype));
+  EXPECT_EQ(forward.bytes_written, 2 * 5 * 1000 * sizeof(Dtype));
+  EXPECT_EQ(profiler.stats(innerproduct, NetProfiler<Dtype>::BACKWARD).count,
+      1);
+  std::ostringstream json;
+  profiler.WriteJSON(&json);
+  EXPECT_NE(json.str().find("\"name\": \"innerproduct\""), string::npos);
+  EXPECT_NE(json.str().find("\"type\": \"SoftmaxWithLoss\""),
+      string::npos);
+  // Two forward passes of 3 layers and a backward pass of 2.
+  std::ostringstream trace;
+  profiler.WriteChromeTrace(&trace);
+  int num_events = 0;
+  for (size_t pos = trace.str().find("\"ph\": \"X\""); pos != string::npos;
+       pos = trace.str().find("\"ph\": \"X\"", pos + 1)) {
+    ++num_events;
+  }
+  EXPECT_EQ(num_events, 8);
+}
+
+TYPED_TEST(NetTest, TestAutoInPlace) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitElementwiseNet(false);
+  shared_ptr<Net<Dtype> > reference_net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitElementwiseNet(true);
+  // Power and ReLU run in place on the blobs they consume. TanH does not,
+  // as the net input must survive Forward, and neither does Sigmoid, whose
+  // bottom is a Split top sharing memory with the input of Eltwise.
+  const Net<Dtype>& net = *this->net_;
+  const vector<string>& names = net.layer_names();
+  const char* in_place_layers[] = { "power", "relu" };
+  for (int i = 0; i < 2; ++i) {
+    const int layer_id = std::find(names.begin(), names.end(),
+        in_place_layers[i]) - names.begin();
+    EXPECT_EQ(net.top_vecs()[layer_id][0], net.bottom_vecs()[layer_id][0]);
+  }
+  const char* other_layers[] = { "tanh", "sigmoid" };
+  for (int i = 0; i < 2; ++i) {
+    const int layer_id = std::find(names.begin(), names.end(),
+        other_layers[i]) - names.begin();
+    EXPECT_NE(net.top_vecs()[layer_id][0], net.bottom_vecs()[layer_id][0]);
+  }
+  EXPECT_EQ(net.blobs().size() + 2, reference_net->blobs().size());
+  // The consumed bottoms remain reachable as aliases of the tops.
+  EXPECT_TRUE(net.has_blob("sigmoid"));
+  EXPECT_EQ(net.blob_by_name("sigmoid"), net.blob_by_name("power"));
+  EXPECT_EQ(net.blob_by_name("sum"), net.blob_by_name("relu"));
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->net_->input_blobs()[0]);
+  reference_net->input_blobs()[0]->CopyFrom(*this->net_->input_blobs()[0]);
+  const Blob<Dtype>& output = *this->net_->Forward()[0];
+  const Blob<Dtype>& reference_output = *reference_net->Forward()[0];
+  ASSERT_EQ(output.count(), reference_output.count());
+  for (int i = 0; i < output.count(); ++i) {
+    EXPECT_EQ(reference_output.cpu_data()[i], output.cpu_data()[i]);
+  }
+  EXPECT_EQ(this->net_->output_blobs()[0],
+      this->net_->blob_by_name("relu").get());
+}
+
+TYPED_TEST(NetTest, TestFuseLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_random_seed(this->seed_);
+  this->InitConvBatchNormNet(false);
+  shared_ptr<Net<Dtype> > reference_net = this->net_;
+  // Give the BatchNorm and Scale layers nontrivial parameters.
+  FillerParameter filler_param;
+  filler_param.set_min(0.5);
+  filler_param.set_max(2);
+  UniformFiller<Dtype> positive_filler(filler_param);
+  filler_param.set_std(0.5);
+  GaussianFiller<Dtype> filler(filler_param);
+  const char* batch_norm_names[] = { "bn1", "bn2" };
+  for (int i = 0; i < 2; ++i) {
+    const vector<shared_ptr<Blob<Dtype> > >& blobs =
+        reference_net->layer_by_name(batch_norm_names[i])->blobs();
+    filler.Fill(blobs[0].get());
+    positive_filler.Fill(blobs[1].get());
+    blobs[2]->mutable_cpu_data()[0] = 2;
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& scale_blobs =
+      reference_net->layer_by_name("scale1")->blobs();
+  positive_filler.Fill(scale_blobs[0].get());
+  filler.Fill(scale_blobs[1].get());
+  NetParameter reference_param;
+  reference_net->ToProto(&reference_param);
+  // The weights are folded by layer name, whatever the topology of the
+  // trained net, here with its layers reversed and its BatchNorm layers
+  // computing batch statistics as in TRAIN.
+  NetParameter trained_param;
+  for (int i = reference_param.layer_size() - 1; i >= 0; --i) {
+    LayerParameter* layer = trained_param.add_layer();
+    layer->CopyFrom(reference_param.layer(i));
+    if (layer->type() == "BatchNorm") {
+      layer->mutable_batch_norm_param()->set_use_global_stats(false);
+    }
+  }
+  this->InitConvBatchNormNet(true);
+  this->net_->CopyTrainedLayersFrom(trained_param);
+  // Input, the two fused convolutions and pooling remain.
+  EXPECT_EQ(this->net_->layers().size(), 4);
+  EXPECT_FALSE(this->net_->has_layer("bn1"));
+  EXPECT_FALSE(this->net_->has_layer("relu1"));
+  filler.Fill(this->net_->input_blobs()[0]);
+  reference_net->input_blobs()[0]->CopyFrom(*this->net_->input_blobs()[0]);
+  const Blob<Dtype>& output = *this->net_->Forward()[0];
+  const Blob<Dtype>& reference_output = *reference_net->Forward()[0];
+  ASSERT_EQ(output.count(), reference_output.count());
+  for (int i = 0; i < output.count(); ++i) {
+    EXPECT_NEAR(reference_output.cpu_data()[i], output.cpu_data()[i], 1e-4);
+  }
+}
+
 }  // namespace caffe
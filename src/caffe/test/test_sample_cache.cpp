@@ -0,0 +1,93 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/sample_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class SampleCacheTest : public ::testing::Test {
+ protected:
+  // A decoded datum of the given shape, with pixels counting from first.
+  Datum MakeDatum(int channels, int height, int width, int first) {
+    Datum datum;
+    datum.set_channels(channels);
+    datum.set_height(height);
+    datum.set_width(width);
+    for (int i = 0; i < channels * height * width; ++i) {
+      datum.mutable_data()->push_back(static_cast<char>(first + i));
+    }
+    return datum;
+  }
+
+  void ExpectCached(const SampleCache& cache, int index,
+      const Datum& expected) {
+    Datum shape;
+    const char* data = NULL;
+    size_t data_size = 0;
+    ASSERT_TRUE(cache.Get(index, &shape, &data, &data_size));
+    EXPECT_EQ(expected.channels(), shape.channels());
+    EXPECT_EQ(expected.height(), shape.height());
+    EXPECT_EQ(expected.width(), shape.width());
+    EXPECT_FALSE(shape.encoded());
+    EXPECT_EQ(expected.data(), string(data, data_size));
+  }
+};
+
+TEST_F(SampleCacheTest, TestGetPut) {
+  SampleCache cache(1000);
+  Datum shape;
+  const char* data;
+  size_t data_size;
+  EXPECT_FALSE(cache.Get(0, &shape, &data, &data_size));
+  const Datum first = MakeDatum(3, 4, 5, 0);
+  const Datum second = MakeDatum(1, 2, 3, 100);
+  EXPECT_TRUE(cache.Put(7, first));
+  EXPECT_TRUE(cache.Put(2, second));
+  ExpectCached(cache, 7, first);
+  ExpectCached(cache, 2, second);
+  EXPECT_FALSE(cache.Get(0, &shape, &data, &data_size));
+  EXPECT_FALSE(cache.Get(8, &shape, &data, &data_size));
+  EXPECT_EQ(cache.count(), 2);
+  EXPECT_EQ(cache.size(), 66);
+  // Samples are cached once.
+  EXPECT_TRUE(cache.Put(7, second));
+  ExpectCached(cache, 7, first);
+  EXPECT_EQ(cache.count(), 2);
+}
+
+TEST_F(SampleCacheTest, TestCapacity) {
+  SampleCache cache(100);
+  const Datum sample = MakeDatum(2, 5, 5, 0);
+  EXPECT_TRUE(cache.Put(0, sample));
+  EXPECT_TRUE(cache.Put(1, sample));
+  EXPECT_FALSE(cache.Put(2, sample));
+  Datum shape;
+  const char* data;
+  size_t data_size;
+  EXPECT_FALSE(cache.Get(2, &shape, &data, &data_size));
+  ExpectCached(cache, 0, sample);
+  ExpectCached(cache, 1, sample);
+  EXPECT_EQ(cache.size(), 100);
+}
+
+TEST_F(SampleCacheTest, TestManyBlocks) {
+  // Samples of over half a block each start a new block, leaving the pixels
+  // of earlier blocks in place.
+  const int sample_size = 33;
+  SampleCache cache(4 * sample_size, 64);
+  Datum samples[4];
+  for (int i = 0; i < 4; ++i) {
+    samples[i] = MakeDatum(1, 1, sample_size, i);
+    EXPECT_TRUE(cache.Put(i, samples[i]));
+  }
+  for (int i = 0; i < 4; ++i) {
+    ExpectCached(cache, i, samples[i]);
+  }
+}
+
+}  // namespace caffe
@@ -9,6 +9,7 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/sgd_solvers.hpp"
 #include "caffe/solver.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -106,4 +107,75 @@ TYPED_TEST(SolverTest, TestInitTrainTestNets) {
   EXPECT_TRUE(this->solver_->test_nets()[1]->has_layer("accuracy"));
 }
 
+// Leaves the params as they are, unlike the update of SGDSolver.
+template <typename Dtype>
+class FrozenSGDSolver : public SGDSolver<Dtype> {
+ public:
+  explicit FrozenSGDSolver(const SolverParameter& param)
+      : SGDSolver<Dtype>(param), num_updates_(0) {}
+
+  int num_updates_;
+
+ protected:
+  virtual void ComputeUpdateValue(int param_id, Dtype rate) {
+    Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+    caffe_set(param->count(), Dtype(0), param->mutable_cpu_diff());
+    ++num_updates_;
+  }
+};
+
+TYPED_TEST(SolverTest, TestSubclassUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string& proto =
+     "base_lr: 0.1 "
+     "lr_policy: 'fixed' "
+     "momentum: 0.9 "
+     "weight_decay: 0.1 "
+     "net_param { "
+     "  name: 'TestNetwork' "
+     "  layer { "
+     "    name: 'data' "
+     "    type: 'DummyData' "
+     "    dummy_data_param { "
+     "      shape { dim: 5 dim: 3 } "
+     "      shape { dim: 5 } "
+     "      data_filler { type: 'gaussian' } "
+     "      data_filler { type: 'constant' } "
+     "    } "
+     "    top: 'data' "
+     "    top: 'label' "
+     "  } "
+     "  layer { "
+     "    name: 'innerprod' "
+     "    type: 'InnerProduct' "
+     "    inner_product_param { "
+     "      num_output: 2 "
+     "      weight_filler { type: 'gaussian' } "
+     "    } "
+     "    bottom: 'data' "
+     "    top: 'innerprod' "
+     "  } "
+     "  layer { "
+     "    name: 'loss' "
+     "    type: 'SoftmaxWithLoss' "
+     "    bottom: 'innerprod' "
+     "    bottom: 'label' "
+     "  } "
+     "} ";
+  SolverParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.set_solver_mode(Caffe::mode() == Caffe::CPU ?
+      SolverParameter_SolverMode_CPU : SolverParameter_SolverMode_GPU);
+  FrozenSGDSolver<Dtype> solver(param);
+  const Blob<Dtype>& weights = *solver.net()->learnable_params()[0];
+  const vector<Dtype> initial(weights.cpu_data(),
+      weights.cpu_data() + weights.count());
+  solver.Step(1);
+  // The overridden ComputeUpdateValue runs instead of the fused update.
+  EXPECT_EQ(solver.net()->learnable_params().size(), solver.num_updates_);
+  for (int i = 0; i < weights.count(); ++i) {
+    EXPECT_EQ(initial[i], weights.cpu_data()[i]);
+  }
+}
+
 }  // namespace caffe
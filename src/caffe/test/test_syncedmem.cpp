@@ -67,6 +67,22 @@ TEST_F(SyncedMemoryTest, TestCPUWrite) {
   }
 }
 
+TEST_F(SyncedMemoryTest, TestVersion) {
+  SyncedMemory mem(10);
+  size_t version = mem.version();
+  mem.cpu_data();
+  EXPECT_EQ(version, mem.version());
+  mem.mutable_cpu_data();
+  EXPECT_NE(version, mem.version());
+  version = mem.version();
+  char data[10];
+  mem.set_cpu_data(data);
+  EXPECT_NE(version, mem.version());
+  version = mem.version();
+  mem.cpu_data();
+  EXPECT_EQ(version, mem.version());
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestGPURead) {
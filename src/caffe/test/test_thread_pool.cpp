@@ -0,0 +1,84 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ThreadPoolTest : public ::testing::Test {
+ public:
+  void Count(int offset, int i) {
+    ++counts_[offset + i];
+  }
+
+  // Runs a nested batch from within a task of the pool.
+  void RunNested(ThreadPool* pool, int i) {
+    pool->Run(10, boost::bind(&ThreadPoolTest::Count, this, i * 10, _1));
+  }
+
+  void Done() {
+    boost::mutex::scoped_lock lock(mutex_);
+    ++num_done_;
+    condition_.notify_all();
+  }
+
+ protected:
+  ThreadPoolTest() : counts_(100, 0), num_done_(0) {}
+
+  vector<int> counts_;
+  int num_done_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+};
+
+TEST_F(ThreadPoolTest, TestRun) {
+  ThreadPool pool(3);
+  EXPECT_EQ(pool.num_threads(), 3);
+  pool.Run(counts_.size(), boost::bind(&ThreadPoolTest::Count, this, 0, _1));
+  for (int i = 0; i < counts_.size(); ++i) {
+    EXPECT_EQ(counts_[i], 1);
+  }
+}
+
+TEST_F(ThreadPoolTest, TestRunWithoutThreads) {
+  ThreadPool pool(0);
+  pool.Run(counts_.size(), boost::bind(&ThreadPoolTest::Count, this, 0, _1));
+  for (int i = 0; i < counts_.size(); ++i) {
+    EXPECT_EQ(counts_[i], 1);
+  }
+}
+
+TEST_F(ThreadPoolTest, TestNestedRun) {
+  // Every worker blocks in a nested Run, which must still complete.
+  ThreadPool pool(2);
+  pool.Run(10, boost::bind(&ThreadPoolTest::RunNested, this, &pool, _1));
+  for (int i = 0; i < counts_.size(); ++i) {
+    EXPECT_EQ(counts_[i], 1);
+  }
+}
+
+TEST_F(ThreadPoolTest, TestSchedule) {
+  ThreadPool pool(2);
+  for (int i = 0; i < 5; ++i) {
+    pool.Schedule(boost::bind(&ThreadPoolTest::Done, this));
+  }
+  boost::mutex::scoped_lock lock(mutex_);
+  while (num_done_ < 5) {
+    condition_.wait(lock);
+  }
+  EXPECT_EQ(num_done_, 5);
+}
+
+TEST_F(ThreadPoolTest, TestResolveNumThreads) {
+  EXPECT_EQ(ThreadPool::ResolveNumThreads(4), 4);
+  EXPECT_GE(ThreadPool::ResolveNumThreads(0), 1);
+}
+
+}  // namespace caffe
@@ -0,0 +1,299 @@
+#include "caffe/util/db_record_file.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace caffe { namespace db {
+
+static const uint32_t kChunkMagic = 0x43524543;  // "CREC"
+static const int kChunkHeaderSize = 16;
+static const int kRecordHeaderSize = 8;
+
+const int64_t RecordFile::kDefaultChunkSize;
+const int64_t RecordFile::kDefaultShardSize;
+
+// Loads and stores values at positions that may not be aligned for them.
+template <typename T>
+static T Load(const char* data) {
+  T value;
+  std::copy(data, data + sizeof(T), reinterpret_cast<char*>(&value));
+  return value;
+}
+
+template <typename T>
+static void Store(T value, char* data) {
+  const char* bytes = reinterpret_cast<const char*>(&value);
+  std::copy(bytes, bytes + sizeof(T), data);
+}
+
+static void WriteFully(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t written = write(fd, data, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(written, 0) << "Cannot write: " << strerror(errno);
+    data += written;
+    size -= written;
+  }
+}
+
+// Reads size bytes at offset, and returns false if the file ends before.
+static bool ReadFully(int fd, int64_t offset, char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t bytes = pread(fd, data, size, offset);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GE(bytes, 0) << "Cannot read: " << strerror(errno);
+    if (bytes == 0) {
+      return false;
+    }
+    data += bytes;
+    offset += bytes;
+    size -= bytes;
+  }
+  return true;
+}
+
+// The shards in source, in the order they were written.
+static vector<string> ListShards(const string& source) {
+  DIR* dir = opendir(source.c_str());
+  CHECK(dir) << "Cannot open " << source << ": " << strerror(errno);
+  vector<string> names;
+  for (dirent* entry = readdir(dir); entry; entry = readdir(dir)) {
+    const string name = entry->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".rec") == 0) {
+      names.push_back(name.substr(0, name.size() - 4));
+    }
+  }
+  closedir(dir);
+  // Shard names are zero-padded numbers, so that they sort in order.
+  std::sort(names.begin(), names.end());
+  vector<string> shards;
+  for (int i = 0; i < names.size(); ++i) {
+    shards.push_back(source + "/" + names[i]);
+  }
+  return shards;
+}
+
+RecordFileCursor::RecordFileCursor(const vector<string>& shards)
+    : shards_(shards), shard_(-1), fd_(-1), chunk_(0), position_(0),
+      records_left_(0), key_(NULL), key_size_(0), value_(NULL),
+      value_size_(0), valid_(false) {
+  SeekToFirst();
+}
+
+RecordFileCursor::~RecordFileCursor() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+void RecordFileCursor::SeekToFirst() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  shard_ = -1;
+  chunks_.clear();
+  chunk_ = 0;
+  valid_ = true;
+  NextChunk();
+}
+
+void RecordFileCursor::Next() {
+  if (records_left_ > 0) {
+    ReadRecord();
+  } else {
+    NextChunk();
+  }
+}
+
+void RecordFileCursor::NextChunk() {
+  while (chunk_ >= chunks_.size()) {
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+    if (++shard_ >= shards_.size()) {
+      valid_ = false;
+      return;
+    }
+    // Only the chunks in the index are complete.
+    chunks_.clear();
+    chunk_ = 0;
+    const string index = shards_[shard_] + ".idx";
+    const int index_fd = open(index.c_str(), O_RDONLY);
+    CHECK_GE(index_fd, 0) << "Cannot open " << index << ": "
+        << strerror(errno);
+    int64_t entry[2];
+    for (int64_t offset = 0; ReadFully(index_fd, offset,
+        reinterpret_cast<char*>(entry), sizeof(entry));
+        offset += sizeof(entry)) {
+      chunks_.push_back(std::make_pair(entry[0], entry[1]));
+    }
+    close(index_fd);
+    const string path = shards_[shard_] + ".rec";
+    fd_ = open(path.c_str(), O_RDONLY);
+    CHECK_GE(fd_, 0) << "Cannot open " << path << ": " << strerror(errno);
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
+  const int64_t offset = chunks_[chunk_].first;
+  const int64_t size = chunks_[chunk_].second;
+  ++chunk_;
+  buffer_.resize(size);
+  CHECK(ReadFully(fd_, offset, &buffer_[0], size))
+      << "Shard " << shards_[shard_] << " is shorter than its index";
+  // Have the kernel read the next chunk while this one is consumed, where
+  // the platform takes the hint (OS X has no posix_fadvise).
+#ifdef POSIX_FADV_WILLNEED
+  if (chunk_ < chunks_.size()) {
+    posix_fadvise(fd_, chunks_[chunk_].first, chunks_[chunk_].second,
+        POSIX_FADV_WILLNEED);
+  }
+#endif
+  const uint32_t magic = Load<uint32_t>(&buffer_[0]);
+  records_left_ = Load<uint32_t>(&buffer_[4]);
+  const uint64_t payload_size = Load<uint64_t>(&buffer_[8]);
+  CHECK_EQ(magic, kChunkMagic) << "Corrupt chunk in " << shards_[shard_];
+  CHECK_EQ(payload_size + kChunkHeaderSize, size)
+      << "Corrupt chunk in " << shards_[shard_];
+  position_ = kChunkHeaderSize;
+  if (records_left_ == 0) {
+    NextChunk();
+  } else {
+    ReadRecord();
+  }
+}
+
+void RecordFileCursor::ReadRecord() {
+  CHECK_LE(position_ + kRecordHeaderSize, buffer_.size())
+      << "Corrupt chunk in " << shards_[shard_];
+  key_size_ = Load<uint32_t>(&buffer_[position_]);
+  value_size_ = Load<uint32_t>(&buffer_[position_ + 4]);
+  position_ += kRecordHeaderSize;
+  CHECK_LE(position_ + key_size_ + value_size_, buffer_.size())
+      << "Corrupt chunk in " << shards_[shard_];
+  key_ = &buffer_[position_];
+  value_ = key_ + key_size_;
+  position_ += key_size_ + value_size_;
+  --records_left_;
+}
+
+void RecordFileTransaction::Put(const string& key, const string& value) {
+  keys_.push_back(key);
+  values_.push_back(value);
+}
+
+void RecordFileTransaction::Commit() {
+  for (int i = 0; i < keys_.size(); ++i) {
+    db_->Append(keys_[i], values_[i]);
+  }
+  keys_.clear();
+  values_.clear();
+}
+
+RecordFile::RecordFile(int64_t chunk_size, int64_t shard_size)
+    : chunk_size_(chunk_size), shard_size_(shard_size), mode_(READ),
+      fd_(-1), index_fd_(-1), shard_offset_(0), chunk_records_(0) {
+  CHECK_GT(chunk_size, 0);
+  CHECK_GT(shard_size, 0);
+}
+
+void RecordFile::Open(const string& source, Mode mode) {
+  if (mode == NEW) {
+    CHECK_EQ(mkdir(source.c_str(), 0744), 0) << "mkdir " << source << " failed";
+  }
+  source_ = source;
+  mode_ = mode;
+  shards_ = ListShards(source);
+  LOG(INFO) << "Opened record file " << source << " with " << shards_.size()
+      << " shards";
+}
+
+void RecordFile::Close() {
+  if (!chunk_.empty()) {
+    WriteChunk();
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    close(index_fd_);
+    fd_ = -1;
+    index_fd_ = -1;
+  }
+}
+
+RecordFileCursor* RecordFile::NewCursor() {
+  return new RecordFileCursor(shards_);
+}
+
+RecordFileTransaction* RecordFile::NewTransaction() {
+  CHECK_NE(mode_, READ) << "Record file " << source_ << " is read-only";
+  return new RecordFileTransaction(this);
+}
+
+void RecordFile::Append(const string& key, const string& value) {
+  const uint32_t sizes[2] = { static_cast<uint32_t>(key.size()),
+      static_cast<uint32_t>(value.size()) };
+  chunk_.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+  chunk_.append(key);
+  chunk_.append(value);
+  ++chunk_records_;
+  if (chunk_.size() >= chunk_size_) {
+    WriteChunk();
+  }
+}
+
+void RecordFile::WriteChunk() {
+  const int64_t size = kChunkHeaderSize + chunk_.size();
+  if (fd_ < 0 || shard_offset_ + size > shard_size_) {
+    NewShard();
+  }
+  char header[kChunkHeaderSize];
+  Store<uint32_t>(kChunkMagic, header);
+  Store<uint32_t>(chunk_records_, header + 4);
+  Store<uint64_t>(chunk_.size(), header + 8);
+  WriteFully(fd_, header, kChunkHeaderSize);
+  WriteFully(fd_, chunk_.data(), chunk_.size());
+  const int64_t entry[2] = { shard_offset_, size };
+  WriteFully(index_fd_, reinterpret_cast<const char*>(entry), sizeof(entry));
+  shard_offset_ += size;
+  chunk_.clear();
+  chunk_records_ = 0;
+}
+
+void RecordFile::NewShard() {
+  if (fd_ >= 0) {
+    close(fd_);
+    close(index_fd_);
+  }
+  // Never write to the shards of earlier writers, only after them.
+  char name[32];
+  snprintf(name, sizeof(name), "/%08d", static_cast<int>(shards_.size()));
+  const string shard = source_ + name;
+  const string path = shard + ".rec";
+  const string index = shard + ".idx";
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  CHECK_GE(fd_, 0) << "Cannot create " << path << ": " << strerror(errno);
+  index_fd_ = open(index.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  CHECK_GE(index_fd_, 0) << "Cannot create " << index << ": "
+      << strerror(errno);
+  shards_.push_back(shard);
+  shard_offset_ = 0;
+}
+
+}  // namespace db
+}  // namespace caffe
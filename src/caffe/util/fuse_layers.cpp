@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/fuse_layers.hpp"
+
+namespace caffe {
+
+namespace {
+
+// The producers and consumer counts of the tops of a net, as in InsertSplits.
+struct TopUsage {
+  explicit TopUsage(const NetParameter& param) {
+    map<string, pair<int, int> > blob_name_to_last_top_idx;
+    for (int i = 0; i < param.layer_size(); ++i) {
+      const LayerParameter& layer_param = param.layer(i);
+      for (int j = 0; j < layer_param.bottom_size(); ++j) {
+        const string& blob_name = layer_param.bottom(j);
+        if (blob_name_to_last_top_idx.count(blob_name)) {
+          const pair<int, int>& top_idx = blob_name_to_last_top_idx[blob_name];
+          bottom_idx_to_source_top_idx[make_pair(i, j)] = top_idx;
+          ++top_idx_to_bottom_count[top_idx];
+        }
+      }
+      for (int j = 0; j < layer_param.top_size(); ++j) {
+        blob_name_to_last_top_idx[layer_param.top(j)] = make_pair(i, j);
+      }
+      // A top used as a loss is consumed too.
+      for (int j = 0; j < layer_param.loss_weight_size() &&
+           j < layer_param.top_size(); ++j) {
+        if (layer_param.loss_weight(j)) {
+          ++top_idx_to_bottom_count[make_pair(i, j)];
+        }
+      }
+    }
+  }
+
+  // Whether layer next, of the given type, takes the only top of layer prev
+  // as its only bottom, and is the only layer to use that top.
+  bool Extends(const NetParameter& param, int prev, int next,
+      const string& type) {
+    if (next >= param.layer_size()) {
+      return false;
+    }
+    const LayerParameter& layer_param = param.layer(next);
+    if (layer_param.type() != type || layer_param.bottom_size() != 1 ||
+        layer_param.top_size() != 1) {
+      return false;
+    }
+    const pair<int, int> top_idx = make_pair(prev, 0);
+    map<pair<int, int>, pair<int, int> >::const_iterator source =
+        bottom_idx_to_source_top_idx.find(make_pair(next, 0));
+    return source != bottom_idx_to_source_top_idx.end() &&
+        source->second == top_idx && top_idx_to_bottom_count[top_idx] == 1;
+  }
+
+  map<pair<int, int>, pair<int, int> > bottom_idx_to_source_top_idx;
+  map<pair<int, int>, int> top_idx_to_bottom_count;
+};
+
+// Fold the statistics of batch_norm and the factors of scale, either of
+// which may be NULL, into the weights and bias of the fused convolution.
+void FoldWeights(const LayerParameter& conv, const LayerParameter* batch_norm,
+    const LayerParameter* scale, LayerParameter* fused) {
+  const bool kReshape = true;
+  Blob<double> weights;
+  weights.FromProto(conv.blobs(0), kReshape);
+  const int num_output = weights.shape(0);
+  const int filter_dim = weights.count(1);
+  // The chain computes multiplier * (weights * x) + shift per output channel.
+  vector<double> multiplier(num_output, 1);
+  vector<double> shift(num_output, 0);
+  if (conv.convolution_param().bias_term() && conv.blobs_size() > 1) {
+    Blob<double> bias;
+    bias.FromProto(conv.blobs(1), kReshape);
+    CHECK_EQ(bias.count(), num_output);
+    for (int k = 0; k < num_output; ++k) {
+      shift[k] = bias.cpu_data()[k];
+    }
+  }
+  if (batch_norm) {
+    Blob<double> mean, variance, scale_factor;
+    mean.FromProto(batch_norm->blobs(0), kReshape);
+    variance.FromProto(batch_norm->blobs(1), kReshape);
+    scale_factor.FromProto(batch_norm->blobs(2), kReshape);
+    CHECK_EQ(mean.count(), num_output)
+        << "BatchNorm " << batch_norm->name() << " does not match "
+        << conv.name();
+    CHECK_EQ(variance.count(), num_output);
+    // As in BatchNormLayer, the statistics are stored scaled.
+    const double factor = scale_factor.cpu_data()[0] == 0 ?
+        0 : 1 / scale_factor.cpu_data()[0];
+    const double eps = batch_norm->batch_norm_param().eps();
+    for (int k = 0; k < num_output; ++k) {
+      const double inv_std =
+          1 / std::sqrt(variance.cpu_data()[k] * factor + eps);
+      shift[k] = (shift[k] - mean.cpu_data()[k] * factor) * inv_std;
+      multiplier[k] *= inv_std;
+    }
+  }
+  if (scale) {
+    Blob<double> gamma;
+    gamma.FromProto(scale->blobs(0), kReshape);
+    CHECK_EQ(gamma.count(), num_output)
+        << "Scale " << scale->name() << " does not match " << conv.name();
+    Blob<double> beta;
+    if (scale->scale_param().bias_term()) {
+      beta.FromProto(scale->blobs(1), kReshape);
+      CHECK_EQ(beta.count(), num_output);
+    }
+    for (int k = 0; k < num_output; ++k) {
+      multiplier[k] *= gamma.cpu_data()[k];
+      shift[k] *= gamma.cpu_data()[k];
+      if (beta.count()) {
+        shift[k] += beta.cpu_data()[k];
+      }
+    }
+  }
+  double* weight_data = weights.mutable_cpu_data();
+  for (int k = 0; k < num_output; ++k) {
+    for (int i = 0; i < filter_dim; ++i) {
+      weight_data[k * filter_dim + i] *= multiplier[k];
+    }
+  }
+  Blob<double> bias(vector<int>(1, num_output));
+  std::copy(shift.begin(), shift.end(), bias.mutable_cpu_data());
+  // Keep the precision the weights were stored with.
+  if (conv.blobs(0).double_data_size() > 0) {
+    weights.ToProto(fused->add_blobs());
+    bias.ToProto(fused->add_blobs());
+  } else {
+    Blob<double>* blobs[] = { &weights, &bias };
+    for (int b = 0; b < 2; ++b) {
+      Blob<float> blob(blobs[b]->shape());
+      for (int i = 0; i < blob.count(); ++i) {
+        blob.mutable_cpu_data()[i] = blobs[b]->cpu_data()[i];
+      }
+      blob.ToProto(fused->add_blobs());
+    }
+  }
+}
+
+}  // namespace
+
+void FuseLayers(const NetParameter& param, NetParameter* param_fused,
+    vector<FusedLayers>* fused_layers) {
+  // Initialize by copying from the input NetParameter.
+  param_fused->CopyFrom(param);
+  param_fused->clear_layer();
+  fused_layers->clear();
+  TopUsage usage(param);
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& conv = param.layer(i);
+    if (conv.type() != "Convolution" || conv.bottom_size() != 1 ||
+        conv.top_size() != 1 || conv.convolution_param().fused_relu()) {
+      param_fused->add_layer()->CopyFrom(conv);
+      continue;
+    }
+    // Collect the chain following the convolution.
+    int last = i;
+    const LayerParameter* batch_norm = NULL;
+    const LayerParameter* scale = NULL;
+    const LayerParameter* relu = NULL;
+    if (usage.Extends(param, last, last + 1, "BatchNorm")) {
+      const BatchNormParameter& batch_norm_param =
+          param.layer(last + 1).batch_norm_param();
+      if (!batch_norm_param.has_use_global_stats() ||
+          batch_norm_param.use_global_stats()) {
+        batch_norm = &param.layer(++last);
+      }
+    }
+    if (usage.Extends(param, last, last + 1, "Scale")) {
+      const ScaleParameter& scale_param = param.layer(last + 1).scale_param();
+      if (scale_param.axis() == 1 && scale_param.num_axes() == 1) {
+        scale = &param.layer(++last);
+      }
+    }
+    if (usage.Extends(param, last, last + 1, "ReLU")) {
+      relu = &param.layer(++last);
+    }
+    if (last == i) {
+      param_fused->add_layer()->CopyFrom(conv);
+      continue;
+    }
+    LayerParameter* fused = param_fused->add_layer();
+    fused->CopyFrom(conv);
+    fused->set_top(0, param.layer(last).top(0));
+    ConvolutionParameter* conv_param = fused->mutable_convolution_param();
+    if (batch_norm || scale) {
+      FusedLayers folded;
+      folded.convolution = conv.name();
+      folded.batch_norm = batch_norm ? batch_norm->name() : "";
+      folded.scale = scale ? scale->name() : "";
+      fused_layers->push_back(folded);
+      conv_param->set_bias_term(true);
+      fused->clear_blobs();
+      // Only fold weights that are all there, e.g. in a trained model; a
+      // net definition without weights gets a convolution without blobs.
+      if (conv.blobs_size() > 0 &&
+          (!batch_norm || batch_norm->blobs_size() == 3) &&
+          (!scale || scale->blobs_size() > 0)) {
+        FoldWeights(conv, batch_norm, scale, fused);
+      }
+    }
+    if (relu) {
+      conv_param->set_fused_relu(true);
+      conv_param->set_fused_relu_negative_slope(
+          relu->relu_param().negative_slope());
+    }
+    LOG(INFO) << "Fused " << last - i << " layer(s) following "
+        << conv.name() << " into it";
+    i = last;
+  }
+}
+
+void FoldTrainedLayers(const NetParameter& param,
+    const vector<FusedLayers>& fused_layers, NetParameter* param_folded) {
+  map<string, const LayerParameter*> layers;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    layers[param.layer(i).name()] = &param.layer(i);
+  }
+  map<string, const FusedLayers*> chains;
+  set<string> folded_names;
+  for (int i = 0; i < fused_layers.size(); ++i) {
+    chains[fused_layers[i].convolution] = &fused_layers[i];
+    if (!fused_layers[i].batch_norm.empty()) {
+      folded_names.insert(fused_layers[i].batch_norm);
+    }
+    if (!fused_layers[i].scale.empty()) {
+      folded_names.insert(fused_layers[i].scale);
+    }
+  }
+  param_folded->CopyFrom(param);
+  param_folded->clear_layer();
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer = param.layer(i);
+    if (folded_names.count(layer.name())) {
+      continue;
+    }
+    LayerParameter* folded = param_folded->add_layer();
+    folded->CopyFrom(layer);
+    map<string, const FusedLayers*>::const_iterator chain =
+        chains.find(layer.name());
+    if (chain == chains.end()) {
+      continue;
+    }
+    const LayerParameter* batch_norm = NULL;
+    const LayerParameter* scale = NULL;
+    if (!chain->second->batch_norm.empty()) {
+      CHECK(layers.count(chain->second->batch_norm))
+          << "Cannot fold the weights of " << layer.name() << " without "
+          << "those of " << chain->second->batch_norm;
+      batch_norm = layers[chain->second->batch_norm];
+      CHECK_EQ(batch_norm->blobs_size(), 3)
+          << "Incompatible number of blobs for layer " << batch_norm->name();
+    }
+    if (!chain->second->scale.empty()) {
+      CHECK(layers.count(chain->second->scale))
+          << "Cannot fold the weights of " << layer.name() << " without "
+          << "those of " << chain->second->scale;
+      scale = layers[chain->second->scale];
+      CHECK_GT(scale->blobs_size(), 0)
+          << "Incompatible number of blobs for layer " << scale->name();
+    }
+    CHECK_GT(layer.blobs_size(), 0)
+        << "Incompatible number of blobs for layer " << layer.name();
+    folded->clear_blobs();
+    FoldWeights(layer, batch_norm, scale, folded);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "caffe/util/gradient_codec.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+const int GradientCodec<Dtype>::kBlockSize;
+
+// Reinterprets the bits of a value as a type of the same size.
+template <typename To, typename From>
+static To BitCast(From from) {
+  To to;
+  const char* bytes = reinterpret_cast<const char*>(&from);
+  std::copy(bytes, bytes + sizeof(To), reinterpret_cast<char*>(&to));
+  return to;
+}
+
+// Rounds value to the nearest half precision float, ties to even, and
+// saturates values too large for it to the largest finite one.
+static uint16_t FloatToHalf(float value) {
+  uint32_t bits = BitCast<uint32_t>(value);
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  bits &= 0x7fffffff;
+  if (bits >= 0x7f800000) {
+    // Infinity, or NaN kept quiet.
+    return sign | 0x7c00 | (bits > 0x7f800000 ? 0x200 : 0);
+  }
+  if (bits >= 0x477ff000) {
+    // 65520 and above round to infinity.
+    return sign | 0x7bff;
+  }
+  if (bits < 0x38800000) {
+    // Below 2^-14, subnormal halves count units of 2^-24, and values below
+    // half a unit round to zero.
+    if (bits < 0x33000000) {
+      return sign;
+    }
+    const int shift = 126 - static_cast<int>(bits >> 23);
+    const uint32_t mantissa = (bits & 0x7fffff) | 0x800000;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+      ++half;
+    }
+    return sign | half;
+  }
+  // Rebias the exponent from 127 to 15, and round the mantissa to 10 bits,
+  // which may carry into the exponent.
+  uint32_t half = (bits - 0x38000000) >> 13;
+  const uint32_t rest = bits & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return sign | half;
+}
+
+static float HalfToFloat(uint16_t half) {
+  const uint32_t exponent = (half >> 10) & 0x1f;
+  const uint32_t mantissa = half & 0x3ff;
+  float value;
+  if (exponent == 0) {
+    value = std::ldexp(static_cast<float>(mantissa), -24);
+  } else {
+    const uint32_t bits = (exponent == 0x1f ? 0x7f800000 :
+        (exponent + 112) << 23) | (mantissa << 13);
+    value = BitCast<float>(bits);
+  }
+  return (half & 0x8000) ? -value : value;
+}
+
+// Orders indices by decreasing magnitude of their values.
+template <typename Dtype>
+class GreaterMagnitude {
+ public:
+  explicit GreaterMagnitude(const Dtype* values) : values_(values) {}
+  bool operator()(uint32_t a, uint32_t b) const {
+    return std::fabs(values_[a]) > std::fabs(values_[b]);
+  }
+
+ private:
+  const Dtype* values_;
+};
+
+template <typename Dtype>
+GradientCodec<Dtype>::GradientCodec(
+    SolverParameter_SyncCompression compression, float top_k)
+    : compression_(compression), top_k_(top_k) {
+  if (compression == SolverParameter_SyncCompression_TOP_K) {
+    CHECK(top_k > 0 && top_k <= 1) << "sync_top_k must be in (0, 1]";
+  }
+}
+
+template <typename Dtype>
+size_t GradientCodec<Dtype>::TopK(size_t count) const {
+  const size_t k = std::floor(top_k_ * count + 0.5);
+  return std::min(count, std::max<size_t>(k, 1));
+}
+
+template <typename Dtype>
+size_t GradientCodec<Dtype>::EncodedBytes(size_t count) const {
+  switch (compression_) {
+  case SolverParameter_SyncCompression_NONE:
+    return count * sizeof(Dtype);
+  case SolverParameter_SyncCompression_FP16:
+    return count * sizeof(uint16_t);
+  case SolverParameter_SyncCompression_INT8:
+    return (count + kBlockSize - 1) / kBlockSize * sizeof(float) + count;
+  case SolverParameter_SyncCompression_TOP_K:
+    return TopK(count) * (sizeof(Dtype) + sizeof(uint32_t));
+  default:
+    LOG(FATAL) << "Unknown sync compression " << compression_;
+    return 0;
+  }
+}
+
+template <typename Dtype>
+void GradientCodec<Dtype>::Encode(size_t count, const Dtype* values,
+    Dtype* residual, void* encoded) {
+  for (size_t i = 0; i < count; ++i) {
+    residual[i] += values[i];
+  }
+  switch (compression_) {
+  case SolverParameter_SyncCompression_NONE: {
+    std::copy(residual, residual + count, static_cast<Dtype*>(encoded));
+    std::fill(residual, residual + count, Dtype(0));
+    break;
+  }
+  case SolverParameter_SyncCompression_FP16: {
+    uint16_t* halves = static_cast<uint16_t*>(encoded);
+    for (size_t i = 0; i < count; ++i) {
+      halves[i] = FloatToHalf(residual[i]);
+      residual[i] -= HalfToFloat(halves[i]);
+    }
+    break;
+  }
+  case SolverParameter_SyncCompression_INT8: {
+    const size_t blocks = (count + kBlockSize - 1) / kBlockSize;
+    float* scales = static_cast<float*>(encoded);
+    int8_t* quantized = reinterpret_cast<int8_t*>(scales + blocks);
+    for (size_t b = 0; b < blocks; ++b) {
+      const size_t begin = b * kBlockSize;
+      const size_t end = std::min(count, begin + kBlockSize);
+      Dtype max_abs = 0;
+      for (size_t i = begin; i < end; ++i) {
+        max_abs = std::max<Dtype>(max_abs, std::fabs(residual[i]));
+      }
+      const float scale = max_abs / 127;
+      scales[b] = scale;
+      for (size_t i = begin; i < end; ++i) {
+        const Dtype q = scale > 0 ? std::floor(residual[i] / scale + 0.5) : 0;
+        quantized[i] = std::max<Dtype>(-127, std::min<Dtype>(127, q));
+        residual[i] -= quantized[i] * scale;
+      }
+    }
+    break;
+  }
+  case SolverParameter_SyncCompression_TOP_K: {
+    CHECK_LE(count, std::numeric_limits<uint32_t>::max());
+    const size_t k = TopK(count);
+    indices_.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      indices_[i] = i;
+    }
+    std::nth_element(indices_.begin(), indices_.begin() + k, indices_.end(),
+        GreaterMagnitude<Dtype>(residual));
+    std::sort(indices_.begin(), indices_.begin() + k);
+    Dtype* kept = static_cast<Dtype*>(encoded);
+    uint32_t* kept_indices = reinterpret_cast<uint32_t*>(kept + k);
+    for (size_t j = 0; j < k; ++j) {
+      kept[j] = residual[indices_[j]];
+      kept_indices[j] = indices_[j];
+      residual[indices_[j]] = 0;
+    }
+    break;
+  }
+  default:
+    LOG(FATAL) << "Unknown sync compression " << compression_;
+  }
+}
+
+template <typename Dtype>
+void GradientCodec<Dtype>::DecodeAdd(size_t count, const void* encoded,
+    size_t begin, size_t end, Dtype* sum) const {
+  CHECK_LE(begin, end);
+  CHECK_LE(end, count);
+  switch (compression_) {
+  case SolverParameter_SyncCompression_NONE: {
+    const Dtype* values = static_cast<const Dtype*>(encoded);
+    for (size_t i = begin; i < end; ++i) {
+      sum[i - begin] += values[i];
+    }
+    break;
+  }
+  case SolverParameter_SyncCompression_FP16: {
+    const uint16_t* halves = static_cast<const uint16_t*>(encoded);
+    for (size_t i = begin; i < end; ++i) {
+      sum[i - begin] += HalfToFloat(halves[i]);
+    }
+    break;
+  }
+  case SolverParameter_SyncCompression_INT8: {
+    const size_t blocks = (count + kBlockSize - 1) / kBlockSize;
+    const float* scales = static_cast<const float*>(encoded);
+    const int8_t* quantized = reinterpret_cast<const int8_t*>(scales + blocks);
+    for (size_t i = begin; i < end; ++i) {
+      sum[i - begin] += quantized[i] * scales[i / kBlockSize];
+    }
+    break;
+  }
+  case SolverParameter_SyncCompression_TOP_K: {
+    const size_t k = TopK(count);
+    const Dtype* kept = static_cast<const Dtype*>(encoded);
+    const uint32_t* kept_indices = reinterpret_cast<const uint32_t*>(kept + k);
+    for (size_t j = std::lower_bound(kept_indices, kept_indices + k, begin) -
+        kept_indices; j < k && kept_indices[j] < end; ++j) {
+      sum[kept_indices[j] - begin] += kept[j];
+    }
+    break;
+  }
+  default:
+    LOG(FATAL) << "Unknown sync compression " << compression_;
+  }
+}
+
+INSTANTIATE_CLASS(GradientCodec);
+
+}  // namespace caffe
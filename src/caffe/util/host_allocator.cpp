@@ -0,0 +1,175 @@
+#include <boost/thread.hpp>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "caffe/util/host_allocator.hpp"
+
+namespace caffe {
+
+class HostAllocator::sync {
+ public:
+  mutable boost::mutex mutex_;
+};
+
+HostAllocator::HostAllocator()
+    : sync_(new sync()) {
+}
+
+HostAllocatorStats HostAllocator::stats() const {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  return stats_;
+}
+
+void HostAllocator::RecordAllocation(size_t size, bool cache_hit) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  stats_.bytes_in_use += size;
+  stats_.peak_bytes_in_use =
+      std::max(stats_.peak_bytes_in_use, stats_.bytes_in_use);
+  ++stats_.num_allocations;
+  if (cache_hit) {
+    ++stats_.num_cache_hits;
+    stats_.bytes_cached -= size;
+  }
+}
+
+void HostAllocator::RecordFree(size_t size, bool cached) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  stats_.bytes_in_use -= size;
+  if (cached) {
+    stats_.bytes_cached += size;
+  }
+}
+
+void HostAllocator::RecordRelease(size_t size) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  stats_.bytes_cached -= size;
+}
+
+// The process-wide allocator.
+static boost::mutex host_allocator_mutex_;
+static shared_ptr<HostAllocator> host_allocator_;
+
+shared_ptr<HostAllocator> HostAllocator::Get() {
+  boost::mutex::scoped_lock lock(host_allocator_mutex_);
+  if (!host_allocator_) {
+    host_allocator_.reset(new MallocHostAllocator());
+  }
+  return host_allocator_;
+}
+
+void HostAllocator::Set(shared_ptr<HostAllocator> allocator) {
+  CHECK(allocator);
+  boost::mutex::scoped_lock lock(host_allocator_mutex_);
+  host_allocator_ = allocator;
+}
+
+void* MallocHostAllocator::Allocate(size_t size) {
+  void* ptr = malloc(size);
+  if (ptr) {
+    RecordAllocation(size, false);
+  }
+  return ptr;
+}
+
+void MallocHostAllocator::Free(void* ptr, size_t size) {
+  free(ptr);
+  RecordFree(size, false);
+}
+
+class PoolHostAllocator::cache_sync {
+ public:
+  boost::mutex mutex_;
+};
+
+const size_t PoolHostAllocator::kAlignment;
+
+PoolHostAllocator::PoolHostAllocator(size_t max_bytes_cached)
+    : cache_sync_(new cache_sync()), max_bytes_cached_(max_bytes_cached),
+      bytes_cached_(0) {
+}
+
+PoolHostAllocator::~PoolHostAllocator() {
+  ReleaseCache();
+}
+
+size_t PoolHostAllocator::SizeClass(size_t size) {
+  if (size <= kAlignment) {
+    return kAlignment;
+  }
+  // Round up to a multiple of a quarter of the largest power of two not
+  // greater than size - 1, and at least to a multiple of kAlignment.
+  size_t step = 1;
+  for (size_t rest = (size - 1) >> 2; rest > 1; rest >>= 1) {
+    step <<= 1;
+  }
+  step = std::max(step, kAlignment);
+  return (size - 1) / step * step + step;
+}
+
+void* PoolHostAllocator::Allocate(size_t size) {
+  const size_t block_size = SizeClass(size);
+  void* ptr = NULL;
+  {
+    boost::mutex::scoped_lock lock(cache_sync_->mutex_);
+    std::map<size_t, std::vector<void*> >::iterator it =
+        free_blocks_.find(block_size);
+    if (it != free_blocks_.end() && !it->second.empty()) {
+      ptr = it->second.back();
+      it->second.pop_back();
+      bytes_cached_ -= block_size;
+    }
+  }
+  if (ptr) {
+    RecordAllocation(block_size, true);
+    return ptr;
+  }
+  if (posix_memalign(&ptr, kAlignment, block_size) != 0) {
+    // Give the cached memory back to the system and try again.
+    ReleaseCache();
+    if (posix_memalign(&ptr, kAlignment, block_size) != 0) {
+      return NULL;
+    }
+  }
+  RecordAllocation(block_size, false);
+  return ptr;
+}
+
+void PoolHostAllocator::Free(void* ptr, size_t size) {
+  const size_t block_size = SizeClass(size);
+  bool cached = false;
+  {
+    boost::mutex::scoped_lock lock(cache_sync_->mutex_);
+    if (max_bytes_cached_ == 0 ||
+        bytes_cached_ + block_size <= max_bytes_cached_) {
+      free_blocks_[block_size].push_back(ptr);
+      bytes_cached_ += block_size;
+      cached = true;
+    }
+  }
+  if (!cached) {
+    free(ptr);
+  }
+  RecordFree(block_size, cached);
+}
+
+void PoolHostAllocator::ReleaseCache() {
+  size_t released = 0;
+  {
+    boost::mutex::scoped_lock lock(cache_sync_->mutex_);
+    for (std::map<size_t, std::vector<void*> >::iterator it =
+         free_blocks_.begin(); it != free_blocks_.end(); ++it) {
+      for (int i = 0; i < it->second.size(); ++i) {
+        free(it->second[i]);
+      }
+      released += it->first * it->second.size();
+    }
+    free_blocks_.clear();
+    bytes_cached_ = 0;
+  }
+  RecordRelease(released);
+}
+
+}  // namespace caffe
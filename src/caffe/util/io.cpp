@@ -162,6 +162,55 @@ bool ReadFileToDatum(const string& filename, const int label,
   }
 }
 
+bool ParseDatumInPlace(const char* serialized, size_t size, Datum* datum,
+    const char** data, size_t* data_size) {
+  const uint8_t* buffer = reinterpret_cast<const uint8_t*>(serialized);
+  CodedInputStream input(buffer, size);
+  datum->Clear();
+  *data = NULL;
+  *data_size = 0;
+  // Skip over every field, merging all but the data field into datum.
+  while (!input.ExpectAtEnd()) {
+    const int begin = input.CurrentPosition();
+    const uint32_t tag = input.ReadTag();
+    const bool is_data = (tag >> 3) == Datum::kDataFieldNumber;
+    uint64_t varint;
+    uint32_t length;
+    bool ok;
+    switch (tag & 7) {
+    case 0:  // varint
+      ok = tag && input.ReadVarint64(&varint);
+      break;
+    case 1:  // fixed64
+      ok = input.Skip(8);
+      break;
+    case 2:  // length-delimited
+      ok = input.ReadVarint32(&length);
+      if (ok && is_data) {
+        *data = serialized + input.CurrentPosition();
+        *data_size = length;
+      }
+      ok = ok && input.Skip(length);
+      break;
+    case 5:  // fixed32
+      ok = input.Skip(4);
+      break;
+    default:
+      ok = false;
+    }
+    if (!ok) {
+      return false;
+    }
+    if (!is_data) {
+      CodedInputStream field(buffer + begin, input.CurrentPosition() - begin);
+      if (!datum->MergeFromCodedStream(&field)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 #ifdef USE_OPENCV
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum) {
   cv::Mat cv_img;
@@ -0,0 +1,222 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/util/mapped_weights.hpp"
+
+namespace caffe {
+
+static const char kMagic[8] = { 'C', 'A', 'F', 'F', 'E', 'W', 'T', 'S' };
+static const uint32_t kVersion = 1;
+static const size_t kHeaderSize = 24;
+static const uint32_t kLegacyShape = 1;
+
+const int MappedWeights::kAlignment;
+
+// Loads and stores values at positions that may not be aligned for them.
+template <typename T>
+static T Load(const char* data) {
+  T value;
+  std::copy(data, data + sizeof(T), reinterpret_cast<char*>(&value));
+  return value;
+}
+
+template <typename T>
+static void Append(T value, string* out) {
+  const char* bytes = reinterpret_cast<const char*>(&value);
+  out->append(bytes, sizeof(T));
+}
+
+static uint64_t Align(uint64_t offset) {
+  const uint64_t alignment = MappedWeights::kAlignment;
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Parses the index with bounds checks, as the file may be truncated.
+class IndexReader {
+ public:
+  IndexReader(const char* data, size_t size, const string& filename)
+      : data_(data), size_(size), position_(0), filename_(filename) {}
+
+  template <typename T>
+  T Read() {
+    CheckLeft(sizeof(T));
+    const T value = Load<T>(data_ + position_);
+    position_ += sizeof(T);
+    return value;
+  }
+
+  string ReadString(size_t size) {
+    CheckLeft(size);
+    const string value(data_ + position_, size);
+    position_ += size;
+    return value;
+  }
+
+ private:
+  void CheckLeft(size_t size) {
+    CHECK_LE(position_ + size, size_) << "Truncated index in " << filename_;
+  }
+
+  const char* data_;
+  size_t size_;
+  size_t position_;
+  string filename_;
+};
+
+MappedWeights::MappedWeights(const string& filename)
+    : filename_(filename), data_(NULL), size_(0) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Cannot open " << filename << ": " << strerror(errno);
+  struct stat st;
+  CHECK_EQ(fstat(fd, &st), 0) << "Cannot stat " << filename << ": "
+      << strerror(errno);
+  size_ = st.st_size;
+  CHECK_GE(size_, kHeaderSize) << filename << " is not a weights file";
+  void* data = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  CHECK(data != MAP_FAILED) << "Cannot map " << filename << ": "
+      << strerror(errno);
+  close(fd);
+  data_ = static_cast<char*>(data);
+
+  CHECK(std::equal(kMagic, kMagic + sizeof(kMagic), data_))
+      << filename << " is not a weights file";
+  const uint32_t version = Load<uint32_t>(data_ + 8);
+  CHECK_EQ(version, kVersion) << "Unsupported weights file version in "
+      << filename;
+  const uint32_t num_params = Load<uint32_t>(data_ + 12);
+  const uint64_t index_size = Load<uint64_t>(data_ + 16);
+  CHECK_LE(index_size, size_ - kHeaderSize) << "Truncated index in "
+      << filename;
+  IndexReader index(data_ + kHeaderSize, index_size, filename_);
+  params_.resize(num_params);
+  for (int i = 0; i < num_params; ++i) {
+    Param& param = params_[i];
+    param.layer_name = index.ReadString(index.Read<uint32_t>());
+    param.index = index.Read<uint32_t>();
+    const uint32_t type = index.Read<uint32_t>();
+    CHECK(type == FLOAT || type == DOUBLE) << "Unknown data type " << type
+        << " in " << filename;
+    param.type = static_cast<DataType>(type);
+    const uint32_t flags = index.Read<uint32_t>();
+    const uint32_t num_axes = index.Read<uint32_t>();
+    vector<int64_t> dims(num_axes);
+    for (int j = 0; j < num_axes; ++j) {
+      dims[j] = index.Read<int64_t>();
+    }
+    if (flags & kLegacyShape) {
+      CHECK_EQ(num_axes, 4) << "Legacy shapes have 4 axes in " << filename;
+      param.shape.set_num(dims[0]);
+      param.shape.set_channels(dims[1]);
+      param.shape.set_height(dims[2]);
+      param.shape.set_width(dims[3]);
+    } else {
+      BlobShape* shape = param.shape.mutable_shape();
+      for (int j = 0; j < num_axes; ++j) {
+        shape->add_dim(dims[j]);
+      }
+    }
+    const uint64_t offset = index.Read<uint64_t>();
+    param.count = index.Read<uint64_t>();
+    const size_t value_size = type == DOUBLE ? sizeof(double) : sizeof(float);
+    CHECK_EQ(offset % kAlignment, 0) << "Unaligned data in " << filename;
+    CHECK(offset <= size_ && param.count <= (size_ - offset) / value_size)
+        << "Truncated data in " << filename;
+    param.data = data_ + offset;
+  }
+}
+
+MappedWeights::~MappedWeights() {
+  if (data_) {
+    munmap(data_, size_);
+  }
+}
+
+void MappedWeights::Write(const NetParameter& param, const string& filename) {
+  // Lay out the index, then the data following it.
+  vector<const BlobProto*> blobs;
+  // The positions in the index of the offset of every blob, followed by its
+  // count, filled in once the size of the index is known.
+  vector<size_t> offset_positions;
+  string index;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer = param.layer(i);
+    for (int j = 0; j < layer.blobs_size(); ++j) {
+      const BlobProto& blob = layer.blobs(j);
+      blobs.push_back(&blob);
+      Append<uint32_t>(layer.name().size(), &index);
+      index.append(layer.name());
+      Append<uint32_t>(j, &index);
+      Append<uint32_t>(blob.double_data_size() > 0 ? DOUBLE : FLOAT, &index);
+      const bool legacy = blob.has_num() || blob.has_channels() ||
+          blob.has_height() || blob.has_width();
+      Append<uint32_t>(legacy ? kLegacyShape : 0, &index);
+      if (legacy) {
+        Append<uint32_t>(4, &index);
+        Append<int64_t>(blob.num(), &index);
+        Append<int64_t>(blob.channels(), &index);
+        Append<int64_t>(blob.height(), &index);
+        Append<int64_t>(blob.width(), &index);
+      } else {
+        Append<uint32_t>(blob.shape().dim_size(), &index);
+        for (int k = 0; k < blob.shape().dim_size(); ++k) {
+          Append<int64_t>(blob.shape().dim(k), &index);
+        }
+      }
+      offset_positions.push_back(index.size());
+      Append<uint64_t>(0, &index);
+      Append<uint64_t>(0, &index);
+    }
+  }
+  vector<uint64_t> offsets(blobs.size());
+  uint64_t offset = Align(kHeaderSize + index.size());
+  for (int i = 0; i < blobs.size(); ++i) {
+    const BlobProto& blob = *blobs[i];
+    const bool is_double = blob.double_data_size() > 0;
+    const uint64_t count = is_double ? blob.double_data_size() :
+        blob.data_size();
+    offsets[i] = offset;
+    string fields;
+    Append<uint64_t>(offset, &fields);
+    Append<uint64_t>(count, &fields);
+    index.replace(offset_positions[i], fields.size(), fields);
+    offset = Align(offset + count * (is_double ? sizeof(double) :
+        sizeof(float)));
+  }
+
+  std::ofstream out(filename.c_str(),
+      std::ios::out | std::ios::trunc | std::ios::binary);
+  CHECK(out) << "Cannot open " << filename;
+  string header(kMagic, sizeof(kMagic));
+  Append<uint32_t>(kVersion, &header);
+  Append<uint32_t>(blobs.size(), &header);
+  Append<uint64_t>(index.size(), &header);
+  out.write(header.data(), header.size());
+  out.write(index.data(), index.size());
+  uint64_t written = kHeaderSize + index.size();
+  for (int i = 0; i < blobs.size(); ++i) {
+    const string padding(offsets[i] - written, '\0');
+    out.write(padding.data(), padding.size());
+    const BlobProto& blob = *blobs[i];
+    if (blob.double_data_size() > 0) {
+      out.write(reinterpret_cast<const char*>(blob.double_data().data()),
+          blob.double_data_size() * sizeof(double));
+      written = offsets[i] + blob.double_data_size() * sizeof(double);
+    } else {
+      out.write(reinterpret_cast<const char*>(blob.data().data()),
+          blob.data_size() * sizeof(float));
+      written = offsets[i] + blob.data_size() * sizeof(float);
+    }
+  }
+  CHECK(out) << "Cannot write " << filename;
+}
+
+}  // namespace caffe
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "caffe/util/net_profiler.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+const int NetProfiler<Dtype>::kNumBuckets;
+
+template <typename Dtype>
+NetProfiler<Dtype>::Stats::Stats()
+    : count(0), total_us(0), min_us(0), max_us(0), bytes_read(0),
+      bytes_written(0), flops(0), histogram(kNumBuckets, 0) {}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::Stats::Add(int64_t duration_us, int64_t read,
+    int64_t written, int64_t flop_count) {
+  min_us = count ? std::min(min_us, duration_us) : duration_us;
+  max_us = count ? std::max(max_us, duration_us) : duration_us;
+  ++count;
+  total_us += duration_us;
+  bytes_read += read;
+  bytes_written += written;
+  flops += flop_count;
+  int bucket = 0;
+  while (bucket < kNumBuckets - 1 && (int64_t(1) << bucket) <= duration_us) {
+    ++bucket;
+  }
+  ++histogram[bucket];
+}
+
+template <typename Dtype>
+int64_t NetProfiler<Dtype>::Stats::Quantile(double q) const {
+  const int64_t rank = static_cast<int64_t>(q * count);
+  int64_t seen = 0;
+  for (int b = 0; b < kNumBuckets; ++b) {
+    seen += histogram[b];
+    if (seen > rank) {
+      return std::min(int64_t(1) << b, max_us);
+    }
+  }
+  return max_us;
+}
+
+template <typename Dtype>
+NetProfiler<Dtype>::NetProfiler(const vector<string>& layer_names,
+    const vector<string>& layer_types, int max_events)
+    : layer_names_(layer_names), layer_types_(layer_types),
+      max_events_(max_events), next_event_(0), start_us_(0) {
+  CHECK_EQ(layer_names.size(), layer_types.size());
+  CHECK_GE(max_events, 0);
+  Reset();
+}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::Reset() {
+  for (int pass = 0; pass < 2; ++pass) {
+    stats_[pass].assign(layer_names_.size(), Stats());
+  }
+  events_.clear();
+  next_event_ = 0;
+  origin_ = boost::posix_time::microsec_clock::local_time();
+}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::Start() {
+  start_us_ = (boost::posix_time::microsec_clock::local_time() - origin_)
+      .total_microseconds();
+  timer_.Start();
+}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::Stop(int layer_id, Pass pass,
+    Layer<Dtype>* layer, const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  const int64_t duration_us = timer_.MicroSeconds();
+  int64_t bottom_count = 0;
+  int64_t top_count = 0;
+  int64_t param_count = 0;
+  for (int i = 0; i < bottom.size(); ++i) {
+    bottom_count += bottom[i]->count();
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    top_count += top[i]->count();
+  }
+  for (int i = 0; i < layer->blobs().size(); ++i) {
+    param_count += layer->blobs()[i]->count();
+  }
+  int64_t flops = ForwardFlops(layer, bottom, top);
+  int64_t read, written;
+  if (pass == FORWARD) {
+    read = bottom_count + param_count;
+    written = top_count;
+  } else {
+    // The top data and diffs, the bottom data and the parameters are read,
+    // and the bottom and parameter diffs written.
+    read = 2 * top_count + bottom_count + param_count;
+    written = bottom_count + param_count;
+    // Layers with parameters compute gradients for the inputs and weights.
+    flops *= param_count ? 2 : 1;
+  }
+  stats_[pass][layer_id].Add(duration_us, read * sizeof(Dtype),
+      written * sizeof(Dtype), flops);
+  if (max_events_ == 0) {
+    return;
+  }
+  Event event = { layer_id, pass, start_us_, duration_us };
+  if (events_.size() < max_events_) {
+    events_.push_back(event);
+  } else {
+    events_[next_event_] = event;
+    next_event_ = (next_event_ + 1) % max_events_;
+  }
+}
+
+template <typename Dtype>
+int64_t NetProfiler<Dtype>::ForwardFlops(Layer<Dtype>* layer,
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const string type = layer->type();
+  if ((type == "Convolution" || type == "Deconvolution") &&
+      layer->blobs().size() > 0) {
+    // A multiply-add per output and filter element, and input and filter
+    // element for deconvolution.
+    const Blob<Dtype>& weights = *layer->blobs()[0];
+    const int64_t filter_dim = weights.count() / weights.shape(0);
+    const Blob<Dtype>& outputs = type == "Convolution" ? *top[0] : *bottom[0];
+    return 2 * int64_t(outputs.count()) * filter_dim;
+  }
+  if (type == "InnerProduct") {
+    const int axis = bottom[0]->CanonicalAxisIndex(
+        layer->layer_param().inner_product_param().axis());
+    return 2 * int64_t(top[0]->count()) * bottom[0]->count(axis);
+  }
+  // Element-wise layers take about an operation per output.
+  int64_t flops = 0;
+  for (int i = 0; i < top.size(); ++i) {
+    flops += top[i]->count();
+  }
+  return flops;
+}
+
+// Writes s as a JSON string.
+static void WriteJSONString(const string& s, std::ostream* out) {
+  *out << '"';
+  for (int i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') {
+      *out << '\\' << s[i];
+    } else if (static_cast<unsigned char>(s[i]) < 0x20) {
+      *out << ' ';
+    } else {
+      *out << s[i];
+    }
+  }
+  *out << '"';
+}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::WriteJSON(std::ostream* out) const {
+  const char* pass_names[] = { "forward", "backward" };
+  *out << "{\"layers\": [";
+  for (int i = 0; i < layer_names_.size(); ++i) {
+    *out << (i ? ",\n  " : "\n  ") << "{\"name\": ";
+    WriteJSONString(layer_names_[i], out);
+    *out << ", \"type\": ";
+    WriteJSONString(layer_types_[i], out);
+    for (int pass = 0; pass < 2; ++pass) {
+      const Stats& stats = stats_[pass][i];
+      const double mean_us = stats.count ?
+          static_cast<double>(stats.total_us) / stats.count : 0;
+      *out << ", \"" << pass_names[pass] << "\": {\"count\": " << stats.count
+          << ", \"total_us\": " << stats.total_us
+          << ", \"mean_us\": " << mean_us
+          << ", \"min_us\": " << stats.min_us
+          << ", \"max_us\": " << stats.max_us
+          << ", \"p50_us\": " << stats.Quantile(0.5)
+          << ", \"p90_us\": " << stats.Quantile(0.9)
+          << ", \"p99_us\": " << stats.Quantile(0.99)
+          << ", \"bytes_read\": " << stats.bytes_read
+          << ", \"bytes_written\": " << stats.bytes_written
+          << ", \"flops\": " << stats.flops
+          << ", \"gflops_per_s\": "
+          << (stats.total_us ? stats.flops / (stats.total_us * 1e3) : 0)
+          << ", \"histogram_us\": [";
+      // Pairs of bucket upper bounds and counts, for the buckets in use.
+      bool first = true;
+      for (int b = 0; b < kNumBuckets; ++b) {
+        if (stats.histogram[b]) {
+          *out << (first ? "" : ", ") << "[" << (int64_t(1) << b) << ", "
+              << stats.histogram[b] << "]";
+          first = false;
+        }
+      }
+      *out << "]}";
+    }
+    *out << "}";
+  }
+  *out << "\n]}\n";
+}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::WriteChromeTrace(std::ostream* out) const {
+  const char* pass_names[] = { "forward", "backward" };
+  *out << "{\"traceEvents\": [";
+  // Oldest first: once the ring is full, the oldest event is at next_event_.
+  for (int i = 0; i < events_.size(); ++i) {
+    const Event& event = events_[(next_event_ + i) % events_.size()];
+    *out << (i ? ",\n  " : "\n  ") << "{\"name\": ";
+    WriteJSONString(layer_names_[event.layer_id], out);
+    *out << ", \"cat\": \"" << pass_names[event.pass] << "\", \"ph\": \"X\""
+        << ", \"ts\": " << event.start_us << ", \"dur\": "
+        << event.duration_us << ", \"pid\": 0, \"tid\": " << event.pass
+        << ", \"args\": {\"type\": ";
+    WriteJSONString(layer_types_[event.layer_id], out);
+    *out << "}}";
+  }
+  *out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+}
+
+INSTANTIATE_CLASS(NetProfiler);
+
+}  // namespace caffe
@@ -0,0 +1,78 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "caffe/util/sample_cache.hpp"
+
+namespace caffe {
+
+const size_t SampleCache::kBlockSize;
+
+SampleCache::SampleCache(size_t capacity, size_t block_size)
+    : capacity_(capacity), block_size_(block_size), size_(0), count_(0),
+      block_used_(0), mutex_(new boost::mutex()) {
+}
+
+bool SampleCache::Get(int index, Datum* shape, const char** data,
+    size_t* data_size) const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  if (index >= entries_.size() || !entries_[index].data) {
+    return false;
+  }
+  const Entry& entry = entries_[index];
+  shape->set_channels(entry.channels);
+  shape->set_height(entry.height);
+  shape->set_width(entry.width);
+  shape->set_encoded(false);
+  *data = entry.data;
+  *data_size = entry.data_size;
+  return true;
+}
+
+bool SampleCache::Put(int index, const Datum& datum) {
+  CHECK_GE(index, 0);
+  CHECK(!datum.encoded()) << "Only decoded samples are cached";
+  const string& pixels = datum.data();
+  boost::mutex::scoped_lock lock(*mutex_);
+  if (index < entries_.size() && entries_[index].data) {
+    return true;
+  }
+  if (pixels.empty() || size_ + pixels.size() > capacity_) {
+    return false;
+  }
+  // Start a new block when the sample does not fit in the last one, sized
+  // to what is left of the capacity once that is less than a block.
+  if (blocks_.empty() || block_used_ + pixels.size() > blocks_.back()->size()) {
+    const size_t block_size = std::max(pixels.size(),
+        std::min(block_size_, capacity_ - size_));
+    blocks_.push_back(shared_ptr<vector<char> >(new vector<char>(block_size)));
+    block_used_ = 0;
+  }
+  char* data = &(*blocks_.back())[block_used_];
+  std::copy(pixels.begin(), pixels.end(), data);
+  block_used_ += pixels.size();
+  if (index >= entries_.size()) {
+    const Entry empty = { NULL, 0, 0, 0, 0 };
+    entries_.resize(index + 1, empty);
+  }
+  const Entry entry = { data, pixels.size(), datum.channels(), datum.height(),
+      datum.width() };
+  entries_[index] = entry;
+  size_ += pixels.size();
+  ++count_;
+  return true;
+}
+
+size_t SampleCache::size() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return size_;
+}
+
+int SampleCache::count() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return count_;
+}
+
+}  // namespace caffe
@@ -0,0 +1,154 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <exception>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+class ThreadPool::sync {
+ public:
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+};
+
+// The state of one Run call, shared by the caller and the workers helping it.
+class ThreadPool::Batch {
+ public:
+  Batch(int n, const boost::function<void(int)>& task)
+      : n_(n), task_(task), next_(0), done_(0) {}
+
+  // Claims and runs indices until none are left.
+  void Work() {
+    for (;;) {
+      int i;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (next_ == n_) {
+          return;
+        }
+        i = next_++;
+      }
+      task_(i);
+      boost::mutex::scoped_lock lock(mutex_);
+      if (++done_ == n_) {
+        condition_.notify_all();
+      }
+    }
+  }
+
+  void Wait() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (done_ < n_) {
+      condition_.wait(lock);
+    }
+  }
+
+ private:
+  const int n_;
+  const boost::function<void(int)> task_;
+  int next_;
+  int done_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+};
+
+ThreadPool::ThreadPool(int num_threads)
+    : sync_(new sync()), stopping_(false) {
+  CHECK_GE(num_threads, 0);
+  try {
+    for (int i = 0; i < num_threads; ++i) {
+      threads_.push_back(shared_ptr<boost::thread>(new boost::thread(
+          &ThreadPool::WorkerEntry, this)));
+    }
+  } catch (std::exception& e) {
+    LOG(FATAL) << "Thread exception: " << e.what();
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    stopping_ = true;
+  }
+  sync_->condition_.notify_all();
+  for (int i = 0; i < threads_.size(); ++i) {
+    threads_[i]->join();
+  }
+}
+
+void ThreadPool::WorkerEntry() {
+  for (;;) {
+    boost::function<void()> task;
+    {
+      boost::mutex::scoped_lock lock(sync_->mutex_);
+      while (tasks_.empty() && !stopping_) {
+        sync_->condition_.wait(lock);
+      }
+      if (tasks_.empty()) {
+        return;
+      }
+      task.swap(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+void ThreadPool::Schedule(const boost::function<void()>& task) {
+  CHECK(threads_.size()) << "Cannot schedule on a pool without threads.";
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    tasks_.push_back(task);
+  }
+  sync_->condition_.notify_one();
+}
+
+void ThreadPool::Run(int n, const boost::function<void(int)>& task) {
+  if (n <= 0) {
+    return;
+  }
+  if (n == 1 || threads_.empty()) {
+    for (int i = 0; i < n; ++i) {
+      task(i);
+    }
+    return;
+  }
+  shared_ptr<Batch> batch(new Batch(n, task));
+  // Helpers that start after the caller has claimed every index exit at once.
+  const int num_helpers = std::min<int>(n - 1, threads_.size());
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    for (int i = 0; i < num_helpers; ++i) {
+      tasks_.push_back(boost::bind(&Batch::Work, batch));
+    }
+  }
+  sync_->condition_.notify_all();
+  // The helpers run the task on the stack of the caller, which must not
+  // unwind before they are done, even if its thread is interrupted.
+  boost::this_thread::disable_interruption no_interruption;
+  batch->Work();
+  batch->Wait();
+}
+
+static boost::mutex global_thread_pool_mutex_;
+static shared_ptr<ThreadPool> global_thread_pool_;
+
+ThreadPool& ThreadPool::Global() {
+  boost::mutex::scoped_lock lock(global_thread_pool_mutex_);
+  if (!global_thread_pool_) {
+    global_thread_pool_.reset(new ThreadPool(ResolveNumThreads(0) - 1));
+  }
+  return *global_thread_pool_;
+}
+
+int ThreadPool::ResolveNumThreads(int num_threads) {
+  if (num_threads > 0) {
+    return num_threads;
+  }
+  return std::max(1u, boost::thread::hardware_concurrency());
+}
+
+}  // namespace caffe
@@ -5,14 +5,20 @@ namespace bp = boost::python;
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
 #include <map>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/signal_handler.h"
 
 using caffe::Blob;
@@ -30,6 +36,13 @@ DEFINE_string(gpu, "",
     "Optional; run in GPU mode on given device IDs separated by ','."
     "Use '-gpu all' to run on all available GPUs. The effective training "
     "batch size is multiplied by the number of devices.");
+DEFINE_int32(cpu_replicas, 1,
+    "Optional; in CPU mode, train with this many replicas of the solver, "
+    "each on its own slice of the data, averaging their gradients. The "
+    "effective training batch size is multiplied by the number of replicas.");
+DEFINE_string(cpu_replica_mode, "threads",
+    "Optional; run the CPU replicas as 'threads' of one process, or as "
+    "'processes' sharing memory.");
 DEFINE_string(solver, "",
     "The solver definition protocol buffer text file.");
 DEFINE_string(model, "",
@@ -51,9 +64,19 @@ DEFINE_int32(iterations, 50,
 DEFINE_string(sigint_effect, "stop",
              "Optional; action to take when a SIGINT signal is received: "
               "snapshot, stop or none.");
+DEFINE_string(profile, "",
+    "Optional; for 'test' and 'time', write the per-layer profile of the "
+    "net as JSON to the given file, and as a Chrome trace to the file "
+    "name with '.trace' appended.");
 DEFINE_string(sighup_effect, "snapshot",
              "Optional; action to take when a SIGHUP signal is received: "
              "snapshot, stop or none.");
+DEFINE_string(host_allocator, "malloc",
+    "Optional; the allocator of host memory: 'malloc', or 'pool' to cache "
+    "freed memory for later allocations of a similar size.");
+DEFINE_int32(host_pool_limit_mb, 0,
+    "Optional; with '-host_allocator pool', the megabytes of freed memory "
+    "to cache at most, 0 for no limit.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -108,6 +131,51 @@ static void get_gpus(vector<int>* gpus) {
   }
 }
 
+// Fork the processes of the CPU replicas of ranks above 0, and return the
+// rank of the calling process, with the ids of the forked ones for rank 0.
+static int fork_replicas(int replicas, vector<pid_t>* children) {
+  for (int rank = 1; rank < replicas; ++rank) {
+    const pid_t pid = fork();
+    CHECK_GE(pid, 0) << "Cannot fork: " << strerror(errno);
+    if (pid == 0) {
+      children->clear();
+      return rank;
+    }
+    children->push_back(pid);
+  }
+  return 0;
+}
+
+// Leave testing, snapshotting and reporting to the replica of rank 0, and
+// seed the others differently.
+static void set_replica_param(int rank, caffe::SolverParameter* param) {
+  param->clear_test_net();
+  param->clear_test_net_param();
+  param->clear_test_iter();
+  param->clear_test_state();
+  param->set_test_interval(0);
+  param->set_display(0);
+  param->set_snapshot(0);
+  param->set_snapshot_after_train(false);
+  if (param->random_seed() >= 0) {
+    param->set_random_seed(param->random_seed() + rank);
+  }
+}
+
+// Set the host allocator from flags, before any memory is allocated.
+static void set_host_allocator() {
+  if (FLAGS_host_allocator == "malloc") {
+    return;
+  }
+  CHECK_EQ(FLAGS_host_allocator, "pool")
+      << "Unknown host allocator " << FLAGS_host_allocator;
+  CHECK_GE(FLAGS_host_pool_limit_mb, 0);
+  shared_ptr<caffe::HostAllocator> allocator(new caffe::PoolHostAllocator(
+      static_cast<size_t>(FLAGS_host_pool_limit_mb) << 20));
+  caffe::HostAllocator::Set(allocator);
+  Caffe::set_host_allocator(allocator);
+}
+
 // Parse phase from flags
 caffe::Phase get_phase_from_flags(caffe::Phase default_value) {
   if (FLAGS_phase == "")
@@ -204,12 +272,22 @@ int train() {
       }
   }
 
+  CHECK_GE(FLAGS_cpu_replicas, 1);
   vector<int> gpus;
   get_gpus(&gpus);
   if (gpus.size() == 0) {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    if (FLAGS_cpu_replicas > 1) {
+      CHECK(FLAGS_cpu_replica_mode == "threads"
+          || FLAGS_cpu_replica_mode == "processes")
+          << "cpu_replica_mode must be \"threads\" or \"processes\"";
+      LOG(INFO) << "Using " << FLAGS_cpu_replicas << " CPU replicas as "
+          << FLAGS_cpu_replica_mode;
+      Caffe::set_solver_count(FLAGS_cpu_replicas);
+    }
   } else {
+    CHECK_EQ(FLAGS_cpu_replicas, 1) << "CPU replicas do not apply to GPUs.";
     ostringstream s;
     for (int i = 0; i < gpus.size(); ++i) {
       s << (i ? ", " : "") << gpus[i];
@@ -228,9 +306,29 @@ int train() {
     Caffe::set_solver_count(gpus.size());
   }
 
+  // CPU replicas in processes are forked before any thread is started, and
+  // create a solver each.
+  shared_ptr<caffe::CPUSyncGroup<float> > group;
+  vector<pid_t> children;
+  int rank = 0;
+  if (FLAGS_cpu_replicas > 1 && FLAGS_cpu_replica_mode == "processes") {
+    group.reset(new caffe::CPUSyncGroup<float>(FLAGS_cpu_replicas));
+    Caffe::set_multiprocess(true);
+    rank = fork_replicas(FLAGS_cpu_replicas, &children);
+    Caffe::set_solver_rank(rank);
+    if (rank > 0) {
+      FLAGS_minloglevel = std::max(FLAGS_minloglevel, 1);
+      set_replica_param(rank, &solver_param);
+    }
+  }
+
+  // Only the replica of rank 0 acts on signals, which reach all replica
+  // processes at once from a terminal; the others stop when it does.
   caffe::SignalHandler signal_handler(
-        GetRequestedAction(FLAGS_sigint_effect),
-        GetRequestedAction(FLAGS_sighup_effect));
+        rank > 0 ? caffe::SolverAction::NONE :
+            GetRequestedAction(FLAGS_sigint_effect),
+        rank > 0 ? caffe::SolverAction::NONE :
+            GetRequestedAction(FLAGS_sighup_effect));
 
   shared_ptr<caffe::Solver<float> >
       solver(caffe::SolverRegistry<float>::CreateSolver(solver_param));
@@ -247,16 +345,39 @@ int train() {
   if (gpus.size() > 1) {
     caffe::P2PSync<float> sync(solver, NULL, solver->param());
     sync.Run(gpus);
+  } else if (group) {
+    caffe::CPUSync<float>::RunProcess(solver, group, rank);
+  } else if (FLAGS_cpu_replicas > 1) {
+    caffe::CPUSync<float>::RunThreads(solver, FLAGS_cpu_replicas);
   } else {
     LOG(INFO) << "Starting Optimization";
     solver->Solve();
   }
+  for (int i = 0; i < children.size(); ++i) {
+    int status;
+    CHECK_EQ(waitpid(children[i], &status, 0), children[i]);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        << "CPU replica " << i + 1 << " failed";
+  }
   LOG(INFO) << "Optimization Done.";
   return 0;
 }
 RegisterBrewFunction(train);
 
 
+// Write the profile of a net to the files named by FLAGS_profile.
+static void write_profile(const Net<float>& net) {
+  std::ofstream json(FLAGS_profile.c_str());
+  CHECK(json) << "Cannot write " << FLAGS_profile;
+  net.profiler()->WriteJSON(&json);
+  const string trace_filename = FLAGS_profile + ".trace";
+  std::ofstream trace(trace_filename.c_str());
+  CHECK(trace) << "Cannot write " << trace_filename;
+  net.profiler()->WriteChromeTrace(&trace);
+  LOG(INFO) << "Wrote the profile to " << FLAGS_profile << " and "
+      << trace_filename;
+}
+
 // Test: score a model.
 int test() {
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to score.";
@@ -283,6 +404,7 @@ int test() {
   Net<float> caffe_net(FLAGS_model, caffe::TEST, FLAGS_level, &stages);
   caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
   LOG(INFO) << "Running for " << FLAGS_iterations << " iterations.";
+  caffe_net.set_profiling(!FLAGS_profile.empty());
 
   vector<int> test_score_output_id;
   vector<float> test_score;
@@ -324,6 +446,9 @@ int test() {
     }
     LOG(INFO) << output_name << " = " << mean_score << loss_msg_stream.str();
   }
+  if (!FLAGS_profile.empty()) {
+    write_profile(caffe_net);
+  }
 
   return 0;
 }
@@ -417,6 +542,15 @@ int time() {
     FLAGS_iterations << " ms.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
   LOG(INFO) << "*** Benchmark ends ***";
+  if (!FLAGS_profile.empty()) {
+    LOG(INFO) << "Profiling for " << FLAGS_iterations << " iterations.";
+    caffe_net.set_profiling(true);
+    for (int j = 0; j < FLAGS_iterations; ++j) {
+      caffe_net.Forward();
+      caffe_net.Backward();
+    }
+    write_profile(caffe_net);
+  }
   return 0;
 }
 RegisterBrewFunction(time);
@@ -436,6 +570,7 @@ int main(int argc, char** argv) {
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  set_host_allocator();
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {
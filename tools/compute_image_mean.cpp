@@ -19,7 +19,7 @@ using std::pair;
 using boost::scoped_ptr;
 
 DEFINE_string(backend, "lmdb",
-        "The backend {leveldb, lmdb} containing the images");
+        "The backend {leveldb, lmdb, recordfile} containing the images");
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -0,0 +1,29 @@
+// This is a script to convert the weights of a binary NetParameter proto to
+// a memory mapped weights file, which nets load by pointing their parameter
+// blobs at its pages instead of parsing and copying the proto.
+// Usage:
+//    convert_caffemodel weights_in.caffemodel weights_out.caffeweights
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/mapped_weights.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: convert_caffemodel weights_in.caffemodel "
+        << "weights_out.caffeweights";
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromBinaryFileOrDie(string(argv[1]), &net_param);
+  MappedWeights::Write(net_param, argv[2]);
+  LOG(INFO) << "Wrote memory mapped weights to " << argv[2];
+  return 0;
+}
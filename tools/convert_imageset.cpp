@@ -1,5 +1,5 @@
-// This program converts a set of images to a lmdb/leveldb by storing them
-// as Datum proto buffers.
+// This program converts a set of images to a lmdb/leveldb/recordfile by storing
+// them as Datum proto buffers.
 // Usage:
 //   convert_imageset [FLAGS] ROOTFOLDER/ LISTFILE DB_NAME
 //
@@ -20,6 +20,7 @@
 
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/db_record_file.hpp"
 #include "caffe/util/format.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/rng.hpp"
@@ -33,7 +34,9 @@ DEFINE_bool(gray, false,
 DEFINE_bool(shuffle, false,
     "Randomly shuffle the order of images and their labels");
 DEFINE_string(backend, "lmdb",
-        "The backend {lmdb, leveldb} for storing the result");
+        "The backend {lmdb, leveldb, recordfile} for storing the result");
+DEFINE_int32(shard_size_mb, 1024,
+        "The size in MB from which a recordfile starts a new shard");
 DEFINE_int32(resize_width, 0, "Width images are resized to");
 DEFINE_int32(resize_height, 0, "Height images are resized to");
 DEFINE_bool(check_size, false,
@@ -95,7 +98,13 @@ int main(int argc, char** argv) {
   int resize_width = std::max<int>(0, FLAGS_resize_width);
 
   // Create new DB
-  scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
+  scoped_ptr<db::DB> db;
+  if (FLAGS_backend == "recordfile") {
+    db.reset(new db::RecordFile(db::RecordFile::kDefaultChunkSize,
+        static_cast<int64_t>(FLAGS_shard_size_mb) << 20));
+  } else {
+    db.reset(db::GetDB(FLAGS_backend));
+  }
   db->Open(argv[3], db::NEW);
   scoped_ptr<db::Transaction> txn(db->NewTransaction());
 
@@ -0,0 +1,44 @@
+// This is a script to fold the BatchNorm, Scale and ReLU layers following
+// convolutions of a deploy network into the convolutions, for inference.
+// Usage:
+//    fuse_net_layers deploy_proto_in weights_in deploy_proto_out weights_out
+
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/fuse_layers.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: fuse_net_layers deploy_proto_in weights_in "
+        << "deploy_proto_out weights_out";
+    return 1;
+  }
+
+  NetParameter deploy_param;
+  ReadNetParamsFromTextFileOrDie(string(argv[1]), &deploy_param);
+  deploy_param.mutable_state()->set_phase(TEST);
+  NetParameter fused_param;
+  vector<FusedLayers> fused_layers;
+  FuseLayers(deploy_param, &fused_param, &fused_layers);
+  WriteProtoToTextFile(fused_param, argv[3]);
+  LOG(INFO) << "Folded " << fused_layers.size() << " convolution chains; "
+      << "wrote fused NetParameter text proto to " << argv[3];
+
+  // Load the weights into the fused net, which folds them, and save them.
+  deploy_param.set_fuse_layers(true);
+  Net<float> net(deploy_param);
+  net.CopyTrainedLayersFrom(string(argv[2]));
+  NetParameter weights_param;
+  net.ToProto(&weights_param);
+  WriteProtoToBinaryFile(weights_param, argv[4]);
+  LOG(INFO) << "Wrote fused NetParameter binary proto to " << argv[4];
+  return 0;
+}
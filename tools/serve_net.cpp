@@ -0,0 +1,341 @@
+// This program serves a deployed net to concurrent requests, coalescing the
+// requests into batches so that every Forward runs on many inputs at once.
+// Usage:
+//   serve_net [FLAGS] DEPLOY_PROTOTXT WEIGHTS
+//
+// Requests are read from stdin, or from the clients of the Unix socket given
+// by --socket, one per line, in the format
+//   ID VALUE VALUE ...
+// with as many values as one input of the net holds, e.g. channels x height x
+// width for an image net. Every request is answered with a line holding the
+// output blob of the net for that input,
+//   ID VALUE VALUE ...
+// or with a line "ID error MESSAGE". The responses on a connection follow
+// the order of its requests.
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/thread.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_string(socket, "",
+    "Optional; serve the clients of this Unix socket instead of stdin.");
+DEFINE_int32(max_batch_size, 32,
+    "The largest number of requests to run in one Forward.");
+DEFINE_int32(max_latency_ms, 5,
+    "How long the first request of a batch waits for more requests.");
+DEFINE_string(output, "",
+    "Optional; the blob to answer with, by default the first net output.");
+DEFINE_int32(gpu, -1,
+    "Optional; run in GPU mode on the given device ID.");
+
+// A request, answered by the batcher.
+struct Request {
+  Request() : done(false) {}
+
+  string id;
+  vector<float> input;
+  boost::system_time arrival;
+  vector<float> output;
+  string error;
+  bool done;
+};
+
+// The requests of all connections waiting to be batched.
+class RequestQueue {
+ public:
+  RequestQueue() : closed_(false) {}
+
+  void Push(Request* request) {
+    boost::mutex::scoped_lock lock(mutex_);
+    request->arrival = boost::get_system_time();
+    requests_.push_back(request);
+    pushed_.notify_one();
+  }
+
+  // Takes up to max_size requests into batch. Waits for a first request, and
+  // then for more until max_latency has passed since it arrived. Returns
+  // false once the queue is closed and empty.
+  bool PopBatch(int max_size, const boost::posix_time::time_duration&
+      max_latency, vector<Request*>* batch) {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (requests_.empty() && !closed_) {
+      pushed_.wait(lock);
+    }
+    if (requests_.empty()) {
+      return false;
+    }
+    const boost::system_time deadline = requests_.front()->arrival +
+        max_latency;
+    while (requests_.size() < static_cast<size_t>(max_size) && !closed_ &&
+        pushed_.timed_wait(lock, deadline)) {
+    }
+    batch->clear();
+    while (batch->size() < static_cast<size_t>(max_size) &&
+        !requests_.empty()) {
+      batch->push_back(requests_.front());
+      requests_.pop_front();
+    }
+    return true;
+  }
+
+  // Stops PopBatch from waiting once the requests left are batched.
+  void Close() {
+    boost::mutex::scoped_lock lock(mutex_);
+    closed_ = true;
+    pushed_.notify_all();
+  }
+
+  void Complete(Request* request) {
+    boost::mutex::scoped_lock lock(mutex_);
+    request->done = true;
+    completed_.notify_all();
+  }
+
+  void WaitDone(Request* request) {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!request->done) {
+      completed_.wait(lock);
+    }
+  }
+
+ private:
+  boost::mutex mutex_;
+  boost::condition_variable pushed_;
+  boost::condition_variable completed_;
+  std::deque<Request*> requests_;
+  bool closed_;
+};
+
+// The requests of a connection in order, ended by NULL.
+class PendingResponses {
+ public:
+  void Push(Request* request) {
+    boost::mutex::scoped_lock lock(mutex_);
+    requests_.push_back(request);
+    pushed_.notify_one();
+  }
+
+  Request* Pop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (requests_.empty()) {
+      pushed_.wait(lock);
+    }
+    Request* request = requests_.front();
+    requests_.pop_front();
+    return request;
+  }
+
+ private:
+  boost::mutex mutex_;
+  boost::condition_variable pushed_;
+  std::deque<Request*> requests_;
+};
+
+// Runs batches of requests through the net until the queue is closed.
+void ServeBatches(Net<float>* net, const Blob<float>* output,
+    RequestQueue* queue) {
+  Blob<float>* input = net->input_blobs()[0];
+  vector<int> input_shape = input->shape();
+  const int input_dim = input->count(1);
+  const boost::posix_time::time_duration max_latency =
+      boost::posix_time::milliseconds(FLAGS_max_latency_ms);
+  vector<Request*> requests;
+  while (queue->PopBatch(FLAGS_max_batch_size, max_latency, &requests)) {
+    vector<Request*> batch;
+    for (int i = 0; i < requests.size(); ++i) {
+      if (requests[i]->input.size() == static_cast<size_t>(input_dim)) {
+        batch.push_back(requests[i]);
+      } else {
+        std::ostringstream error;
+        error << "expected " << input_dim << " values but got "
+            << requests[i]->input.size();
+        requests[i]->error = error.str();
+        queue->Complete(requests[i]);
+      }
+    }
+    if (batch.empty()) {
+      continue;
+    }
+    input_shape[0] = batch.size();
+    input->Reshape(input_shape);
+    net->Reshape();
+    float* input_data = input->mutable_cpu_data();
+    for (int i = 0; i < batch.size(); ++i) {
+      std::copy(batch[i]->input.begin(), batch[i]->input.end(),
+          input_data + i * input_dim);
+    }
+    net->Forward();
+    CHECK_EQ(output->shape(0), static_cast<int>(batch.size()))
+        << "The output blob does not hold one item per input.";
+    const int output_dim = output->count(1);
+    const float* output_data = output->cpu_data();
+    for (int i = 0; i < batch.size(); ++i) {
+      batch[i]->output.assign(output_data + i * output_dim,
+          output_data + (i + 1) * output_dim);
+      queue->Complete(batch[i]);
+    }
+    DLOG(INFO) << "Served a batch of " << batch.size() << " requests";
+  }
+}
+
+bool ReadLine(FILE* in, string* line) {
+  line->clear();
+  char buffer[4096];
+  while (fgets(buffer, sizeof(buffer), in)) {
+    line->append(buffer);
+    if ((*line)[line->size() - 1] == '\n') {
+      line->resize(line->size() - 1);
+      return true;
+    }
+  }
+  return !line->empty();
+}
+
+// Writes the responses of a connection as its requests complete.
+void WriteResponses(FILE* out, RequestQueue* queue,
+    PendingResponses* pending) {
+  for (Request* request = pending->Pop(); request; request = pending->Pop()) {
+    queue->WaitDone(request);
+    fputs(request->id.c_str(), out);
+    if (request->error.empty()) {
+      for (int i = 0; i < request->output.size(); ++i) {
+        fprintf(out, " %.9g", request->output[i]);
+      }
+    } else {
+      fprintf(out, " error %s", request->error.c_str());
+    }
+    fputc('\n', out);
+    fflush(out);
+    delete request;
+  }
+}
+
+// Serves the requests of a connection until it ends, and closes it.
+void ServeConnection(FILE* in, FILE* out, RequestQueue* queue,
+    bool close_queue) {
+  PendingResponses pending;
+  boost::thread writer(&WriteResponses, out, queue, &pending);
+  string line;
+  while (ReadLine(in, &line)) {
+    std::istringstream fields(line);
+    Request* request = new Request();
+    if (!(fields >> request->id)) {
+      delete request;
+      continue;
+    }
+    float value;
+    while (fields >> value) {
+      request->input.push_back(value);
+    }
+    if (!fields.eof()) {
+      request->error = "cannot parse the input values";
+      request->done = true;
+    } else {
+      queue->Push(request);
+    }
+    pending.Push(request);
+  }
+  pending.Push(NULL);
+  writer.join();
+  fclose(in);
+  fclose(out);
+  if (close_queue) {
+    queue->Close();
+  }
+}
+
+int ListenOnSocket(const string& path) {
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK_GE(fd, 0) << "Cannot create a socket: " << strerror(errno);
+  sockaddr_un address = sockaddr_un();
+  address.sun_family = AF_UNIX;
+  CHECK_LT(path.size(), sizeof(address.sun_path)) << "Socket path too long";
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  unlink(path.c_str());
+  CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)),
+      0) << "Cannot bind to " << path << ": " << strerror(errno);
+  CHECK_EQ(listen(fd, SOMAXCONN), 0) << "Cannot listen on " << path << ": "
+      << strerror(errno);
+  return fd;
+}
+
+void AcceptClients(int fd, RequestQueue* queue) {
+  for (;;) {
+    const int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+      LOG(WARNING) << "Cannot accept a client: " << strerror(errno);
+      continue;
+    }
+    boost::thread(&ServeConnection, fdopen(client, "r"),
+        fdopen(dup(client), "w"), queue, false).detach();
+  }
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging); stdout holds responses.
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Serve a deployed net to requests from stdin or a\n"
+        "Unix socket, running them through the net in batches.\n"
+        "Usage:\n"
+        "    serve_net [FLAGS] DEPLOY_PROTOTXT WEIGHTS\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/serve_net");
+    return 1;
+  }
+  CHECK_GT(FLAGS_max_batch_size, 0);
+  CHECK_GE(FLAGS_max_latency_ms, 0);
+  if (FLAGS_gpu >= 0) {
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  }
+
+  Net<float> net(argv[1], TEST);
+  net.CopyTrainedLayersFrom(argv[2]);
+  CHECK_EQ(net.num_inputs(), 1) << "The net must have a single input.";
+  const Blob<float>* output = net.output_blobs()[0];
+  if (!FLAGS_output.empty()) {
+    CHECK(net.has_blob(FLAGS_output)) << "Unknown blob " << FLAGS_output;
+    output = net.blob_by_name(FLAGS_output).get();
+  }
+
+  RequestQueue queue;
+  if (FLAGS_socket.empty()) {
+    boost::thread(&ServeConnection, stdin, stdout, &queue, true).detach();
+  } else {
+    // Clients that hang up early must not end the server.
+    signal(SIGPIPE, SIG_IGN);
+    const int fd = ListenOnSocket(FLAGS_socket);
+    LOG(INFO) << "Listening on " << FLAGS_socket;
+    boost::thread(&AcceptClients, fd, &queue).detach();
+  }
+  ServeBatches(&net, output, &queue);
+  return 0;
+}